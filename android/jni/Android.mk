@@ -18,9 +18,11 @@ LOCAL_CFLAGS += -fopenmp
 LOCAL_LDFLAGS += -fopenmp
 LOCAL_MODULE    := hdr
 LOCAL_SRC_FILES := hdr.cpp \
+	$(SRC_PATH)/CLRuntime.cpp \
 	$(SRC_PATH)/Filter.cpp \
 	$(SRC_PATH)/HistEq.cpp \
 	$(SRC_PATH)/GradDom.cpp \
+	$(SRC_PATH)/DCT.cpp \
 	$(SRC_PATH)/ReinhardLocal.cpp \
 	$(SRC_PATH)/ReinhardGlobal.cpp
 
@@ -56,6 +56,7 @@ JNIEXPORT void JNICALL Java_com_uob_achohan_hdr_MyGLRenderer_processFrame(JNIEnv
 
 JNIEXPORT void JNICALL Java_com_uob_achohan_hdr_MyGLRenderer_killCL(JNIEnv* jenv, jobject obj) {
 	filter->cleanupOpenCL();
+	CLRuntime::release();	//the OpenGL context it shares with is going away
 }
 
 
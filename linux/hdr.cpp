@@ -11,6 +11,8 @@
 #include <cstring>
 #include <iostream>
 #include <map>
+#include <deque>
+#include <vector>
 #include <exception>
 #include <stdexcept>
 #include <sys/stat.h>
@@ -25,6 +27,9 @@
 #include "ReinhardLocal.h"
 #include "GradDom.h"
 #include "HistEq.h"
+#include "RGBE.h"
+#include "RadianceFile.h"
+#include "ExposureMerge.h"
 
 #define PIXEL_RANGE 255
 #define NUM_CHANNELS 4
@@ -35,6 +40,8 @@ using namespace std;
 struct _options_ {
 	map<string, Filter*> filters;
 	map<string, unsigned int> methods;
+	map<string, int> poissonSolvers;
+	map<string, unsigned int> inputTypes;
 
 	_options_() {
 		filters["histEq"] = new HistEq();
@@ -44,6 +51,15 @@ struct _options_ {
 
 		methods["reference"] = METHOD_REFERENCE;
 		methods["opencl"] = METHOD_OPENCL;
+		methods["native"] = METHOD_NATIVE;
+
+		poissonSolvers["jacobi"] = POISSON_JACOBI;
+		poissonSolvers["multigrid"] = POISSON_MULTIGRID;
+		poissonSolvers["dct"] = POISSON_DCT;
+
+		inputTypes["8bit"] = CL_UNSIGNED_INT8;
+		inputTypes["float"] = CL_FLOAT;
+		inputTypes["half"] = CL_HALF_FLOAT;
 	}
 } Options;
 
@@ -54,15 +70,44 @@ int updateStatus(const char *format, va_list args);
 void checkError(const char* message, int err);
 bool is_dir(const char* path);
 bool hasEnding (string const &fullString, string const &ending);
+//an image to be tone mapped, and in flight in the OpenCL pipeline
+struct Frame {
+	string path;
+	Image input, output;
+	RadianceImage radiance;	//the input as radiance, if the filter is given that
+	RadianceFile* file;	//the mapped file the radiance is in, if it was read from a .pfm or .raw file
+};
+
 Image readJPG(const char* filePath);
+RadianceImage readHDR(const char* filePath);
+RadianceImage toRadiance(const Image& image);
+Frame readFrame(const string& path, bool radiance);
+Frame mergeFrame(const vector<string>& paths, const vector<float>& times);
+void freeFrame(Frame& frame);
+bool isMapped(const string& path);
+string outputPath(string image_path, Filter* filter);
+void runBatch(Filter* filter, unsigned int method, const Filter::Params& params, const vector<string>& image_paths);
 void writeJPG(Image &image, const char* filePath);
+void writeRadiance(const Frame& frame, const char* filePath);
 
 
 int main(int argc, char *argv[]) {
 	Filter *filter = NULL;
 	Filter::Params params;
 	unsigned int method = 0;
-	string image_path;
+	int poisson_solver = 0;
+	bool autotune = false;
+	map<string, float> filter_params;
+	vector<string> image_paths;
+	vector<string> merge_paths;
+	vector<float> merge_times;	//0 for the exposure times to be estimated
+	string radiance_path;
+
+	//compiled programs are cached in the user's cache directory unless told otherwise
+	if (getenv("HOME")) {
+		params.cacheDir = string(getenv("HOME")) + "/.cache/hdr";
+		params.tuningFile = params.cacheDir + "/tuning";
+	}
 
 	// Parse arguments
 	for (int i = 1; i < argc; i++) {
@@ -96,8 +141,89 @@ int main(int argc, char *argv[]) {
 				cout << "Invalid image path with -image." << endl;
 				exit(1);
 			}
-			image_path = argv[i];
+			image_paths.push_back(argv[i]);
 		}		
+		else if (!strcmp(argv[i], "-clcache")) {	//directory of the program binary cache
+			++i;
+			if (i >= argc) {
+				cout << "Directory required with -clcache." << endl;
+				exit(1);
+			}
+			params.cacheDir = argv[i];
+		}
+		else if (!strcmp(argv[i], "-poisson")) {	//poisson solver used by gradDom
+			++i;
+			if (i >= argc || Options.poissonSolvers.find(argv[i]) == Options.poissonSolvers.end()) {
+				cout << "Invalid poisson solver with -poisson." << endl;
+				exit(1);
+			}
+			poisson_solver = Options.poissonSolvers[argv[i]];
+		}
+		else if (!strcmp(argv[i], "-param")) {	//tone mapping parameter of the filter
+			++i;
+			const char* value = (i < argc) ? strchr(argv[i], '=') : NULL;
+			if (!value || value == argv[i]) {
+				cout << "NAME=VALUE required with -param." << endl;
+				exit(1);
+			}
+			filter_params[string(argv[i], value - argv[i])] = atof(value+1);
+		}
+		else if (!strcmp(argv[i], "-tuning")) {	//file of the kernel sizes found by the autotuner
+			++i;
+			if (i >= argc) {
+				cout << "File required with -tuning." << endl;
+				exit(1);
+			}
+			params.tuningFile = argv[i];
+		}
+		else if (!strcmp(argv[i], "-autotune")) {	//find the fastest kernel sizes before tone mapping
+			autotune = true;
+		}
+		else if (!strcmp(argv[i], "-vector")) {	//pixels processed by each work item
+			++i;
+			if (i >= argc || (atoi(argv[i]) != 1 && atoi(argv[i]) != 4 && atoi(argv[i]) != 8)) {
+				cout << "Vector width of 1, 4 or 8 required with -vector." << endl;
+				exit(1);
+			}
+			params.vectorWidth = atoi(argv[i]);
+		}
+		else if (!strcmp(argv[i], "-input")) {	//format the filter is given the images in
+			++i;
+			if (i >= argc || Options.inputTypes.find(argv[i]) == Options.inputTypes.end()) {
+				cout << "Invalid input format with -input." << endl;
+				exit(1);
+			}
+			params.inputType = Options.inputTypes[argv[i]];
+		}
+		else if (!strcmp(argv[i], "-merge")) {	//exposure of the scene to merge into radiance
+			++i;
+			if (i >= argc) {
+				cout << "Image required with -merge." << endl;
+				exit(1);
+			}
+			//PATH=TIME gives the exposure time of the image, if the part after the last = is a number
+			const char* time = strrchr(argv[i], '=');
+			char* end = NULL;
+			if (time && time != argv[i] && strtod(time+1, &end) > 0 && end != time+1 && *end == '\0') {
+				merge_paths.push_back(string(argv[i], time - argv[i]));
+				merge_times.push_back(atof(time+1));
+			}
+			else {
+				merge_paths.push_back(argv[i]);
+				merge_times.push_back(0.f);
+			}
+		}
+		else if (!strcmp(argv[i], "-radiance")) {	//file to save the radiance given to the filter in
+			++i;
+			if (i >= argc) {
+				cout << "File required with -radiance." << endl;
+				exit(1);
+			}
+			radiance_path = argv[i];
+		}
+		else if (!strcmp(argv[i], "-profile")) {	//report the device time of each kernel
+			params.profile = true;
+		}
 		else if (!strcmp(argv[i], "-clinfo")) {
 			clinfo();
 			exit(0);
@@ -108,43 +234,167 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
-	if (image_path == "") image_path = "../test_images/lena-300x300.jpg";
-	Image input = readJPG(image_path.c_str());
+	if (poisson_solver) {
+		GradDom* gradDom = dynamic_cast<GradDom*>(filter);
+		if (gradDom) gradDom->setPoissonSolver(poisson_solver);
+	}
 
-	// Run filter
-	filter->setStatusCallback(updateStatus);
-	Image output = {(uchar*) calloc(input.width*input.height*NUM_CHANNELS, sizeof(uchar)), input.width, input.height};
+	map<string, float>::iterator paramItr;
+	for (paramItr = filter_params.begin(); paramItr != filter_params.end(); paramItr++) {
+		if (!filter->setParameter(paramItr->first.c_str(), paramItr->second)) {
+			cout << "Invalid parameter " << paramItr->first << " for " << filter->getName() << "." << endl;
+			exit(1);
+		}
+	}
 
+	if (!merge_paths.empty() && !image_paths.empty()) {
+		cout << "-merge can't be combined with -image." << endl;
+		exit(1);
+	}
+	if (image_paths.empty() && merge_paths.empty()) image_paths.push_back("../test_images/lena-300x300.jpg");
+
+	//merged exposures are radiance
+	if (!merge_paths.empty() && params.inputType == CL_UNSIGNED_INT8) params.inputType = CL_FLOAT;
+
+	//Radiance images are tone mapped from their radiance, so OpenCL is given float images unless told otherwise
+	for (int i = 0; i < image_paths.size(); i++) {
+		if (hasEnding(image_paths[i], ".hdr") && params.inputType == CL_UNSIGNED_INT8) params.inputType = CL_FLOAT;
+		//mapped files are large radiance maps, which runOpenCL reads where they are mapped rather than copying them
+		if (isMapped(image_paths[i])) {
+			if (params.inputType == CL_UNSIGNED_INT8) params.inputType = CL_FLOAT;
+			params.hostInput = true;
+		}
+	}
+
+	filter->setStatusCallback(updateStatus);
 	std::cout << "--------------------------------Tonemapping using " << filter->getName() << std::endl;
 
-	filter->setImageSize(input.width, input.height);
+	if (image_paths.size() > 1) {
+		if (!radiance_path.empty()) {
+			cout << "-radiance requires a single image." << endl;
+			exit(1);
+		}
+		runBatch(filter, method, params, image_paths);
+		CLRuntime::release();
+		return 0;
+	}
+
+	Frame frame = merge_paths.empty() ? readFrame(image_paths[0], params.inputType != CL_UNSIGNED_INT8)
+					: mergeFrame(merge_paths, merge_times);
+	string image_path = frame.path;
+	Image& input = frame.input;
+	RadianceImage& radiance = frame.radiance;
+	Image& output = frame.output;
+
+	if (!radiance_path.empty()) writeRadiance(frame, radiance_path.c_str());
+
+	// Run filter
+	filter->setImageSize(output.width, output.height);
 	switch (method)
 	{
 		case METHOD_REFERENCE:
-			filter->runReference(input.data, output.data);
+			if (radiance.data) filter->runReference(radiance.data, output.data);
+			else filter->runReference(input.data, output.data);
+			break;
+		case METHOD_NATIVE:
+			if (radiance.data) filter->runNative(radiance.data, output.data);
+			else filter->runNative(input.data, output.data);
 			break;
 		case METHOD_OPENCL:
 			filter->setupOpenCL(NULL, params);
-			filter->runOpenCL(input.data, output.data);
+			if (autotune) {
+				if (radiance.data) filter->autotune(radiance.data);
+				else filter->autotune(input.data);
+			}
+			if (radiance.data) filter->runOpenCL(radiance.data, output.data);
+			else filter->runOpenCL(input.data, output.data);
+			if (params.profile) filter->reportProfile(filter->getProfile());
 			filter->cleanupOpenCL();
 			break;
 		default:
 			assert(false && "Invalid method.");
 	}
 
-
 	//Save the file
-	int lastindex;
+	writeJPG(output, outputPath(image_path, filter).c_str());
+
+	freeFrame(frame);
+
+	//the OpenCL runtime is shared by all filters, so is only released once we are done with all of them
+	CLRuntime::release();
+
+	return 0;
+}
+
+string outputPath(string image_path, Filter* filter) {
 	if (is_dir(image_path.c_str()))	image_path = image_path.substr(0, image_path.find_last_of("/"));
 	else image_path = image_path.substr(0, image_path.find_last_of("."));
 
 	string image_name = image_path.substr(image_path.find_last_of("/")+1, 100);
 	string output_path = "../output_images/" + image_name + "_";
-	output_path = output_path + filter->getName() + ".jpg";
+	return output_path + filter->getName() + ".jpg";
+}
 
-	writeJPG(output, output_path.c_str());
 
-	return 0;
+void completeFrame(Filter* filter, deque<Frame>& frames) {
+	Frame& frame = frames.front();
+	filter->completeFrame();
+	writeJPG(frame.output, outputPath(frame.path, filter).c_str());
+	freeFrame(frame);
+	frames.pop_front();
+}
+
+//tone maps each of the images, with OpenCL the upload and readback of the images overlaps the kernels of the others
+void runBatch(Filter* filter, unsigned int method, const Filter::Params& params, const vector<string>& image_paths) {
+	deque<Frame> frames;
+	bool cl_ready = false;
+
+	double start = getCurrentTime();
+	for (int i = 0; i < image_paths.size(); i++) {
+		Frame frame = readFrame(image_paths[i], params.inputType != CL_UNSIGNED_INT8);
+
+		if (method == METHOD_REFERENCE || method == METHOD_NATIVE) {
+			filter->setImageSize(frame.output.width, frame.output.height);
+			filter->clearReferenceCache();
+			if (method == METHOD_NATIVE) {
+				if (frame.radiance.data) filter->runNative(frame.radiance.data, frame.output.data);
+				else filter->runNative(frame.input.data, frame.output.data);
+			}
+			else {
+				if (frame.radiance.data) filter->runReference(frame.radiance.data, frame.output.data);
+				else filter->runReference(frame.input.data, frame.output.data);
+			}
+			writeJPG(frame.output, outputPath(frame.path, filter).c_str());
+			freeFrame(frame);
+			continue;
+		}
+
+		//the frames in flight have to be finished before the images are resized
+		if (!frames.empty() && (frame.output.width != frames.back().output.width || frame.output.height != frames.back().output.height)) {
+			while (!frames.empty()) completeFrame(filter, frames);
+		}
+		filter->setImageSize(frame.output.width, frame.output.height);
+		if (!cl_ready) {
+			if (!filter->setupOpenCL(NULL, params)) exit(1);
+			cl_ready = true;
+		}
+
+		if (filter->pendingFrames() == NUM_FRAME_SLOTS) completeFrame(filter, frames);
+		bool submitted = frame.radiance.data ? filter->submitFrame(frame.radiance.data, frame.output.data)
+						: filter->submitFrame(frame.input.data, frame.output.data);
+		if (!submitted) exit(1);
+		frames.push_back(frame);
+	}
+	while (!frames.empty()) completeFrame(filter, frames);
+
+	double time = (getCurrentTime() - start)/1000;
+	cout << "Tone mapped " << image_paths.size() << " images in " << time << " ms ("
+		<< time/image_paths.size() << " ms per image)" << endl;
+
+	if (cl_ready) {
+		if (params.profile) filter->reportProfile(filter->getProfile());
+		filter->cleanupOpenCL();
+	}
 }
 
 Image readJPG(const char* filePath) {
@@ -170,6 +420,130 @@ Image readJPG(const char* filePath) {
 	return image;
 }
 
+//decodes the image a scanline at a time straight into the radiance given to the filter
+RadianceImage readHDR(const char* filePath) {
+	RGBEReader reader;
+	if (!reader.open(filePath)) throw std::runtime_error("Problem opening input file");
+
+	RadianceImage image = {(float*) calloc((size_t) reader.width()*reader.height()*NUM_CHANNELS, sizeof(float)), (size_t) reader.width(), (size_t) reader.height()};
+	RadianceView view(image.data, (int2){reader.width(), reader.height()});
+	for (int y = 0; y < reader.height(); y++) {
+		if (!reader.readScanline(view.row(y))) throw std::runtime_error("Problem reading input file");
+	}
+	return image;
+}
+
+//.pfm and .raw radiance maps are memory mapped instead of read
+bool isMapped(const string& path) {
+	return hasEnding(path, ".pfm") || hasEnding(path, ".raw");
+}
+
+//reads a JPEG, or a Radiance image or mapped file as radiance, the JPEG being converted to radiance if radiance is set
+Frame readFrame(const string& path, bool radiance) {
+	Frame frame;
+	frame.path = path;
+	frame.input.data = NULL;
+	frame.radiance.data = NULL;
+	frame.file = NULL;
+	if (isMapped(path)) {
+		RadianceFile* file = new RadianceFile();
+		if (!file->open(path.c_str())) {
+			delete file;
+			throw std::runtime_error("Problem opening input file");
+		}
+		frame.file = file;
+		frame.radiance = frame.file->image();
+		frame.input.width = frame.radiance.width;
+		frame.input.height = frame.radiance.height;
+	}
+	else if (hasEnding(path, ".hdr")) {
+		frame.radiance = readHDR(path.c_str());
+		frame.input.width = frame.radiance.width;
+		frame.input.height = frame.radiance.height;
+	}
+	else {
+		frame.input = readJPG(path.c_str());
+		if (radiance) frame.radiance = toRadiance(frame.input);
+	}
+
+	frame.output.width = frame.input.width;
+	frame.output.height = frame.input.height;
+	frame.output.data = (uchar*) calloc(frame.output.width*frame.output.height*NUM_CHANNELS, sizeof(uchar));
+	return frame;
+}
+
+//merges the exposures into radiance in memory, so they are tone mapped without writing a Radiance image
+Frame mergeFrame(const vector<string>& paths, const vector<float>& times) {
+	vector<Image> exposures;
+	for (int i = 0; i < paths.size(); i++) {
+		exposures.push_back(readJPG(paths[i].c_str()));
+		if (exposures[i].width != exposures[0].width || exposures[i].height != exposures[0].height) {
+			throw std::runtime_error("Exposures of different sizes");
+		}
+	}
+
+	Frame frame;
+	frame.path = paths[0];
+	frame.input.data = NULL;
+	frame.input.width = exposures[0].width;
+	frame.input.height = exposures[0].height;
+	frame.file = NULL;
+	frame.radiance.data = (float*) calloc(frame.input.width*frame.input.height*NUM_CHANNELS, sizeof(float));
+	frame.radiance.width = frame.input.width;
+	frame.radiance.height = frame.input.height;
+
+	ExposureMerge merge(frame.input.width, frame.input.height);
+	for (int i = 0; i < exposures.size(); i++) {
+		if (!merge.addExposure(exposures[i].data, times[i])) throw std::runtime_error("Problem estimating exposure time");
+	}
+	double start = getCurrentTime();
+	merge.merge(frame.radiance.data);
+	cout << "Merged " << exposures.size() << " exposures in " << (getCurrentTime() - start)/1000 << " ms (times";
+	for (int i = 0; i < exposures.size(); i++) cout << " " << merge.exposureTime(i);
+	cout << ")" << endl;
+	for (int i = 0; i < exposures.size(); i++) free(exposures[i].data);
+
+	frame.output.width = frame.input.width;
+	frame.output.height = frame.input.height;
+	frame.output.data = (uchar*) calloc(frame.output.width*frame.output.height*NUM_CHANNELS, sizeof(uchar));
+	return frame;
+}
+
+void freeFrame(Frame& frame) {
+	free(frame.input.data);
+	if (frame.file) delete frame.file;
+	else free(frame.radiance.data);
+	free(frame.output.data);
+}
+
+//the 8-bit pixels as radiance, 255 becoming 1
+RadianceImage toRadiance(const Image& image) {
+	RadianceImage radiance = {(float*) calloc(image.width*image.height*NUM_CHANNELS, sizeof(float)), image.width, image.height};
+	for (size_t i = 0; i < image.width*image.height*NUM_CHANNELS; i++) {
+		radiance.data[i] = image.data[i]/(float) PIXEL_RANGE;
+	}
+	return radiance;
+}
+
+//writes the radiance of the frame, or of its 8-bit pixels, as a raw radiance map for .raw files or a Radiance image
+void writeRadiance(const Frame& frame, const char* filePath) {
+	RadianceImage radiance = frame.radiance.data ? frame.radiance : toRadiance(frame.input);
+	if (hasEnding(filePath, ".raw")) {
+		bool written = RadianceFile::writeRaw(filePath, radiance);
+		if (radiance.data != frame.radiance.data) free(radiance.data);
+		if (!written) throw std::runtime_error("Problem writing output file");
+		return;
+	}
+
+	RGBEWriter writer;
+	bool written = writer.open(filePath, radiance.width, radiance.height);
+	RadianceView view(radiance.data, (int2){(int) radiance.width, (int) radiance.height});
+	for (int y = 0; y < (int) radiance.height && written; y++) written = writer.writeScanline(view.row(y));
+	written = writer.close() && written;
+	if (radiance.data != frame.radiance.data) free(radiance.data);
+	if (!written) throw std::runtime_error("Problem writing output file");
+}
+
 void writeJPG(Image &img, const char* filePath) {
 	FILE *outfile  = fopen(filePath, "wb");
 
@@ -193,12 +567,12 @@ void writeJPG(Image &img, const char* filePath) {
 	jpeg_start_compress(&cinfo, true);
 
 	uchar* charImageData = (uchar*) calloc(3*img.width*img.height, sizeof(uchar));
-	int2 pos;
-	int2 img_size = (int2){img.width, img.height};
-	for (pos.y = 0; pos.y < img.height; pos.y++) {
-		for (pos.x = 0; pos.x < img.width; pos.x++) {
+	PixelView image(img.data, (int2){(int) img.width, (int) img.height});
+	for (int y = 0; y < img.height; y++) {
+		uchar* row = image.row(y);
+		for (int x = 0; x < img.width; x++) {
 			for (int i=0; i < 3; i++)
-				charImageData[(pos.x + pos.y*img.width)*3 + i] = getPixel(img.data, img_size, pos, i);
+				charImageData[(x + y*img.width)*3 + i] = row[x*NUM_CHANNELS + i];
 		}
 	}
 
@@ -251,7 +625,7 @@ void clinfo() {
 
 
 void printUsage() {
-	cout << endl << "Usage: hdr FILTER METHOD [-image PATH] [-cldevice P:D]";
+	cout << endl << "Usage: hdr FILTER METHOD [-image PATH]... [-cldevice P:D] [-clcache DIR] [-poisson SOLVER] [-param NAME=VALUE] [-profile] [-autotune] [-tuning FILE] [-vector WIDTH] [-input FORMAT] [-merge PATH[=TIME]]... [-radiance FILE]";
 	cout << endl << "       hdr -clinfo" << endl;
 
 	cout << endl << "Where FILTER is one of:" << endl;
@@ -272,6 +646,80 @@ void printUsage() {
 	<< "indices reported by running -clinfo."
 	<< endl;
 
+	cout << endl
+	<< "Giving -image more than once tone maps all the " << endl
+	<< "images, overlapping their transfers with the kernels."
+	<< endl;
+
+	cout << endl
+	<< "Images ending in .hdr are read as Radiance RGBE " << endl
+	<< "images and tone mapped from their radiance."
+	<< endl;
+
+	cout << endl
+	<< "Images ending in .pfm or .raw are memory mapped. " << endl
+	<< "Raw files, a header of RGBA32F, the width and the " << endl
+	<< "height padded to 4096 bytes followed by RGBA floats, " << endl
+	<< "are tone mapped in place, OpenCL reading them from " << endl
+	<< "the mapping."
+	<< endl;
+
+	cout << endl
+	<< "Compiled OpenCL programs are cached in DIR, " << endl
+	<< "which defaults to $HOME/.cache/hdr. " << endl
+	<< "An empty DIR disables the cache."
+	<< endl;
+
+	cout << endl
+	<< "-autotune times the OpenCL kernels with a range of " << endl
+	<< "work-group sizes, the fastest being stored in FILE " << endl
+	<< "for later runs. FILE defaults to $HOME/.cache/hdr/tuning."
+	<< endl;
+
+	cout << endl
+	<< "-vector sets the number of pixels processed by each " << endl
+	<< "work item of the per-pixel OpenCL kernels to WIDTH, " << endl
+	<< "which is 1, 4 or 8. It defaults to the preferred " << endl
+	<< "float vector width of the device."
+	<< endl;
+
+	cout << endl
+	<< "-input gives the filter the images as 8bit pixels, " << endl
+	<< "which is the default, or as float radiance. With " << endl
+	<< "half, OpenCL is given the radiance as half floats."
+	<< endl;
+
+	cout << endl
+	<< "Giving -merge more than once merges the bracketed " << endl
+	<< "exposures of a scene into radiance, which is tone " << endl
+	<< "mapped. TIME is the relative exposure time of each, " << endl
+	<< "estimated from the previous exposure if left out."
+	<< endl;
+
+	cout << endl
+	<< "-radiance saves the radiance given to the filter, " << endl
+	<< "such as that of merged exposures, in FILE as a " << endl
+	<< "Radiance .hdr image, or as a raw radiance map if " << endl
+	<< "FILE ends in .raw."
+	<< endl;
+
+	cout << endl
+	<< "-profile reports the time each OpenCL kernel and " << endl
+	<< "transfer took on the device."
+	<< endl;
+
+	cout << endl
+	<< "Parameters of the filter can be changed with -param, e.g. " << endl
+	<< "key and sat of the reinhard filters, epsilon and phi of " << endl
+	<< "reinhardLocal, and adjust_alpha, beta and sat of gradDom."
+	<< endl;
+
+	cout << endl << "The poisson SOLVER used by the reference and native gradDom is one of:" << endl;
+	map<string, int>::iterator pItr;
+	for (pItr = Options.poissonSolvers.begin(); pItr != Options.poissonSolvers.end(); pItr++) {
+		cout << "\t" << pItr->first << endl;
+	}
+
 	cout << endl;
 }
 
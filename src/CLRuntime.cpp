@@ -0,0 +1,418 @@
+// CLRuntime.cpp (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+
+#include "Filter.h"
+#include "CLRuntime.h"
+
+namespace hdr
+{
+CLRuntime* CLRuntime::s_runtime = NULL;
+
+CLRuntime::CLRuntime(const Params& params) {
+	m_params = params;
+	m_statusCallback = NULL;
+	platform = 0;
+	device = 0;
+	context = 0;
+	queue = 0;
+	upload_queue = 0;
+	download_queue = 0;
+	max_cu = 0;
+	vector_width = 1;
+	m_users = 0;
+}
+
+CLRuntime::~CLRuntime() {
+	releaseCL();
+}
+
+CLRuntime* CLRuntime::get(cl_context_properties context_prop[], const Params& params, int (*callback)(const char*, va_list args)) {
+	if (s_runtime && (s_runtime->m_params.type != params.type
+				|| s_runtime->m_params.platformIndex != params.platformIndex
+				|| s_runtime->m_params.deviceIndex != params.deviceIndex
+				|| s_runtime->m_params.opengl != params.opengl
+				|| s_runtime->m_params.profile != params.profile)) {
+		//the filters using the runtime hold its context and queues, so it can only be replaced once they are done with it
+		if (s_runtime->m_users > 0) {
+			s_runtime->m_statusCallback = callback;
+			s_runtime->reportStatus("The OpenCL runtime is in use by %d filters with different parameters", s_runtime->m_users);
+			return NULL;
+		}
+		release();
+	}
+
+	if (!s_runtime) {
+		s_runtime = new CLRuntime(params);
+		s_runtime->m_statusCallback = callback;
+		if (!s_runtime->initCL(context_prop)) {
+			release();
+			return NULL;
+		}
+	}
+
+	s_runtime->m_statusCallback = callback;
+	s_runtime->m_params.cacheDir = params.cacheDir;
+	if (s_runtime->m_params.tuningFile != params.tuningFile) {
+		s_runtime->m_params.tuningFile = params.tuningFile;
+		s_runtime->loadTuning();
+	}
+	s_runtime->m_users++;
+	return s_runtime;
+}
+
+void CLRuntime::detach() {
+	m_users--;
+}
+
+void CLRuntime::release() {
+	delete s_runtime;
+	s_runtime = NULL;
+}
+
+
+std::string CLRuntime::deviceInfo(cl_device_info param) const {
+	size_t size = 0;
+	if (clGetDeviceInfo(device, param, 0, NULL, &size) != CL_SUCCESS || size == 0) return "";
+	std::vector<char> value(size + 1, '\0');
+	if (clGetDeviceInfo(device, param, size, &value[0], NULL) != CL_SUCCESS) return "";
+	return &value[0];
+}
+
+std::string CLRuntime::platformInfo(cl_platform_info param) const {
+	size_t size = 0;
+	if (clGetPlatformInfo(platform, param, 0, NULL, &size) != CL_SUCCESS || size == 0) return "";
+	std::vector<char> value(size + 1, '\0');
+	if (clGetPlatformInfo(platform, param, size, &value[0], NULL) != CL_SUCCESS) return "";
+	return &value[0];
+}
+
+bool CLRuntime::initCL(cl_context_properties context_prop[]) {
+	cl_int err;
+	cl_uint numPlatforms, numDevices;
+
+	cl_platform_id platforms[m_params.platformIndex+1];
+	err = clGetPlatformIDs(m_params.platformIndex+1, platforms, &numPlatforms);
+	CHECK_ERROR_OCL(err, "getting platforms", return false);
+	if (m_params.platformIndex >= numPlatforms) {
+		reportStatus("Platform index %d out of range (%d platforms found)",
+			m_params.platformIndex, numPlatforms);
+		return false;
+	}
+	platform = platforms[m_params.platformIndex];
+
+	cl_device_id devices[m_params.deviceIndex+1];
+	err = clGetDeviceIDs(platform, m_params.type, m_params.deviceIndex+1, devices, &numDevices);
+	CHECK_ERROR_OCL(err, "getting devices", return false);
+	if (m_params.deviceIndex >= numDevices) {
+		reportStatus("Device index %d out of range (%d devices found)",
+			m_params.deviceIndex, numDevices);
+		return false;
+	}
+	device = devices[m_params.deviceIndex];
+
+	//the name and versions identify the binaries in the cache and the tuned sizes, so they are queried at their full length
+	std::string name = deviceInfo(CL_DEVICE_NAME);
+	reportStatus("Using device: %s", name.c_str());
+	m_device_info = name + "\n" + deviceInfo(CL_DRIVER_VERSION) + "\n" + platformInfo(CL_PLATFORM_VERSION);
+
+	cl_ulong device_size;
+	clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(device_size), &device_size, NULL);
+	reportStatus("CL_DEVICE_GLOBAL_MEM_SIZE: %lu bytes", device_size);
+
+	clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(device_size), &device_size, NULL);
+	reportStatus("CL_DEVICE_LOCAL_MEM_SIZE: %lu bytes", device_size);
+
+	cl_uint compute_units;
+	clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &compute_units, NULL);
+	max_cu = compute_units;
+	reportStatus("CL_DEVICE_MAX_COMPUTE_UNITS: %lu", max_cu);
+
+	cl_uint preferred_width;
+	clGetDeviceInfo(device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT, sizeof(cl_uint), &preferred_width, NULL);
+	vector_width = (preferred_width >= 8) ? 8 : (preferred_width >= 4) ? 4 : 1;
+	reportStatus("CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT: %u", preferred_width);
+
+	if (m_params.opengl) context_prop[5] = (cl_context_properties) platform;
+
+	context = clCreateContext(context_prop, 1, &device, NULL, NULL, &err);
+	CHECK_ERROR_OCL(err, "creating context", return false);
+
+	cl_command_queue_properties queue_prop = m_params.profile ? CL_QUEUE_PROFILING_ENABLE : 0;
+	queue = clCreateCommandQueue(context, device, queue_prop, &err);
+	CHECK_ERROR_OCL(err, "creating command queue", return false);
+
+	upload_queue = clCreateCommandQueue(context, device, queue_prop, &err);
+	CHECK_ERROR_OCL(err, "creating upload command queue", return false);
+
+	download_queue = clCreateCommandQueue(context, device, queue_prop, &err);
+	CHECK_ERROR_OCL(err, "creating download command queue", return false);
+
+	loadTuning();
+
+	reportStatus("OpenCL context initialised.");
+	return true;
+}
+
+void CLRuntime::releaseCL() {
+	std::map<std::string, cl_program>::iterator itr;
+	for (itr = m_programs.begin(); itr != m_programs.end(); itr++) {
+		clReleaseProgram(itr->second);
+	}
+	m_programs.clear();
+
+	if (queue) {
+		clReleaseCommandQueue(queue);
+		queue = 0;
+	}
+	if (upload_queue) {
+		clReleaseCommandQueue(upload_queue);
+		upload_queue = 0;
+	}
+	if (download_queue) {
+		clReleaseCommandQueue(download_queue);
+		download_queue = 0;
+	}
+	if (context) {
+		clReleaseContext(context);
+		context = 0;
+	}
+}
+
+
+cl_program CLRuntime::buildProgram(const char *source, const char *options) {
+	std::string key = std::string(options ? options : "") + "\n" + source;
+
+	cl_program program;
+	std::map<std::string, cl_program>::iterator itr = m_programs.find(key);
+	if (itr != m_programs.end()) {
+		program = itr->second;
+		reportStatus("Using previously built program");
+	}
+	else if (!m_params.cacheDir.empty() && (program = loadBinary(binaryPath(source, options), options))) {
+		m_programs[key] = program;
+	}
+	else {
+		cl_int err;
+		//the runtime is shared, so a failure of one filter's program mustn't release it
+		program = clCreateProgramWithSource(context, 1, &source, NULL, &err);
+		if (err != CL_SUCCESS) {
+			reportStatus("Error during operation '%s' (%d)", "creating program", err);
+			return 0;
+		}
+
+		err = clBuildProgram(program, 1, &device, options, NULL, NULL);
+		if (err == CL_BUILD_PROGRAM_FAILURE) {
+			size_t sz;
+			clGetProgramBuildInfo(
+				program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &sz);
+			char *log = (char*)malloc(++sz);
+			clGetProgramBuildInfo(
+				program, device, CL_PROGRAM_BUILD_LOG, sz, log, NULL);
+			reportStatus(log);
+			free(log);
+		}
+		if (err != CL_SUCCESS) {
+			reportStatus("Error during operation '%s' (%d)", "building program", err);
+			clReleaseProgram(program);
+			return 0;
+		}
+		m_programs[key] = program;
+		if (!m_params.cacheDir.empty()) storeBinary(binaryPath(source, options), program);
+	}
+
+	clRetainProgram(program);
+	return program;
+}
+
+
+//create the directory along with any missing parents
+static void makeDirectories(const std::string& dir) {
+	for (size_t pos = dir.find('/', 1); pos != std::string::npos; pos = dir.find('/', pos+1)) {
+		mkdir(dir.substr(0, pos).c_str(), 0755);
+	}
+	mkdir(dir.c_str(), 0755);
+}
+
+//64-bit FNV-1a hash
+static uint64_t fnv1a(uint64_t hash, const std::string& data) {
+	for (size_t i = 0; i < data.size(); i++) {
+		hash ^= (unsigned char) data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+std::string CLRuntime::binaryPath(const char *source, const char *options) const {
+	uint64_t hash = 14695981039346656037ULL;
+	hash = fnv1a(hash, source);
+	hash = fnv1a(hash, std::string("\n") + (options ? options : ""));
+	hash = fnv1a(hash, "\n" + m_device_info);
+
+	char name[32];
+	sprintf(name, "/%016llx.bin", (unsigned long long) hash);
+	return m_params.cacheDir + name;
+}
+
+cl_program CLRuntime::loadBinary(const std::string& path, const char *options) {
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file) return 0;
+
+	fseek(file, 0, SEEK_END);
+	size_t size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	unsigned char* binary = (unsigned char*) malloc(size);
+	size_t read = fread(binary, 1, size, file);
+	fclose(file);
+	if (read != size) {
+		free(binary);
+		return 0;
+	}
+
+	//a stale or corrupt binary is not an error, the program is simply built from source instead
+	cl_int err, status;
+	const unsigned char* binaries[] = {binary};
+	cl_program program = clCreateProgramWithBinary(context, 1, &device, &size, binaries, &status, &err);
+	free(binary);
+	if (err != CL_SUCCESS || status != CL_SUCCESS) return 0;
+
+	err = clBuildProgram(program, 1, &device, options, NULL, NULL);
+	if (err != CL_SUCCESS) {
+		clReleaseProgram(program);
+		return 0;
+	}
+
+	reportStatus("Loaded program binary %s", path.c_str());
+	return program;
+}
+
+void CLRuntime::storeBinary(const std::string& path, cl_program program) {
+	size_t size;
+	cl_int err = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, NULL);
+	if (err != CL_SUCCESS || size == 0) return;
+
+	unsigned char* binary = (unsigned char*) malloc(size);
+	unsigned char* binaries[] = {binary};
+	err = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaries), binaries, NULL);
+	if (err != CL_SUCCESS) {
+		free(binary);
+		return;
+	}
+
+	makeDirectories(m_params.cacheDir);
+
+	//written to a temporary file first, so concurrent runs never load a partially written binary
+	char tmp_path[1024];
+	sprintf(tmp_path, "%.1000s.%d.tmp", path.c_str(), (int) getpid());
+	FILE* file = fopen(tmp_path, "wb");
+	if (file) {
+		bool written = fwrite(binary, 1, size, file) == size;
+		written = (fclose(file) == 0) && written;
+		if (written && rename(tmp_path, path.c_str()) == 0) reportStatus("Stored program binary %s", path.c_str());
+		else remove(tmp_path);
+	}
+	else {
+		reportStatus("Unable to write program binary %s (%s)", path.c_str(), strerror(errno));
+	}
+	free(binary);
+}
+
+
+//the tuning file has a line for each entry: device, kernel and size class separated by tabs,
+//followed by the local and global sizes
+std::string CLRuntime::tuningKey(const std::string& kernel, int size_class) const {
+	//the device name and driver version, the platform version doesn't affect the best sizes
+	std::string device = m_device_info.substr(0, m_device_info.rfind('\n'));
+	std::replace(device.begin(), device.end(), '\n', ' ');
+
+	char size[16];
+	sprintf(size, "%d", size_class);
+	return device + "\t" + kernel + "\t" + size;
+}
+
+void CLRuntime::loadTuning() {
+	m_tuning.clear();
+	if (m_params.tuningFile.empty()) return;
+
+	FILE* file = fopen(m_params.tuningFile.c_str(), "r");
+	if (!file) return;
+
+	char line[1024];
+	while (fgets(line, sizeof(line), file)) {
+		char* sizes = strrchr(line, '\t');
+		if (!sizes) continue;
+
+		std::vector<size_t> values(4);
+		unsigned long l0, l1, g0, g1;
+		if (sscanf(sizes+1, "%lu %lu %lu %lu", &l0, &l1, &g0, &g1) != 4) continue;
+		values[0] = l0; values[1] = l1; values[2] = g0; values[3] = g1;
+		m_tuning[std::string(line, sizes - line)] = values;
+	}
+	fclose(file);
+	reportStatus("Loaded %d tuned kernel sizes from %s", (int) m_tuning.size(), m_params.tuningFile.c_str());
+}
+
+bool CLRuntime::saveTuning() const {
+	if (m_params.tuningFile.empty()) return false;
+
+	size_t dir = m_params.tuningFile.rfind('/');
+	if (dir != std::string::npos && dir > 0) makeDirectories(m_params.tuningFile.substr(0, dir));
+
+	FILE* file = fopen(m_params.tuningFile.c_str(), "w");
+	if (!file) {
+		reportStatus("Unable to write tuning file %s (%s)", m_params.tuningFile.c_str(), strerror(errno));
+		return false;
+	}
+
+	std::map<std::string, std::vector<size_t> >::const_iterator itr;
+	for (itr = m_tuning.begin(); itr != m_tuning.end(); itr++) {
+		const std::vector<size_t>& v = itr->second;
+		fprintf(file, "%s\t%lu %lu %lu %lu\n", itr->first.c_str(),
+			(unsigned long) v[0], (unsigned long) v[1], (unsigned long) v[2], (unsigned long) v[3]);
+	}
+	fclose(file);
+	return true;
+}
+
+bool CLRuntime::tunedSizes(const std::string& kernel, int size_class, size_t local[2], size_t global[2]) const {
+	std::map<std::string, std::vector<size_t> >::const_iterator itr = m_tuning.find(tuningKey(kernel, size_class));
+	if (itr == m_tuning.end()) return false;
+
+	local[0]  = itr->second[0];
+	local[1]  = itr->second[1];
+	global[0] = itr->second[2];
+	global[1] = itr->second[3];
+	return true;
+}
+
+void CLRuntime::setTunedSizes(const std::string& kernel, int size_class, const size_t local[2], const size_t global[2]) {
+	std::vector<size_t> values(4);
+	values[0] = local[0];
+	values[1] = local[1];
+	values[2] = global[0];
+	values[3] = global[1];
+	m_tuning[tuningKey(kernel, size_class)] = values;
+}
+
+
+void CLRuntime::reportStatus(const char *format, ...) const {
+	if (m_statusCallback) {
+		va_list args;
+		va_start(args, format);
+		m_statusCallback(format, args);
+		va_end(args);
+	}
+}
+}
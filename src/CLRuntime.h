@@ -0,0 +1,102 @@
+// CLRuntime.h (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdarg.h>
+#include <CL/cl.h>
+#include <CL/cl_gl.h>
+
+namespace hdr
+{
+//OpenCL platform, device, context and command queue shared by all the filters
+//it is created by the first filter to set up OpenCL and persists until explicitly released
+class CLRuntime {
+public:
+	typedef struct _Params_ {
+		cl_device_type type;
+		cl_uint platformIndex, deviceIndex;
+		bool opengl, verify;
+		bool profile;	//record the device time of every command, which the queues must be created for
+		std::string cacheDir;	//directory of the program binary cache, empty to disable it
+		std::string tuningFile;	//work-group sizes found by the autotuner, empty to disable it
+		int vectorWidth;	//pixels processed by each work item of the per-pixel kernels, 1, 4 or 8, 0 for the device's preferred width
+		cl_channel_type inputType;	//channel type of the input images, CL_UNSIGNED_INT8 for 8-bit pixels or CL_FLOAT or CL_HALF_FLOAT for radiance
+		bool hostInput;	//runOpenCL reads frames from host memory (CL_MEM_USE_HOST_PTR) instead of writing them to the input image
+		_Params_() {
+			type = CL_DEVICE_TYPE_ALL;
+			opengl = false;
+			deviceIndex = 0;
+			platformIndex = 0;
+			verify = false;
+			profile = false;
+			vectorWidth = 0;
+			inputType = CL_UNSIGNED_INT8;
+			hostInput = false;
+		}
+	} Params;
+
+	//returns the shared runtime, creating it if there is none or if the existing one was created with different parameters
+	//and is no longer used, NULL if filters still use one with different parameters. Each filter given it must detach
+	static CLRuntime* get(cl_context_properties context_prop[], const Params& params, int (*callback)(const char*, va_list args));
+	void detach();
+	//releases the shared runtime along with all of its programs, once the filters have released their OpenCL
+	static void release();
+
+	//builds the program, or returns the one already built from the same source and options
+	//the caller owns a reference to the returned program
+	cl_program buildProgram(const char *source, const char *options);
+
+	//global and local sizes found by the autotuner for this device, keyed by the kernel and the image size class
+	bool tunedSizes(const std::string& kernel, int size_class, size_t local[2], size_t global[2]) const;
+	void setTunedSizes(const std::string& kernel, int size_class, const size_t local[2], const size_t global[2]);
+	//writes the tuning database to Params.tuningFile, entries of other devices are kept
+	bool saveTuning() const;
+
+	cl_platform_id platform;
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue queue;			//kernels are enqueued here
+	cl_command_queue upload_queue;		//transfers to and from the device are enqueued on separate queues
+	cl_command_queue download_queue;	//so they can overlap the kernels of other frames
+	size_t max_cu;	//max compute units
+	int vector_width;	//preferred float vector width of the device, rounded down to 1, 4 or 8
+
+private:
+	CLRuntime(const Params& params);
+	~CLRuntime();
+
+	bool initCL(cl_context_properties context_prop[]);
+	//string parameters of the device and platform, empty if they can't be queried
+	std::string deviceInfo(cl_device_info param) const;
+	std::string platformInfo(cl_platform_info param) const;
+	void releaseCL();
+
+	//on-disk cache of program binaries, the file name being a hash of the source, options, device and driver
+	std::string binaryPath(const char *source, const char *options) const;
+	cl_program loadBinary(const std::string& path, const char *options);
+	void storeBinary(const std::string& path, cl_program program);
+
+	void loadTuning();
+	std::string tuningKey(const std::string& kernel, int size_class) const;
+	std::map<std::string, std::vector<size_t> > m_tuning;	//local then global sizes, keyed by device, kernel and size class
+
+	int (*m_statusCallback)(const char*, va_list args);
+	void reportStatus(const char *format, ...) const;
+
+	Params m_params;
+	int m_users;	//filters which have been given the runtime and not yet detached
+	std::string m_device_info;	//device name, driver and platform version which the binaries depend on
+	std::map<std::string, cl_program> m_programs;	//keyed by the build options followed by the source
+
+	static CLRuntime* s_runtime;
+};
+}
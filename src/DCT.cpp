@@ -0,0 +1,228 @@
+// DCT.cpp (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include <math.h>
+#include <algorithm>
+#include <omp.h>
+
+#include "DCT.h"
+
+using namespace hdr;
+
+static const double PI = 3.14159265358979323846;
+
+
+FFT::FFT(int _n) : n(_n), conv(NULL), conv_size(0) {
+	twiddles.resize(n);
+	for (int k = 0; k < n; k++) twiddles[k] = std::polar(1.0, -2*PI*k/n);
+
+	//factorise n, taking out radix 4 first as it has the cheapest butterflies
+	int rem = n;
+	while (rem % 4 == 0) { factors.push_back(4); rem /= 4; }
+	while (rem % 2 == 0) { factors.push_back(2); rem /= 2; }
+	for (int p = 3; p*p <= rem; p += 2) {
+		while (rem % p == 0) { factors.push_back(p); rem /= p; }
+	}
+	if (rem > 1) factors.push_back(rem);
+	if (factors.empty() || factors.back() <= FFT_MAX_RADIX) return;
+
+	//a large prime factor would make the butterflies quadratic, so instead use a convolution of length at least 2n-1
+	factors.clear();
+	for (conv_size = 1; conv_size < 2*n-1; conv_size *= 2);
+	conv = new FFT(conv_size);
+
+	chirp.resize(n);
+	for (long long k = 0; k < n; k++) chirp[k] = std::polar(1.0, -PI*((k*k) % (2*n))/n);
+
+	std::vector<complex_t> b(conv_size, 0);
+	b[0] = std::conj(chirp[0]);
+	for (int k = 1; k < n; k++) b[k] = b[conv_size-k] = std::conj(chirp[k]);
+
+	chirp_fft.resize(conv_size);
+	conv->transform(&b[0], &chirp_fft[0], false, NULL);
+	for (int k = 0; k < conv_size; k++) chirp_fft[k] /= conv_size;
+}
+
+FFT::~FFT() {
+	delete conv;
+}
+
+int FFT::scratchSize() const {
+	return conv ? 2*conv_size : 0;
+}
+
+complex_t FFT::twiddle(int k, bool inverse) const {
+	return inverse ? std::conj(twiddles[k]) : twiddles[k];
+}
+
+void FFT::transform(const complex_t* in, complex_t* out, bool inverse, complex_t* scratch) const {
+	if (!conv) {
+		if (factors.empty()) out[0] = in[0];
+		else mixedRadix(in, out, 1, 0, inverse);
+		return;
+	}
+
+	//bluestein: X[k] = chirp[k] * sum of (x[j]*chirp[j]) * conj(chirp[k-j])
+	//the inverse is the conjugate of the forward transform of the conjugate
+	complex_t* a = scratch;
+	complex_t* a_fft = scratch + conv_size;
+	for (int k = 0; k < n; k++) a[k] = (inverse ? std::conj(in[k]) : in[k])*chirp[k];
+	std::fill(a + n, a + conv_size, complex_t(0));
+
+	conv->transform(a, a_fft, false, NULL);
+	for (int k = 0; k < conv_size; k++) a_fft[k] *= chirp_fft[k];
+	conv->transform(a_fft, a, true, NULL);
+
+	for (int k = 0; k < n; k++) {
+		complex_t x = a[k]*chirp[k];
+		out[k] = inverse ? std::conj(x) : x;
+	}
+}
+
+//decimation in time, the p interleaved sub-sequences of in are transformed into consecutive parts of out
+//which are then combined by butterflies of the radix p
+void FFT::mixedRadix(const complex_t* in, complex_t* out, int stride, int factor, bool inverse) const {
+	const int p = factors[factor];
+	const int m = n/(stride*p);	//length of the sub-sequences
+
+	if (m == 1) {
+		for (int q = 0; q < p; q++) out[q] = in[q*stride];
+	}
+	else {
+		for (int q = 0; q < p; q++) mixedRadix(in + q*stride, out + q*m, stride*p, factor+1, inverse);
+	}
+
+	switch (p) {
+		case 2:
+			for (int k = 0; k < m; k++) {
+				complex_t t = out[k+m]*twiddle(k*stride, inverse);
+				out[k+m] = out[k] - t;
+				out[k] += t;
+			}
+			break;
+		case 4:
+			for (int k = 0; k < m; k++) {
+				complex_t t0 = out[k];
+				complex_t t1 = out[k +   m]*twiddle(  k*stride, inverse);
+				complex_t t2 = out[k + 2*m]*twiddle(2*k*stride, inverse);
+				complex_t t3 = out[k + 3*m]*twiddle(3*k*stride, inverse);
+
+				complex_t a = t0 + t2;
+				complex_t b = t0 - t2;
+				complex_t c = t1 + t3;
+				complex_t d = (t1 - t3)*complex_t(0, inverse ? 1 : -1);	//multiplied by the 4th root of unity
+				out[k]       = a + c;
+				out[k +   m] = b + d;
+				out[k + 2*m] = a - c;
+				out[k + 3*m] = b - d;
+			}
+			break;
+		default: {
+			complex_t t[FFT_MAX_RADIX];
+			for (int k = 0; k < m; k++) {
+				for (int q = 0; q < p; q++) t[q] = out[k + q*m]*twiddle(q*k*stride, inverse);
+				for (int r = 0; r < p; r++) {
+					complex_t sum = 0;
+					for (int q = 0; q < p; q++) sum += t[q]*twiddle(((q*r) % p)*(n/p), inverse);
+					out[k + r*m] = sum;
+				}
+			}
+		}
+	}
+}
+
+
+DCT::DCT(int _n) : n(_n), fft(_n) {
+	shift.resize(n);
+	for (int k = 0; k < n; k++) shift[k] = std::polar(1.0, -PI*k/(2*n));
+}
+
+int DCT::workSize() const {
+	return 2*n + fft.scratchSize();
+}
+
+void DCT::forward(double* a, double* b, complex_t* work) const {
+	complex_t* z = work;
+	complex_t* z_fft = work + n;
+
+	//even samples in order followed by the odd samples in reverse
+	for (int k = 0; 2*k < n; k++)   z[k]     = complex_t(a[2*k],   b ? b[2*k]   : 0);
+	for (int k = 0; 2*k+1 < n; k++) z[n-1-k] = complex_t(a[2*k+1], b ? b[2*k+1] : 0);
+
+	fft.transform(z, z_fft, false, work + 2*n);
+
+	//the transforms of the two real sequences are the even and odd conjugate symmetric parts
+	for (int k = 0; k < n; k++) {
+		complex_t z_k = z_fft[k];
+		complex_t z_nk = std::conj(z_fft[(n-k) % n]);
+		a[k] = std::real(0.5*(z_k + z_nk)*shift[k]);
+		if (b) b[k] = std::real(complex_t(0, -0.5)*(z_k - z_nk)*shift[k]);
+	}
+}
+
+void DCT::inverse(double* a, double* b, complex_t* work) const {
+	complex_t* z = work;
+	complex_t* z_fft = work + n;
+
+	for (int k = 0; k < n; k++) {
+		complex_t v_a = std::conj(shift[k])*complex_t(a[k], k ? -a[n-k] : 0);
+		complex_t v_b = b ? std::conj(shift[k])*complex_t(b[k], k ? -b[n-k] : 0) : 0;
+		z_fft[k] = v_a + complex_t(0, 1)*v_b;
+	}
+
+	fft.transform(z_fft, z, true, work + 2*n);
+
+	for (int k = 0; 2*k < n; k++) {
+		a[2*k] = std::real(z[k])/n;
+		if (b) b[2*k] = std::imag(z[k])/n;
+	}
+	for (int k = 0; 2*k+1 < n; k++) {
+		a[2*k+1] = std::real(z[n-1-k])/n;
+		if (b) b[2*k+1] = std::imag(z[n-1-k])/n;
+	}
+}
+
+
+void hdr::dct2D(double* data, int width, int height, bool inverse) {
+	DCT row_dct(width);
+	DCT col_dct(height);
+
+	#pragma omp parallel
+	{
+		std::vector<complex_t> work(std::max(row_dct.workSize(), col_dct.workSize()));
+
+		//rows are transformed two at a time
+		#pragma omp for
+		for (int y = 0; y < height; y += 2) {
+			double* b = (y+1 < height) ? data + (y+1)*width : NULL;
+			if (inverse) row_dct.inverse(data + y*width, b, &work[0]);
+			else row_dct.forward(data + y*width, b, &work[0]);
+		}
+
+		//columns are copied in blocks into contiguous memory, so each row of the block is read in a single cache line
+		std::vector<double> block(DCT_BLOCK*height);
+		#pragma omp for
+		for (int x0 = 0; x0 < width; x0 += DCT_BLOCK) {
+			int block_width = std::min(DCT_BLOCK, width - x0);
+
+			for (int y = 0; y < height; y++) {
+				for (int i = 0; i < block_width; i++) block[i*height + y] = data[x0 + i + y*width];
+			}
+
+			for (int i = 0; i < block_width; i += 2) {
+				double* b = (i+1 < block_width) ? &block[(i+1)*height] : NULL;
+				if (inverse) col_dct.inverse(&block[i*height], b, &work[0]);
+				else col_dct.forward(&block[i*height], b, &work[0]);
+			}
+
+			for (int y = 0; y < height; y++) {
+				for (int i = 0; i < block_width; i++) data[x0 + i + y*width] = block[i*height + y];
+			}
+		}
+	}
+}
@@ -0,0 +1,67 @@
+// DCT.h (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#pragma once
+
+#include <complex>
+#include <vector>
+
+#define FFT_MAX_RADIX 32	//lengths with a larger prime factor are transformed using bluestein's algorithm
+#define DCT_BLOCK 16		//number of columns copied into contiguous memory and transformed together
+
+namespace hdr
+{
+typedef std::complex<double> complex_t;
+
+//complex discrete fourier transform of a fixed length
+class FFT {
+public:
+	FFT(int n);
+	~FFT();
+
+	//out is the forward, or the unnormalised inverse, transform of in. in and out must not overlap
+	//scratch must have room for scratchSize() values
+	void transform(const complex_t* in, complex_t* out, bool inverse, complex_t* scratch) const;
+	int scratchSize() const;
+
+private:
+	void mixedRadix(const complex_t* in, complex_t* out, int stride, int factor, bool inverse) const;
+	complex_t twiddle(int k, bool inverse) const;
+
+	int n;
+	std::vector<int> factors;
+	std::vector<complex_t> twiddles;	//exp(-2*pi*i*k/n)
+
+	//bluestein's algorithm computes the transform as a convolution using a power of two fft
+	FFT* conv;
+	int conv_size;
+	std::vector<complex_t> chirp;		//exp(-pi*i*k*k/n)
+	std::vector<complex_t> chirp_fft;	//transform of the conjugate chirp, divided by conv_size
+};
+
+//type II discrete cosine transform of real sequences of a fixed length, computed with an fft of the same length (Makhoul)
+//X[k] = sum of x[j]*cos(pi*k*(2j+1)/(2n)), inverse() being its exact inverse
+class DCT {
+public:
+	DCT(int n);
+
+	//both transform two sequences in place at once, packed into the real and imaginary parts of a single fft
+	//b can be NULL, work must have room for workSize() values
+	void forward(double* a, double* b, complex_t* work) const;
+	void inverse(double* a, double* b, complex_t* work) const;
+	int workSize() const;
+
+private:
+	int n;
+	FFT fft;
+	std::vector<complex_t> shift;	//exp(-pi*i*k/(2n))
+};
+
+//two dimensional transform of a row major grid, rows first then blocks of columns, each in parallel
+void dct2D(double* data, int width, int height, bool inverse);
+}
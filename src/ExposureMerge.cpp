@@ -0,0 +1,107 @@
+// ExposureMerge.cpp (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include <math.h>
+
+#include "ExposureMerge.h"
+
+using namespace hdr;
+
+ExposureMerge::ExposureMerge(int width, int height) {
+	img_size.x = width;
+	img_size.y = height;
+}
+
+int ExposureMerge::numExposures() const {
+	return m_exposures.size();
+}
+
+float ExposureMerge::exposureTime(int index) const {
+	return m_times[index];
+}
+
+bool ExposureMerge::addExposure(const uchar* pixels, float time) {
+	if (!pixels || time < 0.f) return false;
+	if (time == 0.f) {
+		if (m_exposures.empty()) time = 1.f;
+		else {
+			//estimated from the previous exposure, as bracketed exposures are given in order so neighbours overlap the most
+			float ratio = estimateRatio(m_exposures.back(), pixels);
+			if (ratio <= 0.f) return false;
+			time = m_times.back()*ratio;
+		}
+	}
+	m_exposures.push_back(pixels);
+	m_times.push_back(time);
+	return true;
+}
+
+float ExposureMerge::estimateRatio(const uchar* a, const uchar* b) const {
+	//the sums of the rows are added pairwise, so the estimate doesn't depend on the number of threads
+	std::vector<double> sums_a(img_size.y), sums_b(img_size.y);
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		double sum_a = 0, sum_b = 0;
+		for (int i = y*img_size.x*NUM_CHANNELS; i < (y+1)*img_size.x*NUM_CHANNELS; i++) {
+			if (i % NUM_CHANNELS == 3) continue;
+			if (a[i] >= MERGE_MIN_VALUE && a[i] <= MERGE_MAX_VALUE && b[i] >= MERGE_MIN_VALUE && b[i] <= MERGE_MAX_VALUE) {
+				sum_a += a[i];
+				sum_b += b[i];
+			}
+		}
+		sums_a[y] = sum_a;
+		sums_b[y] = sum_b;
+	}
+	double sum_a = pairwiseSum(&sums_a[0], img_size.y);
+	double sum_b = pairwiseSum(&sums_b[0], img_size.y);
+	return (sum_a > 0) ? sum_b/sum_a : 0.f;
+}
+
+bool ExposureMerge::merge(float* radiance) const {
+	const int num_exposures = m_exposures.size();
+	if (!num_exposures) return false;
+
+	//the log and weight of each value, and the log of each exposure time relative to the middle exposure
+	float log_value[PIXEL_RANGE+1], value_weight[PIXEL_RANGE+1];
+	for (int z = 0; z <= PIXEL_RANGE; z++) {
+		log_value[z] = z ? logf(z/(float) PIXEL_RANGE) : 0.f;
+		value_weight[z] = weight(z/(float) PIXEL_RANGE);
+	}
+	std::vector<float> log_time(num_exposures), inv_time(num_exposures);
+	int shortest = 0, longest = 0;
+	for (int i = 0; i < num_exposures; i++) {
+		float time = m_times[i]/m_times[num_exposures/2];
+		log_time[i] = logf(time);
+		inv_time[i] = 1.f/time;
+		if (m_times[i] < m_times[shortest]) shortest = i;
+		if (m_times[i] > m_times[longest]) longest = i;
+	}
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		for (int i = y*img_size.x*NUM_CHANNELS; i < (y+1)*img_size.x*NUM_CHANNELS; i += NUM_CHANNELS) {
+			for (int c = 0; c < 3; c++) {
+				float sum = 0.f, weights = 0.f;
+				for (int e = 0; e < num_exposures; e++) {
+					uchar z = m_exposures[e][i+c];
+					sum += value_weight[z]*(log_value[z] - log_time[e]);
+					weights += value_weight[z];
+				}
+				if (weights > 0.f) radiance[i+c] = expf(sum/weights);
+				else {
+					//clipped in every exposure, so as bright as the shortest exposure shows it or as dark as the longest does
+					uchar z = m_exposures[shortest][i+c];
+					int e = (z > PIXEL_RANGE/2) ? shortest : longest;
+					radiance[i+c] = m_exposures[e][i+c]/(float) PIXEL_RANGE*inv_time[e];
+				}
+			}
+			radiance[i+3] = 1.f;
+		}
+	}
+	return true;
+}
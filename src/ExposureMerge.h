@@ -0,0 +1,46 @@
+// ExposureMerge.h (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#pragma once
+
+#include <vector>
+
+#include "Filter.h"
+
+#define MERGE_MIN_VALUE 8		//darkest value compared when estimating exposure times, darker ones being mostly noise
+#define MERGE_MAX_VALUE 247		//brightest value compared, brighter ones being possibly clipped
+
+namespace hdr
+{
+//merges bracketed 8-bit exposures of a still scene into radiance (Debevec and Malik)
+//the log radiance of each channel is the mean of the log of each exposure's value over its exposure time,
+//weighted by how well exposed the value is. The response of the camera is taken to be linear,
+//as the filters take 8-bit pixels to be linear radiance
+class ExposureMerge {
+public:
+	ExposureMerge(int width, int height);
+
+	//adds an exposure of width*height RGBA pixels, which must be kept until the merge is done
+	//time is its exposure time relative to the others, 0 to estimate it from the exposure added before it
+	bool addExposure(const uchar* pixels, float time);
+	int numExposures() const;
+	float exposureTime(int index) const;
+
+	//merges the exposures into width*height RGBA pixels of opaque radiance, ready for any filter
+	//the radiance is scaled so that the white of the middle exposure is 1
+	bool merge(float* radiance) const;
+
+private:
+	int2 img_size;
+	std::vector<const uchar*> m_exposures;
+	std::vector<float> m_times;
+
+	//exposure time of b relative to a, from the values well exposed in both, 0 if there are none
+	float estimateRatio(const uchar* a, const uchar* b) const;
+};
+}
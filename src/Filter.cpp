@@ -12,17 +12,27 @@
 #include <iostream>
 #include <exception>
 #include <stdexcept>
+#include <algorithm>
 
 #include "Filter.h"
+#include "GLMappings.h"
+#include "opencl/common.h"
 
 namespace hdr
 {
 Filter::Filter() {
 	m_statusCallback = NULL;
+	m_runtime = NULL;
+	m_device = 0;
 	m_clContext = 0;
 	m_queue = 0;
 	m_program = 0;
 	m_reference.data = NULL;
+	img_size.x = 0;
+	img_size.y = 0;
+	m_next_slot = 0;
+	m_pending = 0;
+	m_vector_width = 1;
 }
 
 Filter::~Filter() {
@@ -41,99 +51,92 @@ const char* Filter::getName() const {
 }
 
 
+//source shared by all the programs, prepended to the one of each filter
+//when reading OpenGL textures is buggy it starts with the table inverting the GL-CL mappings
+//which gives the nearest 8 bit value for every value an OpenCL kernel may read
+static std::string commonSource() {
+	std::string source;
+	if (BUGGY_CL_GL) {
+		int table_size = gl_cl_mappings[GL_CL_MAPPINGS_SIZE-1] + 1;
+		char line[64];
+		sprintf(line, "#define GL_TO_CL_TABLE_SIZE %d\n", table_size);
+		source += line;
+		source += "__constant uchar gl_to_cl_table[GL_TO_CL_TABLE_SIZE] = {";
+		int gl = 0;
+		for (int val = 0; val < table_size; val++) {
+			while (gl < GL_CL_MAPPINGS_SIZE-1 && gl_cl_mappings[gl+1] - val < val - gl_cl_mappings[gl]) gl++;
+			sprintf(line, "%s%d,", (val % 32) ? "" : "\n", gl);
+			source += line;
+		}
+		source += "\n};\n";
+	}
+	return source + common_kernel;
+}
+
 bool Filter::initCL(cl_context_properties context_prop[], const Params& params, const char *source, const char *options) {
-	// Ensure no existing context
+	// Ensure no existing program
 	releaseCL();
-
-	cl_int err;
-	cl_uint numPlatforms, numDevices;
-
-	cl_platform_id platform, platforms[params.platformIndex+1];
-	err = clGetPlatformIDs(params.platformIndex+1, platforms, &numPlatforms);
-	CHECK_ERROR_OCL(err, "getting platforms", return false);
-	if (params.platformIndex >= numPlatforms) {
-		reportStatus("Platform index %d out of range (%d platforms found)",
-			params.platformIndex, numPlatforms);
+	m_tunable.clear();
+	m_vectorised.clear();
+
+	m_params = params;
+	m_runtime = CLRuntime::get(context_prop, params, m_statusCallback);
+	if (!m_runtime) return false;
+
+	m_device = m_runtime->device;
+	m_clContext = m_runtime->context;
+	m_queue = m_runtime->queue;
+	max_cu = m_runtime->max_cu;
+
+	//the per-pixel kernels are built for the vector width given, or preferred by the device
+	int vector_width = params.vectorWidth ? params.vectorWidth : m_runtime->vector_width;
+	if (vector_width != 1 && vector_width != 4 && vector_width != 8) {
+		reportStatus("Invalid vector width %d, it must be 1, 4 or 8", vector_width);
 		return false;
 	}
-	platform = platforms[params.platformIndex];
+	reportStatus("Vector width: %d", vector_width);
+	m_vector_width = vector_width;
 
-	cl_device_id devices[params.deviceIndex+1];
-	err = clGetDeviceIDs(platform, params.type, params.deviceIndex+1, devices, &numDevices);
-	CHECK_ERROR_OCL(err, "getting devices", return false);
-	if (params.deviceIndex >= numDevices) {
-		reportStatus("Device index %d out of range (%d devices found)",
-			params.deviceIndex, numDevices);
+	//radiance is read from the input images as floats, which OpenGL textures can't give
+	bool radiance = params.inputType != CL_UNSIGNED_INT8;
+	if (radiance && (params.opengl || (params.inputType != CL_FLOAT && params.inputType != CL_HALF_FLOAT))) {
+		reportStatus("Invalid input channel type %#x", params.inputType);
 		return false;
 	}
-	m_device = devices[params.deviceIndex];
-
-	char name[64];
-	clGetDeviceInfo(m_device, CL_DEVICE_NAME, 64, name, NULL);
-	reportStatus("Using device: %s", name);
 
-	cl_ulong device_size;
-	clGetDeviceInfo(m_device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(device_size), &device_size, NULL);
-	reportStatus("CL_DEVICE_GLOBAL_MEM_SIZE: %lu bytes", device_size);
+	char vector_option[64];
+	sprintf(vector_option, " -D VECTOR_WIDTH=%d -D RADIANCE_INPUT=%d", vector_width, radiance);
 
-	clGetDeviceInfo(m_device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(device_size), &device_size, NULL);
-	reportStatus("CL_DEVICE_LOCAL_MEM_SIZE: %lu bytes", device_size);
-
-	clGetDeviceInfo(m_device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(size_t), &max_cu, NULL);
-	reportStatus("CL_DEVICE_MAX_COMPUTE_UNITS: %lu", max_cu);
-
-	if (params.opengl) context_prop[5] = (cl_context_properties) platform;
-
-	m_clContext = clCreateContext(context_prop, 1, &m_device, NULL, NULL, &err);
-	CHECK_ERROR_OCL(err, "creating context", return false);
-
-	m_queue = clCreateCommandQueue(m_clContext, m_device, 0, &err);
-	CHECK_ERROR_OCL(err, "creating command queue", return false);
-
-	m_program = clCreateProgramWithSource(m_clContext, 1, &source, NULL, &err);
-	CHECK_ERROR_OCL(err, "creating program", return false);
-
-	err = clBuildProgram(m_program, 1, &m_device, options, NULL, NULL);
-	if (err == CL_BUILD_PROGRAM_FAILURE) {
-		size_t sz;
-		clGetProgramBuildInfo(
-			m_program, m_device, CL_PROGRAM_BUILD_LOG, 0, NULL, &sz);
-		char *log = (char*)malloc(++sz);
-		clGetProgramBuildInfo(
-			m_program, m_device, CL_PROGRAM_BUILD_LOG, sz, log, NULL);
-		reportStatus(log);
-		free(log);
-	}
-	CHECK_ERROR_OCL(err, "building program", return false);
+	static const std::string common_source = commonSource();
+	m_program = m_runtime->buildProgram((common_source + source).c_str(), (std::string(options) + vector_option).c_str());
+	if (!m_program) return false;
 
-	reportStatus("OpenCL context initialised.");
 	return true;
 }
 
 void Filter::releaseCL() {
+	releaseFrameSlots();
+	releaseProfile();
 	if (m_program) {
 		clReleaseProgram(m_program);
 		m_program = 0;
 	}
-	if (m_queue) {
-		clReleaseCommandQueue(m_queue);
-		m_queue = 0;
-	}
-	if (m_clContext) {
-		clReleaseContext(m_clContext);
-		m_clContext = 0;
-	}
+	if (m_runtime) m_runtime->detach();
+	m_runtime = NULL;
+	m_device = 0;
+	m_queue = 0;
+	m_clContext = 0;
 }
 
 bool Filter::runOpenCL(bool recomputeMapping) {
 	cl_int err;
 
-	err = clEnqueueAcquireGLObjects(m_queue, 2, &mem_images[0], 0, 0, 0);
+	err = clEnqueueAcquireGLObjects(m_queue, 2, &mem_images[0], 0, 0, profileEvent("acquire GL objects"));
 	CHECK_ERROR_OCL(err, "acquiring GL objects", return false);
 
 	double runTime = runCLKernels(recomputeMapping);
 
-	err = clEnqueueReleaseGLObjects(m_queue, 2, &mem_images[0], 0, 0, 0);
+	err = clEnqueueReleaseGLObjects(m_queue, 2, &mem_images[0], 0, 0, profileEvent("release GL objects"));
 	CHECK_ERROR_OCL(err, "releasing GL objects", return false);
 
 	reportStatus("Finished OpenCL kernels in %lf ms", runTime*1000);
@@ -141,17 +144,50 @@ bool Filter::runOpenCL(bool recomputeMapping) {
 	return true;
 }
 
+double Filter::runCLKernels(bool recomputeMapping) {
+	double start = omp_get_wtime();
+
+	if (!enqueueCLKernels(recomputeMapping)) return 0;
+
+	cl_int err = clFinish(m_queue);
+	CHECK_ERROR_OCL(err, "running kernels", return 0);
+	return omp_get_wtime() - start;
+}
+
 bool Filter::runOpenCL(uchar* input, uchar* output, bool recomputeMapping) {
+	return runOpenCLFrame(input, output, recomputeMapping);
+}
+
+bool Filter::runOpenCL(float* input, uchar* output, bool recomputeMapping) {
+	return runOpenCLFrame(input, output, recomputeMapping);
+}
+
+template <typename T>
+bool Filter::runOpenCLFrame(T* input, uchar* output, bool recomputeMapping) {
 	cl_int err;
 
- 	const size_t origin[] = {0, 0, 0};
- 	const size_t region[] = {img_size.x, img_size.y, 1};
-	err = clEnqueueWriteImage(m_queue, mem_images[0], CL_TRUE, origin, region, sizeof(uchar)*img_size.x*NUM_CHANNELS, 0, input, 0, NULL, NULL);
-	CHECK_ERROR_OCL(err, "writing image memory", return false);
+	void* data = inputData(input, m_staging);
+	if (!data) return false;
+
+	//with Params.hostInput the kernels read the frame where it is, through an image standing in for the input image
+	cl_mem host_image = 0;
+	if (m_params.hostInput) {
+		host_image = wrapInput(data);
+		if (!host_image) return false;
+		std::swap(mem_images[0], host_image);
+		if (!setupKernelArgs()) {
+			restoreInput(host_image);
+			return false;
+		}
+	}
+	else if (!writeInput(m_queue, mem_images[0], data, CL_TRUE, profileEvent("write image"))) return false;
 
+ 	const size_t origin[] = {0, 0, 0};
+ 	const size_t region[] = {(size_t) img_size.x, (size_t) img_size.y, 1};
 	double runTime = runCLKernels(recomputeMapping);
 
-	err = clEnqueueReadImage(m_queue, mem_images[1], CL_TRUE, origin, region, sizeof(uchar)*img_size.x*NUM_CHANNELS, 0, output, 0, NULL, NULL);
+	err = clEnqueueReadImage(m_queue, mem_images[1], CL_TRUE, origin, region, sizeof(uchar)*img_size.x*NUM_CHANNELS, 0, output, 0, NULL, profileEvent("read image"));
+	if (host_image && !restoreInput(host_image)) return false;
 	CHECK_ERROR_OCL(err, "reading image memory", return false);
 
 	reportStatus("Finished OpenCL kernel");
@@ -165,7 +201,388 @@ bool Filter::runOpenCL(uchar* input, uchar* output, bool recomputeMapping) {
 	return passed;
 }
 
+//nearest half float, ties to even, as radiance beyond its range becomes infinity
+static cl_half floatToHalf(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	cl_half sign = (bits >> 16) & 0x8000;
+	uint32_t magnitude = bits & 0x7fffffff;
+
+	if (magnitude > 0x7f800000) return sign | 0x7e00;	//NaN
+	if (magnitude >= 0x477ff000) return sign | 0x7c00;	//rounds to infinity
+	if (magnitude < 0x38800000) return sign | (cl_half) lrintf(fabsf(value)*16777216.f);	//subnormal, in units of 2^-24
+	//rebias the exponent, the rounding carrying into it when the mantissa overflows
+	return sign | ((magnitude + 0xfff + ((magnitude >> 13) & 1) - 0x38000000) >> 13);
+}
+
+void* Filter::inputData(uchar* input, std::vector<uint16_t>&) {
+	if (m_params.inputType != CL_UNSIGNED_INT8) {
+		reportStatus("The input images are set up for radiance");
+		return NULL;
+	}
+	return input;
+}
+
+void* Filter::inputData(float* input, std::vector<uint16_t>& staging) {
+	if (m_params.inputType == CL_UNSIGNED_INT8) {
+		reportStatus("The input images are set up for 8-bit pixels");
+		return NULL;
+	}
+	if (m_params.inputType == CL_FLOAT) return input;
+
+	//halving the size of the radiance costs a pass over it on the host, but halves the transfer and the reads of the kernels
+	const int num_values = img_size.x*img_size.y*NUM_CHANNELS;
+	staging.resize(num_values);
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < num_values; i++) staging[i] = floatToHalf(input[i]);
+	return &staging[0];
+}
+
+size_t Filter::inputPixelSize() const {
+	switch (m_params.inputType) {
+		case CL_FLOAT:		return sizeof(float)*NUM_CHANNELS;
+		case CL_HALF_FLOAT:	return sizeof(cl_half)*NUM_CHANNELS;
+		default:			return sizeof(uchar)*NUM_CHANNELS;
+	}
+}
+
+bool Filter::writeInput(cl_command_queue queue, cl_mem image, void* data, cl_bool blocking, cl_event* event) {
+	const size_t origin[] = {0, 0, 0};
+	const size_t region[] = {(size_t) img_size.x, (size_t) img_size.y, 1};
+	cl_int err = clEnqueueWriteImage(queue, image, blocking, origin, region, inputPixelSize()*img_size.x, 0, data, 0, NULL, event);
+	CHECK_ERROR_OCL(err, "writing image memory", return false);
+	return true;
+}
+
+cl_mem Filter::wrapInput(void* data) {
+	cl_int err;
+	cl_image_format format;
+	format.image_channel_order = CL_RGBA;
+	format.image_channel_data_type = m_params.inputType;
+	cl_mem image = clCreateImage2D(m_clContext, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, &format, img_size.x, img_size.y, inputPixelSize()*img_size.x, data, &err);
+	CHECK_ERROR_OCL(err, "creating host input image", return 0);
+	return image;
+}
+
+bool Filter::restoreInput(cl_mem host_image) {
+	std::swap(mem_images[0], host_image);
+	clReleaseMemObject(host_image);
+	return setupKernelArgs();
+}
+
+
+
+
+//////////////////////////
+// Asynchronous pipeline //
+//////////////////////////
+
+static void releaseEvent(cl_event& event) {
+	if (event) clReleaseEvent(event);
+	event = 0;
+}
+
+bool Filter::setupFrameSlots() {
+	if (m_slots[0].images[0]) return true;
+
+	if (m_params.opengl) {
+		reportStatus("The asynchronous pipeline doesn't support OpenGL textures");
+		return false;
+	}
+
+	//the first slot uses the images of the filter, the others get their own
+	m_slots[0].images[0] = mem_images[0];
+	m_slots[0].images[1] = mem_images[1];
+
+	cl_int err;
+	cl_image_format input_format, output_format;
+	input_format.image_channel_order = output_format.image_channel_order = CL_RGBA;
+	input_format.image_channel_data_type = m_params.inputType;
+	output_format.image_channel_data_type = CL_UNSIGNED_INT8;
+	for (int s = 1; s < NUM_FRAME_SLOTS; s++) {
+		m_slots[s].images[0] = clCreateImage2D(m_clContext, CL_MEM_READ_ONLY, &input_format, img_size.x, img_size.y, 0, NULL, &err);
+		CHECK_ERROR_OCL(err, "creating input image memory", return false);
+
+		m_slots[s].images[1] = clCreateImage2D(m_clContext, CL_MEM_WRITE_ONLY, &output_format, img_size.x, img_size.y, 0, NULL, &err);
+		CHECK_ERROR_OCL(err, "creating output image memory", return false);
+	}
+
+	return true;
+}
+
+void Filter::releaseFrameSlots() {
+	for (int s = 0; s < NUM_FRAME_SLOTS; s++) {
+		FrameSlot& slot = m_slots[s];
+
+		//frames still in flight are finished, but their outputs discarded
+		if (slot.downloaded) clWaitForEvents(1, &slot.downloaded);
+		releaseEvent(slot.uploaded);
+		releaseEvent(slot.computed);
+		releaseEvent(slot.downloaded);
+
+		if (s > 0) {
+			if (slot.images[0]) clReleaseMemObject(slot.images[0]);
+			if (slot.images[1]) clReleaseMemObject(slot.images[1]);
+		}
+		slot.images[0] = 0;
+		slot.images[1] = 0;
+	}
+	m_next_slot = 0;
+	m_pending = 0;
+}
+
+Filter::FrameSlot* Filter::nextFrameSlot() {
+	if (m_pending == NUM_FRAME_SLOTS) {
+		reportStatus("All %d frame slots are in flight", NUM_FRAME_SLOTS);
+		return NULL;
+	}
+	if (!setupFrameSlots()) return NULL;
+
+	//the slot's previous frame has been completed, so its images and events are free
+	return &m_slots[m_next_slot];
+}
+
+bool Filter::submitFrame(uchar* input, uchar* output, bool recomputeMapping) {
+	FrameSlot* slot = nextFrameSlot();
+	if (!slot) return false;
+	slot->input = input;
+	slot->radiance = NULL;
+	slot->output = output;
+
+	void* data = inputData(input, slot->staging);
+	if (!data || !writeInput(m_runtime->upload_queue, slot->images[0], data, CL_FALSE, &slot->uploaded)) return false;
+	return enqueueFrame(*slot, recomputeMapping);
+}
 
+bool Filter::submitFrame(float* input, uchar* output, bool recomputeMapping) {
+	FrameSlot* slot = nextFrameSlot();
+	if (!slot) return false;
+	slot->input = NULL;
+	slot->radiance = input;
+	slot->output = output;
+
+	void* data = inputData(input, slot->staging);
+	if (!data || !writeInput(m_runtime->upload_queue, slot->images[0], data, CL_FALSE, &slot->uploaded)) return false;
+	return enqueueFrame(*slot, recomputeMapping);
+}
+
+bool Filter::enqueueFrame(FrameSlot& slot, bool recomputeMapping) {
+	cl_int err;
+	clFlush(m_runtime->upload_queue);
+
+	cl_event* profiled = profileEvent("upload image");
+	if (profiled) {
+		clRetainEvent(slot.uploaded);
+		*profiled = slot.uploaded;
+	}
+
+	//the kernels run on the slot's images, all the other memory objects being shared by the frames in order
+	err = clEnqueueWaitForEvents(m_queue, 1, &slot.uploaded);
+	CHECK_ERROR_OCL(err, "waiting for upload", return false);
+
+	mem_images[0] = slot.images[0];
+	mem_images[1] = slot.images[1];
+	if (!setupKernelArgs()) return false;
+	bool enqueued = enqueueCLKernels(recomputeMapping);
+
+	mem_images[0] = m_slots[0].images[0];
+	mem_images[1] = m_slots[0].images[1];
+	if (!enqueued || !setupKernelArgs()) return false;
+
+	err = clEnqueueMarker(m_queue, &slot.computed);
+	CHECK_ERROR_OCL(err, "enqueuing marker", return false);
+	clFlush(m_queue);
+
+	const size_t origin[] = {0, 0, 0};
+	const size_t region[] = {(size_t) img_size.x, (size_t) img_size.y, 1};
+	err = clEnqueueReadImage(m_runtime->download_queue, slot.images[1], CL_FALSE, origin, region, sizeof(uchar)*img_size.x*NUM_CHANNELS, 0, slot.output, 1, &slot.computed, &slot.downloaded);
+	CHECK_ERROR_OCL(err, "reading image memory", return false);
+	clFlush(m_runtime->download_queue);
+
+	profiled = profileEvent("download image");
+	if (profiled) {
+		clRetainEvent(slot.downloaded);
+		*profiled = slot.downloaded;
+	}
+
+	m_next_slot = (m_next_slot+1) % NUM_FRAME_SLOTS;
+	m_pending++;
+	return true;
+}
+
+bool Filter::completeFrame() {
+	if (m_pending == 0) return false;
+
+	FrameSlot& slot = m_slots[(m_next_slot - m_pending + NUM_FRAME_SLOTS) % NUM_FRAME_SLOTS];
+	m_pending--;
+
+	cl_int err = clWaitForEvents(1, &slot.downloaded);
+	releaseEvent(slot.uploaded);
+	releaseEvent(slot.computed);
+	releaseEvent(slot.downloaded);
+	CHECK_ERROR_OCL(err, "waiting for frame", return false);
+
+	//the events of the frame's commands are released as it completes, rather than accumulating while streaming
+	if (m_params.profile) collectProfile(false);
+
+	//verifying every frame would defeat the purpose of the pipeline, so it's optional
+	if (m_params.verify) {
+		clearReferenceCache();
+		bool passed = slot.radiance ? verify(slot.radiance, slot.output) : verify(slot.input, slot.output);
+		reportStatus("Finished frame (verification %s)", passed ? "passed" : "failed");
+		return passed;
+	}
+	return true;
+}
+
+int Filter::pendingFrames() const {
+	return m_pending;
+}
+
+
+///////////////
+// Profiling //
+///////////////
+
+cl_event* Filter::profileEvent(const char* name, cl_uint work_dim, const size_t* global, const size_t* local) {
+	if (!m_params.profile) return NULL;
+
+	KernelProfile profile;
+	profile.name = name;
+	profile.queued = profile.submit = profile.start = profile.end = 0;
+	profile.work_dim = work_dim;
+	for (cl_uint i = 0; i < 2; i++) {
+		profile.global[i] = (global && i < work_dim) ? global[i] : 0;
+		profile.local[i]  = (local  && i < work_dim) ? local[i]  : 0;
+	}
+
+	//the event is written by the command enqueued straight after this, before anything else is recorded
+	m_profile.push_back(std::make_pair((cl_event) 0, profile));
+	return &m_profile.back().first;
+}
+
+cl_int Filter::enqueueKernel(const char* name, cl_uint work_dim) {
+	return clEnqueueNDRangeKernel(m_queue, kernels[name], work_dim, NULL, global_sizes[name], local_sizes[name], 0, NULL,
+		profileEvent(name, work_dim, global_sizes[name], local_sizes[name]));
+}
+
+bool Filter::enqueueMipmapPyramid(int num_levels) {
+	const size_t* local = local_sizes["mipmap_pyramid"];
+	cl_int err;
+	err = clSetKernelArg(kernels["mipmap_pyramid"], 6, sizeof(float)*local[0]*local[1], NULL);
+	CHECK_ERROR_OCL(err, "setting mipmap_pyramid arguments", return false);
+
+	//a work group can halve its tile as many times as both of its dimensions are divisible by 2
+	int levels_per_launch = 1;
+	for (size_t x = local[0], y = local[1]; x%2 == 0 && y%2 == 0; x /= 2, y /= 2) levels_per_launch++;
+
+	for (int level = 1; level < num_levels; level += levels_per_launch) {
+		int levels = std::min(levels_per_launch, num_levels - level);
+		err  = clSetKernelArg(kernels["mipmap_pyramid"], 4, sizeof(int), &level);
+		err |= clSetKernelArg(kernels["mipmap_pyramid"], 5, sizeof(int), &levels);
+		CHECK_ERROR_OCL(err, "setting mipmap_pyramid arguments", return false);
+
+		err = enqueueKernel("mipmap_pyramid", 2);
+		CHECK_ERROR_OCL(err, "enqueuing mipmap_pyramid kernel", return false);
+	}
+	return true;
+}
+
+void Filter::collectProfile(bool wait) {
+	size_t n = 0;
+	for (; n < m_profile.size(); n++) {
+		cl_event event = m_profile[n].first;
+		if (!event) continue;	//the command failed to enqueue
+
+		if (wait) clWaitForEvents(1, &event);
+		else {
+			cl_int status = CL_QUEUED;
+			clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL);
+			if (status > CL_COMPLETE) break;	//negative for a command which failed
+		}
+
+		KernelProfile p = m_profile[n].second;
+		clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &p.queued, NULL);
+		clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &p.submit, NULL);
+		clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &p.start, NULL);
+		clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &p.end, NULL);
+		clReleaseEvent(event);
+		m_profile_done.push_back(p);
+	}
+	m_profile.erase(m_profile.begin(), m_profile.begin() + n);
+
+	while (m_profile_done.size() > PROFILE_MAX_COMMANDS) m_profile_done.pop_front();
+}
+
+std::vector<KernelProfile> Filter::getProfile() {
+	collectProfile(true);
+	std::vector<KernelProfile> profile(m_profile_done.begin(), m_profile_done.end());
+	m_profile_done.clear();
+	return profile;
+}
+
+void Filter::releaseProfile() {
+	for (size_t i = 0; i < m_profile.size(); i++) {
+		if (m_profile[i].first) clReleaseEvent(m_profile[i].first);
+	}
+	m_profile.clear();
+	m_profile_done.clear();
+}
+
+//totals of the commands of the same name
+struct ProfileTotal {
+	std::string name;
+	int count;
+	double time, wait;	//time running, and waiting between being queued and starting
+	const KernelProfile* first;
+	ProfileTotal() : count(0), time(0), wait(0), first(NULL) {}
+	bool operator<(const ProfileTotal& other) const { return time > other.time; }
+};
+
+void Filter::reportProfile(const std::vector<KernelProfile>& profile) {
+	if (profile.empty()) {
+		reportStatus("No profile recorded, it requires Params.profile");
+		return;
+	}
+
+	std::map<std::string, ProfileTotal> totals;
+	double total_time = 0;
+	cl_ulong first_queued = profile[0].queued, last_end = profile[0].end;
+	for (size_t i = 0; i < profile.size(); i++) {
+		const KernelProfile& p = profile[i];
+		ProfileTotal& t = totals[p.name];
+		if (t.count == 0) {
+			t.name = p.name;
+			t.first = &p;
+		}
+		t.count++;
+		t.time += (p.end - p.start)*1e-6;
+		t.wait += (p.start - p.queued)*1e-6;
+		total_time += (p.end - p.start)*1e-6;
+		first_queued = std::min(first_queued, p.queued);
+		last_end = std::max(last_end, p.end);
+	}
+
+	std::vector<ProfileTotal> sorted;
+	std::map<std::string, ProfileTotal>::iterator itr;
+	for (itr = totals.begin(); itr != totals.end(); itr++) sorted.push_back(itr->second);
+	std::sort(sorted.begin(), sorted.end());
+
+	reportStatus("Profile: %d commands, %lf ms on the device, %lf ms from the first being queued to the last finishing",
+		(int) profile.size(), total_time, (last_end - first_queued)*1e-6);
+	for (size_t i = 0; i < sorted.size(); i++) {
+		const ProfileTotal& t = sorted[i];
+		if (t.first->work_dim == 0) {
+			reportStatus("%-26s %5d x %10.3lf ms = %10.3lf ms (%5.1lf%%), waiting %10.3lf ms",
+				t.name.c_str(), t.count, t.time/t.count, t.time, 100*t.time/total_time, t.wait);
+		}
+		else {
+			reportStatus("%-26s %5d x %10.3lf ms = %10.3lf ms (%5.1lf%%), waiting %10.3lf ms, global (%lu, %lu) local (%lu, %lu)",
+				t.name.c_str(), t.count, t.time/t.count, t.time, 100*t.time/total_time, t.wait,
+				t.first->global[0], t.first->global[1], t.first->local[0], t.first->local[1]);
+		}
+	}
+}
 
 
 void Filter::reportStatus(const char *format, ...) const {
@@ -182,7 +599,8 @@ void Filter::setStatusCallback(int (*callback)(const char*, va_list args)) {
 }
 
 
-bool Filter::verify(uchar* input, uchar* output, float tolerance, float maxErrorPercent) {
+template <typename T>
+bool Filter::verify(T* input, uchar* output, float tolerance, float maxErrorPercent) {
 	// compute reference image
 	uchar* ref = (uchar*) calloc(img_size.x*img_size.y*NUM_CHANNELS, sizeof(uchar));
 	runReference(input, ref);
@@ -190,19 +608,22 @@ bool Filter::verify(uchar* input, uchar* output, float tolerance, float maxError
 	// compare pixels
 	int errors = 0;
 	const int maxErrors = img_size.x*img_size.y*maxErrorPercent;
-	int2 pos;
-	for (pos.y = 0; pos.y < img_size.y; pos.y++) {
-		for (pos.x = 0; pos.x < img_size.x; pos.x++) {
+	PixelView ref_image(ref, img_size);
+	PixelView out_image(output, img_size);
+	for (int y = 0; y < img_size.y; y++) {
+		uchar* ref_row = ref_image.row(y);
+		uchar* out_row = out_image.row(y);
+		for (int x = 0; x < img_size.x; x++) {
 			for (int c = 0; c < NUM_CHANNELS; c++) {
-				float r = getPixel(ref, img_size, pos, c);
-				float o = getPixel(output, img_size, pos, c);
+				float r = ref_row[x*NUM_CHANNELS + c];
+				float o = out_row[x*NUM_CHANNELS + c];
 				float diff = r - o;
 				diff = diff >= 0 ? diff : -diff;
 
 				if (diff > tolerance) {
 					// Only report first few errors
 					if (errors < maxErrors) {
-						reportStatus("Mismatch at (%d,%d,%d): %f vs %f", pos.x, pos.y, c, r, o);
+						reportStatus("Mismatch at (%d,%d,%d): %f vs %f", x, y, c, r, o);
 					}
 					if (++errors == maxErrors) {
 						reportStatus("Supressing further errors");
@@ -243,15 +664,31 @@ bool Filter::kernel1DSizes(const char* kernel_name) {
 	global_sizes[kernel_name] = global;
 
 	reportStatus("Kernel sizes: Local=%lu Global=%lu", local[0], global[0]);
+	return true;
 }
 
 
-bool Filter::kernel2DSizes(const char* kernel_name) {
+bool Filter::kernel2DSizes(const char* kernel_name, bool tunable, bool vectorised) {
 	reportStatus("---------------------------------Kernel %s:", kernel_name);
+	if (vectorised) m_vectorised.push_back(kernel_name);
 
+	local_sizes[kernel_name] = (size_t*) calloc(2, sizeof(size_t));
+	global_sizes[kernel_name] = (size_t*) calloc(2, sizeof(size_t));
+
+	size_t max_wg_size;
+	if (!default2DSizes(kernel_name, max_wg_size)) return false;
+
+	if (tunable) {
+		m_tunable.push_back(kernel_name);
+		useTunedSizes(kernel_name, max_wg_size);
+	}
+	return true;
+}
+
+bool Filter::default2DSizes(const char* kernel_name, size_t& max_wg_size) {
 	cl_int err;
 
-	size_t max_wg_size;	//max workgroup size for the kernel
+	//max workgroup size for the kernel
 	err = clGetKernelWorkGroupInfo (kernels[kernel_name], m_device,
 		CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_wg_size, NULL);
 	CHECK_ERROR_OCL(err, "getting CL_KERNEL_WORK_GROUP_SIZE", return false);
@@ -263,8 +700,8 @@ bool Filter::kernel2DSizes(const char* kernel_name) {
 	CHECK_ERROR_OCL(err, "getting CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE", return false);
 	reportStatus("CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE: %lu", preferred_wg_size);
 
-	size_t* local = (size_t*) calloc(2, sizeof(size_t));
-	size_t* global = (size_t*) calloc(2, sizeof(size_t));
+	size_t* local = local_sizes[kernel_name];
+	size_t* global = global_sizes[kernel_name];
 
 	int i=0;
 	local[0] = 1;
@@ -280,23 +717,166 @@ bool Filter::kernel2DSizes(const char* kernel_name) {
 	global[0] = local[0]*max_cu;
 	global[1] = local[1]*max_cu;
 
-	global[0] = ceil((float)global[0]/(float)local[0])*local[0];
+	global[0] = ceil((float)global[0]/pixelsPerItem(kernel_name)/(float)local[0])*local[0];
 	global[1] = ceil((float)global[1]/(float)local[1])*local[1];
 
-	local_sizes[kernel_name] = local;
-	global_sizes[kernel_name] = global;
-	
 	reportStatus("Kernel sizes: Local=(%lu, %lu) Global=(%lu, %lu)", local[0], local[1], global[0], global[1]);
+	return true;
 }
 
+int Filter::sizeClass() const {
+	//each class covers a factor of four in the number of pixels
+	return (int) (log2((double) img_size.x*img_size.y)/2);
+}
+
+size_t Filter::pixelsPerItem(const char* kernel_name) const {
+	bool vectorised = std::find(m_vectorised.begin(), m_vectorised.end(), kernel_name) != m_vectorised.end();
+	return vectorised ? m_vector_width : 1;
+}
+
+std::string Filter::tuningName(const char* kernel_name) const {
+	//the sizes of a vectorised kernel are only of use to a program built for the same vector width
+	std::string name = std::string(m_name) + "." + kernel_name;
+	if (pixelsPerItem(kernel_name) > 1) {
+		char suffix[16];
+		sprintf(suffix, ".v%d", m_vector_width);
+		name += suffix;
+	}
+	return name;
+}
+
+bool Filter::useTunedSizes(const char* kernel_name, size_t max_wg_size) {
+	size_t local[2], global[2];
+	if (!m_runtime->tunedSizes(tuningName(kernel_name), sizeClass(), local, global)) return false;
+
+	//an entry which doesn't suit the kernel any more is ignored
+	if (local[0]*std::max(local[1], (size_t) 1) > max_wg_size) return false;
+
+	local_sizes[kernel_name][0] = local[0];
+	local_sizes[kernel_name][1] = local[1];
+	global_sizes[kernel_name][0] = global[0];
+	global_sizes[kernel_name][1] = global[1];
+	reportStatus("Tuned kernel sizes: Local=(%lu, %lu) Global=(%lu, %lu)", local[0], local[1], global[0], global[1]);
+	return true;
+}
+
+//times a number of launches of the kernel with its current sizes, returns a negative time if it can't be launched
+static double timeKernel(cl_command_queue queue, cl_kernel kernel, size_t* global, size_t* local) {
+	//the first launch is a warm-up
+	cl_int err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, local, 0, NULL, NULL);
+	if (err != CL_SUCCESS || clFinish(queue) != CL_SUCCESS) return -1;
+
+	double start = omp_get_wtime();
+	for (int i = 0; i < AUTOTUNE_RUNS; i++) {
+		err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, local, 0, NULL, NULL);
+		if (err != CL_SUCCESS) return -1;
+	}
+	if (clFinish(queue) != CL_SUCCESS) return -1;
+	return (omp_get_wtime() - start)/AUTOTUNE_RUNS;
+}
+
+bool Filter::autotune(uchar* input) {
+	void* data = inputData(input, m_staging);
+	if (!data || !writeInput(m_queue, mem_images[0], data, CL_TRUE, NULL)) return false;
+	return autotuneKernels();
+}
+
+bool Filter::autotune(float* input) {
+	void* data = inputData(input, m_staging);
+	if (!data || !writeInput(m_queue, mem_images[0], data, CL_TRUE, NULL)) return false;
+	return autotuneKernels();
+}
+
+bool Filter::autotuneKernels() {
+	//a complete run sets the arguments of the kernels which change between their launches, e.g. the mipmap level
+	if (!runCLKernels(true)) return false;
+
+	for (size_t k = 0; k < m_tunable.size(); k++) {
+		const char* name = m_tunable[k].c_str();
+		size_t* local = local_sizes[name];
+		size_t* global = global_sizes[name];
+
+		size_t max_wg_size, preferred_wg_size;
+		clGetKernelWorkGroupInfo(kernels[name], m_device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_wg_size, NULL);
+		clGetKernelWorkGroupInfo(kernels[name], m_device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &preferred_wg_size, NULL);
+
+		size_t best_local[2] = {local[0], local[1]};
+		size_t best_global[2] = {global[0], global[1]};
+		double current_time = timeKernel(m_queue, kernels[name], global, local);
+		double best_time = current_time;
+		const size_t columns = (img_size.x + pixelsPerItem(name)-1)/pixelsPerItem(name);	//work items covering a row
+
+		//work-groups of a power of two work-items, from the preferred multiple up, in shapes from a row to a tall block
+		//each covering the image with 1, 4, 16 or 64 pixels, or vectors of pixels, per work-item
+		for (size_t total = std::max(preferred_wg_size, (size_t) 1); total <= std::min(max_wg_size, (size_t) AUTOTUNE_MAX_WG_SIZE); total *= 2) {
+			for (size_t ly = 1; ly <= total && ly <= 16; ly *= 2) {
+				local[0] = total/ly;
+				local[1] = ly;
+				for (int s = 1; s <= 8; s *= 2) {
+					global[0] = ((columns + s-1)/s + local[0]-1)/local[0]*local[0];
+					global[1] = ((img_size.y + s-1)/s + local[1]-1)/local[1]*local[1];
+
+					double time = timeKernel(m_queue, kernels[name], global, local);
+					if (time >= 0 && (best_time < 0 || time < best_time)) {
+						best_time = time;
+						best_local[0] = local[0];
+						best_local[1] = local[1];
+						best_global[0] = global[0];
+						best_global[1] = global[1];
+					}
+				}
+			}
+		}
+
+		local[0] = best_local[0];
+		local[1] = best_local[1];
+		global[0] = best_global[0];
+		global[1] = best_global[1];
+		m_runtime->setTunedSizes(tuningName(name), sizeClass(), local, global);
+		reportStatus("Tuned %s: Local=(%lu, %lu) Global=(%lu, %lu) %lf ms, previously %lf ms",
+			name, local[0], local[1], global[0], global[1], best_time*1000, current_time*1000);
+	}
+
+	//the kernels launched while tuning aren't part of the profile
+	releaseProfile();
+	m_runtime->saveTuning();
+	return true;
+}
 
 /////////////////
 // Image utils //
 /////////////////
 
-void Filter::setImageSize(int width, int height) {
+bool Filter::setImageSize(int width, int height) {
+	if (width == img_size.x && height == img_size.y) return true;
+
+	const int size_class = sizeClass();
 	img_size.x = width;
 	img_size.y = height;
+	clearReferenceCache();
+
+	//the program doesn't depend on the image size, so only the memory objects need replacing
+	if (m_program) {
+		//sizes tuned for another class of image size don't apply any more, the new class may have its own
+		if (sizeClass() != size_class) {
+			for (size_t k = 0; k < m_tunable.size(); k++) {
+				const char* name = m_tunable[k].c_str();
+				size_t max_wg_size;
+				if (!default2DSizes(name, max_wg_size)) return false;
+				useTunedSizes(name, max_wg_size);
+			}
+		}
+
+		releaseFrameSlots();
+		releaseMemory();
+		if (!setupMemory()) return false;
+		return setupKernelArgs();
+	}
+	return true;
+}
+
+bool Filter::setParameter(const char* name, float value) {
+	return false;
 }
 
 void Filter::setImageTextures(GLuint input_texture, GLuint output_texture) {
@@ -311,6 +891,7 @@ float* mipmap(float* input, int2 size, int level) {
 
 	float* result = (float*) calloc(m_width*m_height, sizeof(float));
 
+	#pragma omp parallel for schedule(static)
 	for (int y = 0; y < m_height; y++) {
 		for (int x = 0; x < m_width; x++) {
 			int _x = scale_factor*x;
@@ -321,37 +902,17 @@ float* mipmap(float* input, int2 size, int level) {
 	return result;
 }
 
-float clamp(float x, float min, float max) {
-	return x < min ? min : x > max ? max : x;
-}
-
-
-float getValue(float* data, int2 size, int2 pos) {
-	int _x = clamp(pos.x, 0, size.x-1);
-	int _y = clamp(pos.y, 0, size.y-1);
-	return data[_x + _y*size.x];
-}
-
-float getPixel(uchar* data, int2 image_size, int2 pixel_pos, int c) {
-	int _x = clamp(pixel_pos.x, 0, image_size.x-1);
-	int _y = clamp(pixel_pos.y, 0, image_size.y-1);
-	return ((float) data[(_x + _y*image_size.x)*NUM_CHANNELS + c]);
-}
-
-void setPixel(uchar* data, int2 image_size, int2 pixel_pos, int c, float value) {
-	int _x = clamp(pixel_pos.x, 0, image_size.x-1);
-	int _y = clamp(pixel_pos.y, 0, image_size.y-1);
-	data[(_x + _y*image_size.x)*NUM_CHANNELS + c] = clamp(value, 0.f, PIXEL_RANGE*1.f);
+double pairwiseSum(const double* values, int n) {
+	if (n <= 8) {
+		double sum = 0;
+		for (int i = 0; i < n; i++) sum += values[i];
+		return sum;
+	}
+	return pairwiseSum(values, n/2) + pairwiseSum(values + n/2, n - n/2);
 }
 
-float getPixelLuminance(uchar* image, int2 image_size, int2 pixel_pos) {
-	float3 pixel_val = {getPixel(image, image_size, pixel_pos, 0),
-						getPixel(image, image_size, pixel_pos, 1),
-						getPixel(image, image_size, pixel_pos, 2)};
-
-	return    pixel_val.x*0.2126
-			+ pixel_val.y*0.7152
-			+ pixel_val.z*0.0722;
+float clamp(float x, float min, float max) {
+	return x < min ? min : x > max ? max : x;
 }
 
 
@@ -9,6 +9,9 @@
 #pragma once
 
 #include <map>
+#include <deque>
+#include <algorithm>
+#include <vector>
 #include <math.h>
 #include <cassert>
 #include <cstdio>
@@ -22,6 +25,8 @@
 #include <CL/cl_gl.h>
 #include <omp.h>
 
+#include "CLRuntime.h"
+
 #ifdef __ANDROID_API__
 	#include <GLES/gl.h>
 	#define BUGGY_CL_GL 1	//consult the read-me
@@ -32,10 +37,17 @@
 
 #define METHOD_REFERENCE  (1<<1)
 #define METHOD_OPENCL     (1<<2)
+#define METHOD_NATIVE     (1<<3)
 
 #define PIXEL_RANGE	255	//8-bit
 #define NUM_CHANNELS 4	//RGBA
 
+#define AUTOTUNE_RUNS 5			//launches timed for each candidate kernel size
+#define AUTOTUNE_MAX_WG_SIZE 1024	//largest work-group tried by the autotuner
+
+#define NUM_FRAME_SLOTS 3	//frames in flight in the asynchronous pipeline: uploading, computing and reading back
+#define PROFILE_MAX_COMMANDS 100000	//profiles kept of the latest commands, the oldest being dropped when streaming
+
 #define CHECK_ERROR_OCL(err, op, action)							\
 	if (err != CL_SUCCESS) {										\
 		reportStatus("Error during operation '%s' (%d)", op, err);	\
@@ -56,26 +68,56 @@ typedef struct {
 	size_t width, height;
 } Image;
 
+//linear radiance as RGBA floats, 1 being the white of 8-bit images but brighter values being kept
+typedef struct {
+	float* data;
+	size_t width, height;
+} RadianceImage;
+
 typedef struct {
 	float x;
 	float y;
 	float z;
 } float3;
 
+//view of an image stored row by row, so that loops take a pointer to each row instead of
+//clamping the coordinates and recomputing the index on every channel read
+//only the accessors meant for the neighbours of pixels at the borders clamp the coordinates
+template <typename T, int CHANNELS>
+struct ImageView {
+	T* data;
+	int2 size;
+	int stride;	//elements from the start of a row to the start of the next
+
+	ImageView(T* _data, int2 _size, int _stride=0) : data(_data), size(_size), stride(_stride ? _stride : _size.x*CHANNELS) {}
+
+	T* row(int y) const { return data + y*stride; }
+	T* pixel(int x, int y) const { return row(y) + x*CHANNELS; }
+
+	//the pixel of the image nearest to (x, y)
+	T* clampedPixel(int x, int y) const {
+		return pixel(std::min(std::max(x, 0), size.x-1), std::min(std::max(y, 0), size.y-1));
+	}
+	//whether the pixels within margin of (x, y) are all in the image, so can be accessed without clamping
+	bool interior(int x, int y, int margin=1) const {
+		return x >= margin && y >= margin && x < size.x-margin && y < size.y-margin;
+	}
+};
+typedef ImageView<uchar, NUM_CHANNELS> PixelView;	//RGBA pixels
+typedef ImageView<float, NUM_CHANNELS> RadianceView;	//RGBA radiance
+typedef ImageView<float, 1> ValueView;	//a value for each pixel, e.g. its luminance
+
+//device timing of a command enqueued by a filter, in nanoseconds
+typedef struct {
+	std::string name;	//kernel or transfer
+	cl_ulong queued, submit, start, end;
+	cl_uint work_dim;	//0 for transfers
+	size_t global[2], local[2];
+} KernelProfile;
+
 class Filter {
 public:
-	typedef struct _Params_ {
-		cl_device_type type;
-		cl_uint platformIndex, deviceIndex;
-		bool opengl, verify;
-		_Params_() {
-			type = CL_DEVICE_TYPE_ALL;
-			opengl = false;
-			deviceIndex = 0;
-			platformIndex = 0;
-			verify = false;
-		}
-	} Params;
+	typedef CLRuntime::Params Params;
 
 public:
 	Filter();
@@ -89,22 +131,57 @@ public:
 	//acquire OpenGL objects, execute kernels and release the objects again
 	virtual bool runOpenCL(bool recomputeMapping=true);
 	//transfer data from input to the GPU, execute kernels and read the output from the GPU
+	//the input must be 8-bit or radiance as given by Params.inputType
 	virtual bool runOpenCL(uchar* input, uchar* output, bool recomputeMapping=true);
-	//execute the OpenCL kernels
-	virtual double runCLKernels(bool recomputeMapping) = 0;
+	virtual bool runOpenCL(float* input, uchar* output, bool recomputeMapping=true);
+	//execute the OpenCL kernels and wait for them to finish, returns the time taken
+	virtual double runCLKernels(bool recomputeMapping);
+	//enqueue the OpenCL kernels without waiting for them
+	virtual bool enqueueCLKernels(bool recomputeMapping) = 0;
+
+	//asynchronous pipeline for a sequence of frames of the same size: the upload of a frame overlaps
+	//the kernels of the previous frame and the readback of the one before that
+	//input and output must remain valid until the frame is completed
+	//submitFrame fails if NUM_FRAME_SLOTS frames are already in flight, completeFrame waits for the oldest one
+	virtual bool submitFrame(uchar* input, uchar* output, bool recomputeMapping=true);
+	virtual bool submitFrame(float* input, uchar* output, bool recomputeMapping=true);
+	virtual bool completeFrame();
+	int pendingFrames() const;
+
+	//with Params.profile, every command enqueued is timed on the device
+	//returns the commands enqueued since the last call in order, after waiting for them to finish
+	std::vector<KernelProfile> getProfile();
+	//reports the total time of each kernel and transfer, the largest first
+	void reportProfile(const std::vector<KernelProfile>& profile);
 	//release all the kernels and memory objects
 	virtual bool cleanupOpenCL() = 0;
 
+	//the tone mapped output of radiance input is the same as that of 8-bit input scaled to [0, 1]
 	virtual bool runReference(uchar* input, uchar* output) = 0;
+	virtual bool runReference(float* input, uchar* output) = 0;
+	//multithreaded implementation using the SIMD instructions of the CPU, see Native.h
+	virtual bool runNative(uchar* input, uchar* output) = 0;
+	virtual bool runNative(float* input, uchar* output) = 0;
 
-	//compute kernel sizes depending on the hardware being used
+	//compute kernel sizes depending on the hardware being used, 2D kernels may use those found by the autotuner instead
+	//tunable kernels must give the same result for any global and local size, e.g. by looping over the image
 	virtual bool kernel1DSizes(const char* kernel_name);
-	virtual bool kernel2DSizes(const char* kernel_name);
+	//vectorised kernels process VECTOR_WIDTH pixels of a row in each work item, so need fewer of them along x
+	virtual bool kernel2DSizes(const char* kernel_name, bool tunable=true, bool vectorised=false);
 
-	//set image properties
-	virtual void setImageSize(int width, int height);
+	//benchmarks candidate global and local sizes of the tunable kernels on the given frame, keeping the fastest
+	//the winners are stored in the tuning database of the runtime, which kernel sizes are looked up in at setup
+	virtual bool autotune(uchar* input);
+	virtual bool autotune(float* input);
+
+	//set image properties, the memory objects are reallocated if OpenCL has already been set up
+	virtual bool setImageSize(int width, int height);
 	virtual void setImageTextures(GLuint input_texture, GLuint output_texture);
 
+	//change a tone mapping parameter by name without rebuilding the program
+	//returns false if the filter doesn't have such a parameter
+	virtual bool setParameter(const char* name, float value);
+
 	virtual void setStatusCallback(int (*callback)(const char*, va_list args));
 
 protected:
@@ -112,13 +189,81 @@ protected:
 	Image m_reference;
 	int (*m_statusCallback)(const char*, va_list args);
 	void reportStatus(const char *format, ...) const;
-	virtual bool verify(uchar* input, uchar* output, float tolerance=1.f, float maxErrorPercent=0.05);
+	template <typename T> bool verify(T* input, uchar* output, float tolerance=1.f, float maxErrorPercent=0.05);
 
+	CLRuntime* m_runtime;	//shared OpenCL runtime, the device, context and queue below belong to it
 	cl_device_id m_device;
 	cl_context m_clContext;
 	cl_command_queue m_queue;
 	cl_program m_program;
 	cl_mem mem_images[2];
+	Params m_params;	//parameters OpenCL was set up with
+
+	//the data of a frame as the input images hold it, of the channel type given by Params.inputType
+	//NULL if the input isn't of that kind, radiance being converted to half floats in staging for CL_HALF_FLOAT images
+	void* inputData(uchar* input, std::vector<uint16_t>& staging);
+	void* inputData(float* input, std::vector<uint16_t>& staging);
+	std::vector<uint16_t> m_staging;	//half floats given to runOpenCL and autotune
+	size_t inputPixelSize() const;
+	//write the data of a frame to an input image, which must be kept until the write is done
+	bool writeInput(cl_command_queue queue, cl_mem image, void* data, cl_bool blocking, cl_event* event);
+	//an input image using the memory of the data instead of its own, for Params.hostInput
+	cl_mem wrapInput(void* data);
+	//puts the filter's input image back in place of the wrapped one, which is released
+	bool restoreInput(cl_mem host_image);
+	template <typename T> bool runOpenCLFrame(T* input, uchar* output, bool recomputeMapping);
+
+	//a frame in flight in the asynchronous pipeline, each with its own input and output images
+	struct FrameSlot {
+		cl_mem images[2];
+		cl_event uploaded, computed, downloaded;
+		uchar* input;		//either input or radiance is set
+		float* radiance;
+		uchar* output;
+		std::vector<uint16_t> staging;
+		FrameSlot() : uploaded(0), computed(0), downloaded(0), input(NULL), radiance(NULL), output(NULL) {
+			images[0] = images[1] = 0;
+		}
+	};
+	FrameSlot m_slots[NUM_FRAME_SLOTS];
+	int m_next_slot;	//slot the next frame is submitted to
+	int m_pending;		//number of frames submitted but not yet completed
+	bool setupFrameSlots();
+	void releaseFrameSlots();
+	//the slot the next frame is submitted to, NULL if they are all in flight
+	FrameSlot* nextFrameSlot();
+	//enqueue the kernels and the readback of the frame whose upload has been enqueued on the slot
+	bool enqueueFrame(FrameSlot& slot, bool recomputeMapping);
+
+	//profiled commands whose events haven't been read yet
+	std::vector<std::pair<cl_event, KernelProfile> > m_profile;
+	//profiles of the commands whose events have been read and released, at most PROFILE_MAX_COMMANDS of them
+	std::deque<KernelProfile> m_profile_done;
+	//reads the events of the finished commands into m_profile_done, in order up to the first unfinished one
+	//or waiting for all of them
+	void collectProfile(bool wait);
+	//returns the event to be passed to the next command when profiling, NULL otherwise
+	cl_event* profileEvent(const char* name, cl_uint work_dim=0, const size_t* global=NULL, const size_t* local=NULL);
+	void releaseProfile();
+	//enqueue the kernel with its global and local sizes
+	cl_int enqueueKernel(const char* name, cl_uint work_dim);
+	//enqueue mipmap_pyramid of opencl/mipmap.cl to compute levels 1 to num_levels-1 of a pyramid from level 0
+	//the filter sets its first four arguments, several levels being computed by each launch
+	bool enqueueMipmapPyramid(int num_levels);
+
+	std::vector<std::string> m_tunable;	//2D kernels whose sizes the autotuner may change
+	std::vector<std::string> m_vectorised;	//2D kernels processing m_vector_width pixels in each work item
+	int m_vector_width;	//VECTOR_WIDTH the program is built with
+	//pixels of a row processed by each work item of the kernel
+	size_t pixelsPerItem(const char* kernel_name) const;
+	//images of a similar number of pixels share their tuned sizes
+	int sizeClass() const;
+	std::string tuningName(const char* kernel_name) const;
+	bool useTunedSizes(const char* kernel_name, size_t max_wg_size);
+	//sets the sizes of a 2D kernel from the hardware alone, those it has before any tuned sizes are applied
+	bool default2DSizes(const char* kernel_name, size_t& max_wg_size);
+	//benchmarks the tunable kernels on the frame in the input image
+	bool autotuneKernels();
 
 	size_t max_cu;	//max compute units
 
@@ -131,7 +276,15 @@ protected:
 	GLuint in_tex;
 	GLuint out_tex;
 
+	//allocate the memory objects which depend on the image size, and release them again
+	virtual bool setupMemory() = 0;
+	virtual void releaseMemory() = 0;
+	//set the kernel arguments which depend on the memory objects and the parameters of the filter
+	virtual bool setupKernelArgs() = 0;
+
+	//attach to the shared runtime and build the program of the filter
 	bool initCL(cl_context_properties context_prop[], const Params& params, const char *source, const char *options);
+	//release the program of the filter, the shared runtime stays alive
 	void releaseCL();
 };
 
@@ -140,11 +293,41 @@ double getCurrentTime();
 
 //image utils
 float* mipmap(float* input, int2 input_size, int level=1);
+//sum of the values added pairwise in a fixed order, so that reductions over the rows of an image
+//give the same result however many threads computed the sums of the rows
+double pairwiseSum(const double* values, int n);
 float clamp(float x, float min, float max);
-float getPixelLuminance(uchar* image, int2 image_size, int2 pixel_pos);
-float getValue(float* data, int2 size, int2 pos);
-float getPixel(uchar* data, int2 img_size, int2 pixel_pos, int c);
-void setPixel(uchar* data, int2 img_size, int2 pixel_pos, int c, float value);
+
+//colour of an RGBA pixel, and its luminance
+inline float3 getColour(const uchar* pixel) {
+	float3 rgb = {(float) pixel[0], (float) pixel[1], (float) pixel[2]};
+	return rgb;
+}
+inline float getLuminance(const uchar* pixel) {
+	return pixel[0]*0.2126 + pixel[1]*0.7152 + pixel[2]*0.0722;
+}
+//radiance is scaled to the range of 8-bit pixels, so the filters give the same results for both
+inline float3 getColour(const float* pixel) {
+	float3 rgb = {pixel[0]*PIXEL_RANGE, pixel[1]*PIXEL_RANGE, pixel[2]*PIXEL_RANGE};
+	return rgb;
+}
+inline float getLuminance(const float* pixel) {
+	float3 rgb = getColour(pixel);
+	return rgb.x*0.2126 + rgb.y*0.7152 + rgb.z*0.0722;
+}
+//brightness V of an RGBA pixel, the largest of its channels
+inline float getBrightness(const uchar* pixel) {
+	return std::max(std::max(pixel[0], pixel[1]), pixel[2]);
+}
+inline float getBrightness(const float* pixel) {
+	return std::max(std::max(pixel[0], pixel[1]), pixel[2])*PIXEL_RANGE;
+}
+//sets the colour of an RGBA pixel, clamping each channel to [0, PIXEL_RANGE]
+inline void setColour(uchar* pixel, float3 rgb) {
+	pixel[0] = clamp(rgb.x, 0.f, PIXEL_RANGE*1.f);
+	pixel[1] = clamp(rgb.y, 0.f, PIXEL_RANGE*1.f);
+	pixel[2] = clamp(rgb.z, 0.f, PIXEL_RANGE*1.f);
+}
 
 //pixel conversion
 float3 RGBtoHSV(float3 rgb);
@@ -152,4 +335,7 @@ float3 HSVtoRGB(float3 hsv);
 float3 RGBtoXYZ(float3 rgb);
 float3 XYZtoRGB(float3 xyz);
 
+//how well exposed a pixel value in [0, 1] is, peaking at 0.5 and falling to 0 at the ends
+float weight(float luminance);
+
 }
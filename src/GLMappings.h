@@ -0,0 +1,34 @@
+// GLMappings.h (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#pragma once
+
+namespace hdr
+{
+//value read by an OpenCL kernel for each 8 bit value of an OpenGL texture pixel on Snapdragon's Android OpenCL implementation
+//taken from android/GL-CL_mappings, consult the read-me
+#define GL_CL_MAPPINGS_SIZE 256
+static const int gl_cl_mappings[GL_CL_MAPPINGS_SIZE] = {
+	    0,  7172,  8196,  8710,  9220,  9477,  9734,  9991, 10244, 10372, 10501, 10629, 10758, 10886, 11015, 11143,
+	11268, 11332, 11396, 11460, 11525, 11589, 11653, 11717, 11782, 11846, 11910, 11974, 12039, 12103, 12167, 12231,
+	12292, 12324, 12356, 12388, 12420, 12452, 12484, 12516, 12549, 12581, 12613, 12645, 12677, 12709, 12741, 12773,
+	12806, 12838, 12870, 12902, 12934, 12966, 12998, 13030, 13063, 13095, 13127, 13159, 13191, 13223, 13255, 13287,
+	13316, 13332, 13348, 13364, 13380, 13396, 13412, 13428, 13444, 13460, 13476, 13492, 13508, 13524, 13540, 13556,
+	13573, 13589, 13605, 13621, 13637, 13653, 13669, 13685, 13701, 13717, 13733, 13749, 13765, 13781, 13797, 13813,
+	13830, 13846, 13862, 13878, 13894, 13910, 13926, 13942, 13958, 13974, 13990, 14006, 14022, 14038, 14054, 14070,
+	14087, 14103, 14119, 14135, 14151, 14167, 14183, 14199, 14215, 14231, 14247, 14263, 14279, 14295, 14311, 14327,
+	14340, 14348, 14356, 14364, 14372, 14380, 14388, 14396, 14404, 14412, 14420, 14428, 14436, 14444, 14452, 14460,
+	14468, 14476, 14484, 14492, 14500, 14508, 14516, 14524, 14532, 14540, 14548, 14556, 14564, 14572, 14580, 14588,
+	14597, 14605, 14613, 14621, 14629, 14637, 14645, 14653, 14661, 14669, 14677, 14685, 14693, 14701, 14709, 14717,
+	14725, 14733, 14741, 14749, 14757, 14765, 14773, 14781, 14789, 14797, 14805, 14813, 14821, 14829, 14837, 14845,
+	14854, 14862, 14870, 14878, 14886, 14894, 14902, 14910, 14918, 14926, 14934, 14942, 14950, 14958, 14966, 14974,
+	14982, 14990, 14998, 15006, 15014, 15022, 15030, 15038, 15046, 15054, 15062, 15070, 15078, 15086, 15094, 15102,
+	15111, 15119, 15127, 15135, 15143, 15151, 15159, 15167, 15175, 15183, 15191, 15199, 15207, 15215, 15223, 15231,
+	15239, 15247, 15255, 15263, 15271, 15279, 15287, 15295, 15303, 15311, 15319, 15327, 15335, 15343, 15351, 15359,
+};
+}
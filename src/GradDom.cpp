@@ -14,6 +14,10 @@
 #include <vector>
 
 #include "GradDom.h"
+#include "Native.h"
+#include "DCT.h"
+#include "opencl/vector.h"
+#include "opencl/mipmap.h"
 #include "opencl/gradDom.h"
 
 using namespace hdr;
@@ -23,19 +27,28 @@ GradDom::GradDom(float _adjust_alpha, float _beta, float _sat) : Filter() {
 	adjust_alpha = _adjust_alpha;
 	beta = _beta;
 	sat = _sat;
+	poisson_solver = POISSON_JACOBI;
+	convergence = 0.0005;
+	max_iterations = 10000;
+	check_interval = 32;
+	streaming = false;
+	frame_iterations = 0;
+	frame_time = 0;
+	m_prev_dr = NULL;
+	m_cl_warm = false;
 }
 
-bool GradDom::setupOpenCL(cl_context_properties context_prop[], const Params& params) {
+GradDom::~GradDom() {
+	resetStream();
+}
 
-	//get the number of mipmaps needed for the image of this size
-	num_mipmaps = 0;
-	for (int x=img_size.x, y=img_size.y ; x >= 32 && y >= 32; y/=2, x/=2) num_mipmaps++;
+bool GradDom::setupOpenCL(cl_context_properties context_prop[], const Params& params) {
 
 	char flags[1024];
-	sprintf(flags, "-cl-fast-relaxed-math -D WIDTH=%d -D HEIGHT=%d -D NUM_MIPMAPS=%d -D ADJUST_ALPHA=%f -D BETA=%f -D SAT=%f -D BUGGY_CL_GL=%d",
-				img_size.x, img_size.y, num_mipmaps, adjust_alpha, beta, sat, BUGGY_CL_GL);
+	sprintf(flags, "-cl-fast-relaxed-math -D BUGGY_CL_GL=%d", BUGGY_CL_GL);
 
-	if (!initCL(context_prop, params, gradDom_kernel, flags)) return false;
+	std::string source = std::string(vector_kernel) + mipmap_kernel + gradDom_kernel;
+	if (!initCL(context_prop, params, source.c_str(), flags)) return false;
 
 	cl_int err;
 
@@ -46,8 +59,8 @@ bool GradDom::setupOpenCL(cl_context_properties context_prop[], const Params& pa
 	CHECK_ERROR_OCL(err, "creating computeLogLum kernel", return false);
 
 	//this kernel computes all the mipmap levels of the luminance
-	kernels["channel_mipmap"] = clCreateKernel(m_program, "channel_mipmap", &err);
-	CHECK_ERROR_OCL(err, "creating channel_mipmap kernel", return false);
+	kernels["mipmap_pyramid"] = clCreateKernel(m_program, "mipmap_pyramid", &err);
+	CHECK_ERROR_OCL(err, "creating mipmap_pyramid kernel", return false);
 
 	//this kernel generates gradient magnitude at each of the mipmap levels
 	kernels["gradient_mag"] = clCreateKernel(m_program, "gradient_mag", &err);
@@ -77,16 +90,26 @@ bool GradDom::setupOpenCL(cl_context_properties context_prop[], const Params& pa
 	kernels["divG"] = clCreateKernel(m_program, "divG", &err);
 	CHECK_ERROR_OCL(err, "creating divG kernel", return false);
 
+	//performs a red-black iteration of the poisson solver
+	kernels["poisson_rb"] = clCreateKernel(m_program, "poisson_rb", &err);
+	CHECK_ERROR_OCL(err, "creating poisson_rb kernel", return false);
+
+	//reconstructs the colour image from the compressed dynamic range
+	kernels["tonemap"] = clCreateKernel(m_program, "tonemap", &err);
+	CHECK_ERROR_OCL(err, "creating tonemap kernel", return false);
+
 	/////////////////////////////////////////////////////////////////kernel sizes
 
-	kernel2DSizes("computeLogLum");
-	kernel2DSizes("channel_mipmap");
+	kernel2DSizes("computeLogLum", true, true);
+	kernel2DSizes("mipmap_pyramid", false);	//the work groups hold a tile in local memory
 	kernel2DSizes("gradient_mag");
 	kernel1DSizes("partialReduc");
 	kernel1DSizes("coarsest_level_attenfunc");
-	kernel2DSizes("atten_func");
+	kernel2DSizes("atten_func", false);	//launched once per mipmap level with different arguments
 	kernel2DSizes("grad_atten");
 	kernel2DSizes("divG");
+	kernel2DSizes("poisson_rb", false);	//launched for each colour with different arguments
+	kernel2DSizes("tonemap", true, true);
 
 	reportStatus("---------------------------------Kernel finalReduc:");
 
@@ -103,24 +126,34 @@ bool GradDom::setupOpenCL(cl_context_properties context_prop[], const Params& pa
 		global_sizes["finalReduc"] = global;
 		reportStatus("Kernel sizes: Local=%lu Global=%lu", local[0], global[0]);
 
-	/////////////////////////////////////////////////////////////////allocating memory
+	if (!setupMemory()) return false;
+	if (!setupKernelArgs()) return false;
+
+	reportStatus("\n\n");
+
+	return true;
+}
+
+bool GradDom::setupMemory() {
+	cl_int err;
+
+	//get the number of mipmaps needed for the image of this size
+	num_mipmaps = 0;
+	for (int x=img_size.x, y=img_size.y ; x >= 32 && y >= 32; y/=2, x/=2) num_mipmaps++;
 
 	//initialising information regarding all mipmap levels
 	m_width  = (int*) calloc(num_mipmaps, sizeof(int));
 	m_height = (int*) calloc(num_mipmaps, sizeof(int));
 	m_offset = (int*) calloc(num_mipmaps, sizeof(int));
-	m_divider = (float*) calloc(num_mipmaps, sizeof(float));
 
 	m_offset[0] = 0;
 	m_width[0]  = img_size.x;
 	m_height[0] = img_size.y;
-	m_divider[0] = 2;
 
 	for (int level=1; level<num_mipmaps; level++) {
 		m_width[level]  = m_width[level-1]/2;
 		m_height[level] = m_height[level-1]/2;
 		m_offset[level] = m_offset[level-1] + m_width[level-1]*m_height[level-1];
-		m_divider[level] = pow(2, level+1);
 	}
 
 	//initialise memory objects
@@ -134,7 +167,16 @@ bool GradDom::setupOpenCL(cl_context_properties context_prop[], const Params& pa
 	mems["attenfunc_Mips"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(float)*img_size.x*img_size.y*2, NULL, &err);
 	CHECK_ERROR_OCL(err, "creating attenfunc_Mips memory", return false);
 
-	mems["gradient_PartialSum"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(float)*num_wg, NULL, &err);
+	mems["m_width"] = clCreateBuffer(m_clContext, CL_MEM_COPY_HOST_PTR, sizeof(int)*num_mipmaps, m_width, &err);
+	CHECK_ERROR_OCL(err, "creating m_width memory", return false);
+
+	mems["m_height"] = clCreateBuffer(m_clContext, CL_MEM_COPY_HOST_PTR, sizeof(int)*num_mipmaps, m_height, &err);
+	CHECK_ERROR_OCL(err, "creating m_height memory", return false);
+
+	mems["m_offset"] = clCreateBuffer(m_clContext, CL_MEM_COPY_HOST_PTR, sizeof(int)*num_mipmaps, m_offset, &err);
+	CHECK_ERROR_OCL(err, "creating m_offset memory", return false);
+
+	mems["gradient_PartialSum"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(float)*global_sizes["finalReduc"][0]*num_mipmaps, NULL, &err);
 	CHECK_ERROR_OCL(err, "creating gradient_PartialSum memory", return false);
 
 	mems["k_alphas"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(float)*num_mipmaps, NULL, &err);
@@ -149,7 +191,13 @@ bool GradDom::setupOpenCL(cl_context_properties context_prop[], const Params& pa
 	mems["div_grad"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(float)*img_size.x*img_size.y, NULL, &err);
 	CHECK_ERROR_OCL(err, "creating div_grad memory", return false);
 
-	if (params.opengl) {
+	mems["new_dr"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(float)*img_size.x*img_size.y, NULL, &err);
+	CHECK_ERROR_OCL(err, "creating new_dr memory", return false);
+
+	mems["unconverged"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, &err);
+	CHECK_ERROR_OCL(err, "creating unconverged memory", return false);
+
+	if (m_params.opengl) {
 		mem_images[0] = clCreateFromGLTexture2D(m_clContext, CL_MEM_READ_ONLY, GL_TEXTURE_2D, 0, in_tex, &err);
 		CHECK_ERROR_OCL(err, "creating gl input texture", return false);
 		
@@ -159,36 +207,79 @@ bool GradDom::setupOpenCL(cl_context_properties context_prop[], const Params& pa
 	else {
 		cl_image_format format;
 		format.image_channel_order = CL_RGBA;
-		format.image_channel_data_type = CL_UNSIGNED_INT8;
+		format.image_channel_data_type = m_params.inputType;
 		mem_images[0] = clCreateImage2D(m_clContext, CL_MEM_READ_ONLY, &format, img_size.x, img_size.y, 0, NULL, &err);
 		CHECK_ERROR_OCL(err, "creating input image memory", return false);
-	
+
+		format.image_channel_data_type = CL_UNSIGNED_INT8;
 		mem_images[1] = clCreateImage2D(m_clContext, CL_MEM_WRITE_ONLY, &format, img_size.x, img_size.y, 0, NULL, &err);
 		CHECK_ERROR_OCL(err, "creating output image memory", return false);
 	}
 
+	return true;
+}
 
-	/////////////////////////////////////////////////////////////////setting kernel arguements
+void GradDom::releaseMemory() {
+	m_cl_warm = false;
+	clReleaseMemObject(mem_images[0]);
+	clReleaseMemObject(mem_images[1]);
+	clReleaseMemObject(mems["logLum_Mips"]);
+	clReleaseMemObject(mems["gradient_Mips"]);
+	clReleaseMemObject(mems["attenfunc_Mips"]);
+	clReleaseMemObject(mems["m_width"]);
+	clReleaseMemObject(mems["m_height"]);
+	clReleaseMemObject(mems["m_offset"]);
+	clReleaseMemObject(mems["gradient_PartialSum"]);
+	clReleaseMemObject(mems["k_alphas"]);
+	clReleaseMemObject(mems["atten_grad_x"]);
+	clReleaseMemObject(mems["atten_grad_y"]);
+	clReleaseMemObject(mems["div_grad"]);
+	clReleaseMemObject(mems["new_dr"]);
+	clReleaseMemObject(mems["unconverged"]);
+	free(m_width);
+	free(m_height);
+	free(m_offset);
+}
+
+bool GradDom::setupKernelArgs() {
+	cl_int err;
 
 	err  = clSetKernelArg(kernels["computeLogLum"], 0, sizeof(cl_mem), &mem_images[0]);
 	err  = clSetKernelArg(kernels["computeLogLum"], 1, sizeof(cl_mem), &mems["logLum_Mips"]);
+	err  = clSetKernelArg(kernels["computeLogLum"], 2, sizeof(cl_int2), &img_size);
 	CHECK_ERROR_OCL(err, "setting computeLogLum arguments", return false);
 
-	err  = clSetKernelArg(kernels["channel_mipmap"], 0, sizeof(cl_mem), &mems["logLum_Mips"]);
-	CHECK_ERROR_OCL(err, "setting channel_mipmap arguments", return false);
+	err  = clSetKernelArg(kernels["mipmap_pyramid"], 0, sizeof(cl_mem), &mems["logLum_Mips"]);
+	err  = clSetKernelArg(kernels["mipmap_pyramid"], 1, sizeof(cl_mem), &mems["m_width"]);
+	err  = clSetKernelArg(kernels["mipmap_pyramid"], 2, sizeof(cl_mem), &mems["m_height"]);
+	err  = clSetKernelArg(kernels["mipmap_pyramid"], 3, sizeof(cl_mem), &mems["m_offset"]);
+	CHECK_ERROR_OCL(err, "setting mipmap_pyramid arguments", return false);
 
 	err  = clSetKernelArg(kernels["gradient_mag"], 0, sizeof(cl_mem), &mems["logLum_Mips"]);
 	err  = clSetKernelArg(kernels["gradient_mag"], 1, sizeof(cl_mem), &mems["gradient_Mips"]);
+	err  = clSetKernelArg(kernels["gradient_mag"], 2, sizeof(cl_mem), &mems["m_width"]);
+	err  = clSetKernelArg(kernels["gradient_mag"], 3, sizeof(cl_mem), &mems["m_height"]);
+	err  = clSetKernelArg(kernels["gradient_mag"], 4, sizeof(cl_mem), &mems["m_offset"]);
+	err  = clSetKernelArg(kernels["gradient_mag"], 5, sizeof(int), &num_mipmaps);
 	CHECK_ERROR_OCL(err, "setting gradient_mag arguments", return false);
 
 	err  = clSetKernelArg(kernels["partialReduc"], 0, sizeof(cl_mem), &mems["gradient_Mips"]);
 	err  = clSetKernelArg(kernels["partialReduc"], 1, sizeof(cl_mem), &mems["gradient_PartialSum"]);
 	err  = clSetKernelArg(kernels["partialReduc"], 2, sizeof(float)*local_sizes["partialReduc"][0], NULL);
+	err  = clSetKernelArg(kernels["partialReduc"], 3, sizeof(cl_mem), &mems["m_width"]);
+	err  = clSetKernelArg(kernels["partialReduc"], 4, sizeof(cl_mem), &mems["m_height"]);
+	err  = clSetKernelArg(kernels["partialReduc"], 5, sizeof(cl_mem), &mems["m_offset"]);
+	err  = clSetKernelArg(kernels["partialReduc"], 6, sizeof(int), &num_mipmaps);
 	CHECK_ERROR_OCL(err, "setting partialReduc arguments", return false);
 
 	err  = clSetKernelArg(kernels["finalReduc"], 0, sizeof(cl_mem), &mems["gradient_PartialSum"]);
 	err  = clSetKernelArg(kernels["finalReduc"], 1, sizeof(cl_mem), &mems["k_alphas"]);
+	err  = clSetKernelArg(kernels["finalReduc"], 2, sizeof(cl_mem), &mems["m_width"]);
+	err  = clSetKernelArg(kernels["finalReduc"], 3, sizeof(cl_mem), &mems["m_height"]);
+	err  = clSetKernelArg(kernels["finalReduc"], 4, sizeof(int), &num_mipmaps);
+	unsigned int num_wg = global_sizes["finalReduc"][0];
 	err  = clSetKernelArg(kernels["finalReduc"], 5, sizeof(unsigned int), &num_wg);
+	err  = clSetKernelArg(kernels["finalReduc"], 6, sizeof(float), &adjust_alpha);
 	CHECK_ERROR_OCL(err, "setting finalReduc arguments", return false);
 
 	err  = clSetKernelArg(kernels["coarsest_level_attenfunc"], 0, sizeof(cl_mem), &mems["gradient_Mips"]);
@@ -197,91 +288,66 @@ bool GradDom::setupOpenCL(cl_context_properties context_prop[], const Params& pa
 	err  = clSetKernelArg(kernels["coarsest_level_attenfunc"], 3, sizeof(int), &m_width[num_mipmaps-1]);
 	err  = clSetKernelArg(kernels["coarsest_level_attenfunc"], 4, sizeof(int), &m_height[num_mipmaps-1]);
 	err  = clSetKernelArg(kernels["coarsest_level_attenfunc"], 5, sizeof(int), &m_offset[num_mipmaps-1]);
+	err  = clSetKernelArg(kernels["coarsest_level_attenfunc"], 6, sizeof(float), &beta);
 	CHECK_ERROR_OCL(err, "setting coarsest_level_attenfunc arguments", return false);
 
 	err  = clSetKernelArg(kernels["atten_func"], 0, sizeof(cl_mem), &mems["gradient_Mips"]);
 	err  = clSetKernelArg(kernels["atten_func"], 1, sizeof(cl_mem), &mems["attenfunc_Mips"]);
 	err  = clSetKernelArg(kernels["atten_func"], 2, sizeof(cl_mem), &mems["k_alphas"]);
+	err  = clSetKernelArg(kernels["atten_func"], 10, sizeof(float), &beta);
 	CHECK_ERROR_OCL(err, "setting atten_func arguments", return false);
 
 	err  = clSetKernelArg(kernels["grad_atten"], 0, sizeof(cl_mem), &mems["atten_grad_x"]);
 	err  = clSetKernelArg(kernels["grad_atten"], 1, sizeof(cl_mem), &mems["atten_grad_y"]);
 	err  = clSetKernelArg(kernels["grad_atten"], 2, sizeof(cl_mem), &mems["logLum_Mips"]);
 	err  = clSetKernelArg(kernels["grad_atten"], 3, sizeof(cl_mem), &mems["attenfunc_Mips"]);
+	err  = clSetKernelArg(kernels["grad_atten"], 4, sizeof(cl_int2), &img_size);
 	CHECK_ERROR_OCL(err, "setting grad_atten arguments", return false);
 
 	err  = clSetKernelArg(kernels["divG"], 0, sizeof(cl_mem), &mems["atten_grad_x"]);
 	err  = clSetKernelArg(kernels["divG"], 1, sizeof(cl_mem), &mems["atten_grad_y"]);
 	err  = clSetKernelArg(kernels["divG"], 2, sizeof(cl_mem), &mems["div_grad"]);
+	err  = clSetKernelArg(kernels["divG"], 3, sizeof(cl_int2), &img_size);
 	CHECK_ERROR_OCL(err, "setting divG arguments", return false);
 
-	reportStatus("\n\n");
+	err  = clSetKernelArg(kernels["poisson_rb"], 0, sizeof(cl_mem), &mems["new_dr"]);
+	err  = clSetKernelArg(kernels["poisson_rb"], 1, sizeof(cl_mem), &mems["div_grad"]);
+	err  = clSetKernelArg(kernels["poisson_rb"], 2, sizeof(cl_mem), &mems["unconverged"]);
+	err  = clSetKernelArg(kernels["poisson_rb"], 3, sizeof(float), &convergence);
+	err  = clSetKernelArg(kernels["poisson_rb"], 5, sizeof(cl_int2), &img_size);
+	CHECK_ERROR_OCL(err, "setting poisson_rb arguments", return false);
+
+	err  = clSetKernelArg(kernels["tonemap"], 0, sizeof(cl_mem), &mem_images[0]);
+	err  = clSetKernelArg(kernels["tonemap"], 1, sizeof(cl_mem), &mem_images[1]);
+	err  = clSetKernelArg(kernels["tonemap"], 2, sizeof(cl_mem), &mems["logLum_Mips"]);
+	err  = clSetKernelArg(kernels["tonemap"], 3, sizeof(cl_mem), &mems["new_dr"]);
+	err  = clSetKernelArg(kernels["tonemap"], 4, sizeof(cl_int2), &img_size);
+	err  = clSetKernelArg(kernels["tonemap"], 5, sizeof(float), &sat);
+	CHECK_ERROR_OCL(err, "setting tonemap arguments", return false);
 
 	return true;
 }
 
-double GradDom::runCLKernels(bool recomputeMapping) {
-	double start = omp_get_wtime();
-
+bool GradDom::enqueueCLKernels(bool recomputeMapping) {
 	cl_int err;
 	if (recomputeMapping) {
-		err = clEnqueueNDRangeKernel(m_queue, kernels["computeLogLum"], 2, NULL, global_sizes["computeLogLum"], local_sizes["computeLogLum"], 0, NULL, NULL);
+		err = enqueueKernel("computeLogLum", 2);
 		CHECK_ERROR_OCL(err, "enqueuing computeLogLum kernel", return false);
 
-		//compute the gradient magniute of mipmap level 0
-		err  = clSetKernelArg(kernels["gradient_mag"], 2, sizeof(int), &m_width[0]);
-		err  = clSetKernelArg(kernels["gradient_mag"], 3, sizeof(int), &m_height[0]);
-		err  = clSetKernelArg(kernels["gradient_mag"], 4, sizeof(int), &m_offset[0]);
-		err  = clSetKernelArg(kernels["gradient_mag"], 5, sizeof(float), &m_divider[0]);
-		err = clEnqueueNDRangeKernel(m_queue, kernels["gradient_mag"], 2, NULL, global_sizes["gradient_mag"], local_sizes["gradient_mag"], 0, NULL, NULL);
+		//creating mipmaps, then their gradient magnitudes and average gradients
+		if (!enqueueMipmapPyramid(num_mipmaps)) return false;
+
+		err = enqueueKernel("gradient_mag", 2);
 		CHECK_ERROR_OCL(err, "enqueuing gradient_mag kernel", return false);
 
-		err  = clSetKernelArg(kernels["partialReduc"], 3, sizeof(int), &m_width[0]);
-		err  = clSetKernelArg(kernels["partialReduc"], 4, sizeof(int), &m_height[0]);
-		err  = clSetKernelArg(kernels["partialReduc"], 5, sizeof(int), &m_offset[0]);
-		err = clEnqueueNDRangeKernel(m_queue, kernels["partialReduc"], 1, NULL, &global_sizes["partialReduc"][0], &local_sizes["partialReduc"][0], 0, NULL, NULL);
-		CHECK_ERROR_OCL(err, "setting partialReduc arguments", return false);
-
-		int level = 0;
-		err  = clSetKernelArg(kernels["finalReduc"], 2, sizeof(int), &level);
-		err  = clSetKernelArg(kernels["finalReduc"], 3, sizeof(int), &m_width[level]);
-		err  = clSetKernelArg(kernels["finalReduc"], 4, sizeof(int), &m_height[level]);
-		err = clEnqueueNDRangeKernel(m_queue, kernels["finalReduc"], 1, NULL, &global_sizes["finalReduc"][0], &local_sizes["finalReduc"][0], 0, NULL, NULL);
+		err = enqueueKernel("partialReduc", 1);
+		CHECK_ERROR_OCL(err, "enqueuing partialReduc kernel", return false);
+
+		err = enqueueKernel("finalReduc", 1);
 		CHECK_ERROR_OCL(err, "enqueuing finalReduc kernel", return false);
-	
-		//creating mipmaps and their gradient magnitudes
-		for (int level=1; level<num_mipmaps; level++) {
-			err  = clSetKernelArg(kernels["channel_mipmap"], 1, sizeof(int), &m_width[level-1]);
-			err  = clSetKernelArg(kernels["channel_mipmap"], 2, sizeof(int), &m_offset[level-1]);
-			err  = clSetKernelArg(kernels["channel_mipmap"], 3, sizeof(int), &m_width[level]);
-			err  = clSetKernelArg(kernels["channel_mipmap"], 4, sizeof(int), &m_height[level]);
-			err  = clSetKernelArg(kernels["channel_mipmap"], 5, sizeof(int), &m_offset[level]);
-			err = clEnqueueNDRangeKernel(m_queue, kernels["channel_mipmap"], 2, NULL, global_sizes["channel_mipmap"], local_sizes["channel_mipmap"], 0, NULL, NULL);
-			CHECK_ERROR_OCL(err, "enqueuing channel_mipmap kernel", return false);
-
-			err  = clSetKernelArg(kernels["gradient_mag"], 2, sizeof(int), &m_width[level]);
-			err  = clSetKernelArg(kernels["gradient_mag"], 3, sizeof(int), &m_height[level]);
-			err  = clSetKernelArg(kernels["gradient_mag"], 4, sizeof(int), &m_offset[level]);
-			err  = clSetKernelArg(kernels["gradient_mag"], 5, sizeof(float), &m_divider[level]);
-			err = clEnqueueNDRangeKernel(m_queue, kernels["gradient_mag"], 2, NULL, global_sizes["gradient_mag"], local_sizes["gradient_mag"], 0, NULL, NULL);
-			CHECK_ERROR_OCL(err, "enqueuing gradient_mag kernel", return false);			
-
-			err  = clSetKernelArg(kernels["partialReduc"], 3, sizeof(int), &m_width[level]);
-			err  = clSetKernelArg(kernels["partialReduc"], 4, sizeof(int), &m_height[level]);
-			err  = clSetKernelArg(kernels["partialReduc"], 5, sizeof(int), &m_offset[level]);
-			err = clEnqueueNDRangeKernel(m_queue, kernels["partialReduc"], 1, NULL, &global_sizes["partialReduc"][0], &local_sizes["partialReduc"][0], 0, NULL, NULL);
-			CHECK_ERROR_OCL(err, "setting partialReduc arguments", return false);
-	
-			err  = clSetKernelArg(kernels["finalReduc"], 2, sizeof(int), &level);
-			err  = clSetKernelArg(kernels["finalReduc"], 3, sizeof(int), &m_width[level]);
-			err  = clSetKernelArg(kernels["finalReduc"], 4, sizeof(int), &m_height[level]);
-			err = clEnqueueNDRangeKernel(m_queue, kernels["finalReduc"], 1, NULL, &global_sizes["finalReduc"][0], &local_sizes["finalReduc"][0], 0, NULL, NULL);
-			CHECK_ERROR_OCL(err, "enqueuing finalReduc kernel", return false);
-		}
 
 		//attenuation function of mipmap at level num_mipmaps-1
-		err = clEnqueueNDRangeKernel(m_queue, kernels["coarsest_level_attenfunc"], 1, NULL,
-				&global_sizes["coarsest_level_attenfunc"][0], &local_sizes["coarsest_level_attenfunc"][0], 0, NULL, NULL);
+		err = enqueueKernel("coarsest_level_attenfunc", 1);
 		CHECK_ERROR_OCL(err, "enqueuing coarsest_level_attenfunc kernel", return false);
 
 		for (int level=num_mipmaps-2; level>-1; level--) {
@@ -292,37 +358,72 @@ double GradDom::runCLKernels(bool recomputeMapping) {
 			err  = clSetKernelArg(kernels["atten_func"], 7, sizeof(int), &m_height[level+1]);
 			err  = clSetKernelArg(kernels["atten_func"], 8, sizeof(int), &m_offset[level+1]);
 			err  = clSetKernelArg(kernels["atten_func"], 9, sizeof(int), &level);
-			err = clEnqueueNDRangeKernel(m_queue, kernels["atten_func"], 2, NULL, global_sizes["atten_func"], local_sizes["atten_func"], 0, NULL, NULL);
+			err = enqueueKernel("atten_func", 2);
 			CHECK_ERROR_OCL(err, "enqueuing atten_func kernel", return false);
 		}
 	
-		err = clEnqueueNDRangeKernel(m_queue, kernels["grad_atten"], 2, NULL, global_sizes["grad_atten"], local_sizes["grad_atten"], 0, NULL, NULL);
+		err = enqueueKernel("grad_atten", 2);
 		CHECK_ERROR_OCL(err, "enqueuing grad_atten kernel", return false);
 
-		err = clEnqueueNDRangeKernel(m_queue, kernels["divG"], 2, NULL, global_sizes["divG"], local_sizes["divG"], 0, NULL, NULL);
+		err = enqueueKernel("divG", 2);
 		CHECK_ERROR_OCL(err, "enqueuing divG kernel", return false);
 
+		//the log luminance of the image is used as the initial guess for the poisson solver
+		//unless new_dr still holds the previous frame's solution
+		if (!m_cl_warm) {
+			err = clEnqueueCopyBuffer(m_queue, mems["logLum_Mips"], mems["new_dr"], 0, 0, sizeof(float)*img_size.x*img_size.y, 0, NULL, profileEvent("copy initial guess"));
+			CHECK_ERROR_OCL(err, "copying initial guess of the poisson solver", return false);
+		}
+
+		if (!poissonSolverCL()) return false;
+		m_cl_warm = streaming;
 	}
 
-	err = clFinish(m_queue);
+	err = enqueueKernel("tonemap", 2);
+	CHECK_ERROR_OCL(err, "enqueuing tonemap kernel", return false);
 
-	CHECK_ERROR_OCL(err, "running kernels", return false);
-	return omp_get_wtime() - start;
+	return true;
+}
+
+bool GradDom::poissonSolverCL() {
+	static const cl_uint zero = 0;
+	cl_uint unconverged;
+	cl_int err;
+
+	//same termination criteria as the reference, i.e. stop once 90% of the pixels have converged
+	int iterations = 0;
+	double start = omp_get_wtime();
+	do {
+		const int batch = solverBatch(iterations, start);
+		for (int i = 0; i < batch; i++) {
+			//only the last iteration before a check counts the pixels which haven't converged
+			if (i == batch-1) {
+				err = clEnqueueWriteBuffer(m_queue, mems["unconverged"], CL_FALSE, 0, sizeof(cl_uint), &zero, 0, NULL, profileEvent("reset unconverged"));
+				CHECK_ERROR_OCL(err, "resetting unconverged memory", return false);
+			}
+
+			for (int colour = 0; colour < 2; colour++) {
+				err = clSetKernelArg(kernels["poisson_rb"], 4, sizeof(int), &colour);
+				CHECK_ERROR_OCL(err, "setting poisson_rb arguments", return false);
+
+				err = enqueueKernel("poisson_rb", 2);
+				CHECK_ERROR_OCL(err, "enqueuing poisson_rb kernel", return false);
+			}
+		}
+		iterations += batch;
+
+		err = clEnqueueReadBuffer(m_queue, mems["unconverged"], CL_TRUE, 0, sizeof(cl_uint), &unconverged, 0, NULL, profileEvent("read unconverged"));
+		CHECK_ERROR_OCL(err, "reading unconverged memory", return false);
+	} while (unconverged > 0.1*img_size.x*img_size.y && iterations < max_iterations && !frameBudgetExceeded(iterations, start));
+
+	reportStatus("Poisson solver finished after %d iterations", iterations);
+	return true;
 }
 
 bool GradDom::cleanupOpenCL() {
-	clReleaseMemObject(mem_images[0]);
-	clReleaseMemObject(mem_images[1]);
-	clReleaseMemObject(mems["logLum_Mips"]);
-	clReleaseMemObject(mems["gradient_Mips"]);
-	clReleaseMemObject(mems["attenfunc_Mips"]);
-	clReleaseMemObject(mems["gradient_PartialSum"]);
-	clReleaseMemObject(mems["k_alphas"]);
-	clReleaseMemObject(mems["atten_grad_x"]);
-	clReleaseMemObject(mems["atten_grad_y"]);
-	clReleaseMemObject(mems["div_grad"]);
+	releaseMemory();
 	clReleaseKernel(kernels["computeLogLum"]);
-	clReleaseKernel(kernels["channel_mipmap"]);
+	clReleaseKernel(kernels["mipmap_pyramid"]);
 	clReleaseKernel(kernels["gradient_mag"]);
 	clReleaseKernel(kernels["partialReduc"]);
 	clReleaseKernel(kernels["finalReduc"]);
@@ -330,12 +431,21 @@ bool GradDom::cleanupOpenCL() {
 	clReleaseKernel(kernels["atten_func"]);
 	clReleaseKernel(kernels["grad_atten"]);
 	clReleaseKernel(kernels["divG"]);
+	clReleaseKernel(kernels["poisson_rb"]);
+	clReleaseKernel(kernels["tonemap"]);
 	
 	releaseCL();
 	return true;
 }
 
 
+//gradient magnitude at x using central differences, the neighbours being west and east of it in row and at x in north and south
+static inline float centralGradient(float* row, float* north, float* south, int west, int x, int east, float scale) {
+	float x_grad = (row[west] - row[east])/scale;
+	float y_grad = (south[x] - north[x])/scale;
+	return sqrt(pow(x_grad, 2) + pow(y_grad, 2));
+}
+
 float* GradDom::attenuate_func(float* lum) {
 	int k = 0;
 	int2 k_dim = img_size;	//width and height of the level k in the pyramid
@@ -350,21 +460,30 @@ float* GradDom::attenuate_func(float* lum) {
 	for ( ; k_dim.x >= 32 && k_dim.y >= 32; k_dim.y/=2, k_dim.x/=2, k++) {
 
 		//computing gradient magnitude using central differences at level k
-		k_av_grad = 0.f;
+		//the sums of the rows are reduced in a fixed order so the average doesn't depend on the threads
+		std::vector<double> row_grads(k_dim.y);
 		k_gradient = (float*) calloc(k_dim.x*k_dim.y, sizeof(float));
+		ValueView k_view(k_lum, k_dim);
+		const float scale = pow(2.f, k+1);
+		#pragma omp parallel for schedule(static)
 		for (int y = 0; y < k_dim.y; y++) {
-			for (int x = 0; x < k_dim.x; x++) {
-				int x_west  = clamp(x-1, 0, k_dim.x-1);
-				int x_east  = clamp(x+1, 0, k_dim.x-1);
-				int y_north = clamp(y-1, 0, k_dim.y-1);
-				int y_south = clamp(y+1, 0, k_dim.y-1);
-
-				float x_grad = (k_lum[x_west + y*k_dim.x] - k_lum[x_east + y*k_dim.x])/pow(2.f, k+1);
-				float y_grad = (k_lum[x + y_south*k_dim.x] - k_lum[x + y_north*k_dim.x])/pow(2.f, k+1);
-				k_gradient[x + y*k_dim.x] = sqrt(pow(x_grad, 2) + pow(y_grad, 2));
-				k_av_grad += k_gradient[x + y*k_dim.x];
+			//neighbours past the edges are clamped, the rows once for each row and the columns only for the first and last
+			float* row = k_view.row(y);
+			float* north = k_view.clampedPixel(0, y-1);
+			float* south = k_view.clampedPixel(0, y+1);
+			float* gradient = k_gradient + y*k_dim.x;
+
+			gradient[0] = centralGradient(row, north, south, 0, 0, std::min(1, k_dim.x-1), scale);
+			for (int x = 1; x < k_dim.x-1; x++) {
+				gradient[x] = centralGradient(row, north, south, x-1, x, x+1, scale);
 			}
+			if (k_dim.x > 1) gradient[k_dim.x-1] = centralGradient(row, north, south, k_dim.x-2, k_dim.x-1, k_dim.x-1, scale);
+
+			double row_grad = 0;
+			for (int x = 0; x < k_dim.x; x++) row_grad += gradient[x];
+			row_grads[y] = row_grad;
 		}
+		k_av_grad = pairwiseSum(&row_grads[0], k_dim.y);
 		pyramid.push_back(k_gradient);
 		pyramid_sizes.push_back(std::pair< unsigned int, unsigned int >(k_dim.x, k_dim.y));
 		av_grads.push_back(adjust_alpha*exp(k_av_grad/((float)k_dim.x*k_dim.y)));
@@ -383,6 +502,7 @@ float* GradDom::attenuate_func(float* lum) {
 	
 	//attenuation function for the coarsest level
 	k_atten_func = (float*) calloc(k_dim.x*k_dim.y, sizeof(float));
+	#pragma omp parallel for schedule(static)
 	for (int y = 0; y < k_dim.y; y++) {
 		for (int x = 0; x < k_dim.x; x++) {
 			k_atten_func[x + y*k_dim.x] = (k_alpha/k_gradient[x + y*k_dim.x])*pow(k_gradient[x + y*k_dim.x]/k_alpha, beta);
@@ -403,14 +523,15 @@ float* GradDom::attenuate_func(float* lum) {
 		k_dim.x = pyramid_sizes.back().first;
 		k_dim.y = pyramid_sizes.back().second;
 		float k_alpha = av_grads.back();
-		float k_xy_scale_factor;
-		float k_xy_atten_func;
 		k--;
 
 		//attenuation function for this level
 		k_atten_func = (float*) calloc(k_dim.x*k_dim.y, sizeof(float));
+		#pragma omp parallel for schedule(static)
 		for (int y = 0; y < k_dim.y; y++) {
 			for (int x = 0; x < k_dim.x; x++) {
+				float k_xy_scale_factor;
+				float k_xy_atten_func = 0.f;
 
 				if (k_gradient[x + y*k_dim.x] != 0) {
 
@@ -449,57 +570,407 @@ float* GradDom::attenuate_func(float* lum) {
 }
 
 
-float* GradDom::poissonSolver(float* lum, float* div_grad, float convergenceCriteria) {
+//red-black Gauss-Seidel iterations, in the same order and with the same termination criteria as poissonSolverCL
+//so the reference verifies the OpenCL implementation: the pixels which haven't converged are counted in the last
+//iteration of every solverBatch, and the solver stops once 90% of them have converged
+float* GradDom::poissonSolver(float* lum, float* div_grad, float convergenceCriteria, float* initial_guess) {
+	float* dr = (float*) calloc(img_size.y*img_size.x, sizeof(float));
+	memcpy(dr, initial_guess ? initial_guess : lum, sizeof(float)*img_size.x*img_size.y);
 
-	float* prev_dr = (float*) calloc(img_size.y*img_size.x, sizeof(float));
-	int* converged = (int*) calloc(img_size.y*img_size.x, sizeof(int));
-	for (int y = 0; y < img_size.y; y++) {
-		for (int x = 0; x < img_size.x; x++) {
-			prev_dr[x + y*img_size.x] = lum[x+y*img_size.x];
-			converged[x + y*img_size.x] = 0;
+	int unconverged;
+	int iterations = 0;
+	double start = omp_get_wtime();
+	do {
+		unconverged = 0;
+		const int batch = solverBatch(iterations, start);
+		for (int i = 0; i < batch; i++) {
+			const bool count = (i == batch-1);
+			for (int colour = 0; colour < 2; colour++) {
+				//the pixels of one colour only depend on those of the other, so the count is exact
+				#pragma omp parallel for schedule(static) reduction(+:unconverged)
+				for (int y = 0; y < img_size.y; y++) {
+					for (int x = (y + colour) & 1; x < img_size.x; x += 2) {
+						float prev  = ((x-1 >= 0)           ? dr[x-1 +   y*img_size.x] : 0)
+									+ ((x+1 < img_size.x)   ? dr[x+1 +   y*img_size.x] : 0)
+									+ ((y-1 >= 0)           ? dr[x + (y-1)*img_size.x] : 0)
+									+ ((y+1 < img_size.y)   ? dr[x + (y+1)*img_size.x] : 0);
+
+						float new_dr = 0.25f*(prev - div_grad[x + y*img_size.x]);
+						float diff = new_dr - dr[x + y*img_size.x];
+						diff = (diff >= 0) ? diff : -diff;
+						dr[x + y*img_size.x] = new_dr;
+
+						if (count && diff >= convergenceCriteria) unconverged++;
+					}
+				}
+			}
 		}
+		iterations += batch;
+	} while (unconverged > 0.1*img_size.x*img_size.y && iterations < max_iterations && !frameBudgetExceeded(iterations, start));
+
+	return dr;
+}
+
+
+float* GradDom::solvePoisson(float* lum, float* div_grad) {
+	float* new_dr;
+	switch (poisson_solver) {
+		case POISSON_MULTIGRID:
+			new_dr = multigridSolver(lum, div_grad, 0.0001, 20, m_prev_dr);
+			break;
+		case POISSON_DCT:	//direct solver, so has no use for an initial guess
+			new_dr = dctSolver(lum, div_grad);
+			break;
+		default:
+			new_dr = poissonSolver(lum, div_grad, convergence, m_prev_dr);
 	}
 
-	float* new_dr = (float*) calloc(img_size.y*img_size.x, sizeof(float));
+	//keep the solution as the initial guess for the next frame
+	if (streaming) {
+		if (!m_prev_dr) m_prev_dr = (float*) calloc(img_size.x*img_size.y, sizeof(float));
+		memcpy(m_prev_dr, new_dr, sizeof(float)*img_size.x*img_size.y);
+	}
+	return new_dr;
+}
 
-	float diff;
-	int converged_pixels = 0;
-	while (converged_pixels < 0.9*img_size.x*img_size.y) {
-		diff = 0;
-		for (int y = 0; y < img_size.y; y++) {
-			for (int x = 0; x < img_size.x; x++) {
 
-				if (converged[x + y*img_size.x] != 1) {
-					float prev  = ((x-1 >=        0) ? prev_dr[x-1 +   y*img_size.x] : 0)
-								+ ((x+1 <=  img_size.x-1) ? prev_dr[x+1 +   y*img_size.x] : 0)
-								+ ((y-1 >=        0) ? prev_dr[x + (y-1)*img_size.x] : 0)
-								+ ((y+1 <= img_size.y-1) ? prev_dr[x + (y+1)*img_size.x] : 0);
+void GradDom::setPoissonSolver(int solver) {
+	poisson_solver = solver;
+	clearReferenceCache();
+}
 
-					new_dr[x + y*img_size.x] = 0.25f*(prev - div_grad[x + y*img_size.x]);
-					diff = new_dr[x + y*img_size.x] - prev_dr[x + y*img_size.x];
-					diff = (diff >= 0) ? diff : -diff;
+void GradDom::setStreaming(bool enable, int iterations_per_frame, double time_per_frame) {
+	streaming = enable;
+	frame_iterations = iterations_per_frame;
+	frame_time = time_per_frame;
+	resetStream();
+	clearReferenceCache();
+}
 
-					if (diff < convergenceCriteria) {
-						converged_pixels++;
-						converged[x + y*img_size.x] = 1;
-					}
+void GradDom::resetStream() {
+	if (m_prev_dr) free(m_prev_dr);
+	m_prev_dr = NULL;
+	m_cl_warm = false;
+}
+
+bool GradDom::setImageSize(int width, int height) {
+	//the previous solution is still a good initial guess for a frame of the same size
+	if (width != img_size.x || height != img_size.y) resetStream();
+	return Filter::setImageSize(width, height);
+}
+
+bool GradDom::setParameter(const char* name, float value) {
+	if (!strcmp(name, "adjust_alpha")) adjust_alpha = value;
+	else if (!strcmp(name, "beta")) beta = value;
+	else if (!strcmp(name, "sat")) sat = value;
+	else return false;
+
+	clearReferenceCache();
+	if (m_program) return setupKernelArgs();
+	return true;
+}
+
+int GradDom::solverBatch(int iterations, double start) const {
+	int batch = check_interval;
+	if (!streaming) return batch;
+	if (frame_iterations > 0) batch = std::min(batch, frame_iterations - iterations);
+	//the time left is estimated from the iterations done so far, which take about the same time each,
+	//so a single iteration is timed first
+	if (frame_time > 0) {
+		double elapsed = omp_get_wtime() - start;
+		if (iterations == 0) batch = 1;
+		else if (elapsed > 0) batch = std::min((double) batch, (frame_time - elapsed)*iterations/elapsed);
+	}
+	return std::max(batch, 1);
+}
+
+bool GradDom::frameBudgetExceeded(int iterations, double start) {
+	if (!streaming) return false;
+	if (frame_iterations > 0 && iterations >= frame_iterations) return true;
+	if (frame_time > 0 && omp_get_wtime() - start >= frame_time) return true;
+	return false;
+}
+
+
+//a level of the multigrid hierarchy, each cell covering h*h pixels of the image
+//except for the last column and row, which also cover whatever is left over when halving odd sizes
+typedef struct {
+	int2 size;
+	float h;
+	float last_w;	//width of the last column
+	float last_h;	//height of the last row
+} mg_grid;
+
+static inline float mg_width(const mg_grid& g, int x)  { return (x == g.size.x-1) ? g.last_w : g.h; }
+static inline float mg_height(const mg_grid& g, int y) { return (y == g.size.y-1) ? g.last_h : g.h; }
+
+//finite volume discretisation of the neumann boundary laplacian around cell (x,y)
+//sum is the weighted sum of the neighbours, diag the sum of the weights and area the size of the cell
+static inline void mg_stencil(float* u, const mg_grid& g, int x, int y, float& sum, float& diag, float& area) {
+	float w = mg_width(g, x);
+	float h = mg_height(g, y);
+	float c;
+	sum = 0;
+	diag = 0;
+	if (x > 0)          { c = h/(0.5f*(w + mg_width(g, x-1)));  sum += c*u[x-1 +     y*g.size.x]; diag += c; }
+	if (x < g.size.x-1) { c = h/(0.5f*(w + mg_width(g, x+1)));  sum += c*u[x+1 +     y*g.size.x]; diag += c; }
+	if (y > 0)          { c = w/(0.5f*(h + mg_height(g, y-1))); sum += c*u[x   + (y-1)*g.size.x]; diag += c; }
+	if (y < g.size.y-1) { c = w/(0.5f*(h + mg_height(g, y+1))); sum += c*u[x   + (y+1)*g.size.x]; diag += c; }
+	area = w*h;
+}
+
+//residual r = f - A*u of the poisson equation, A being the neumann boundary laplacian
+//returns the sum of squares of the residual
+static double mg_residual(float* u, float* f, float* r, const mg_grid& g) {
+	//the sums of the rows are reduced in a fixed order so the result doesn't depend on the threads
+	std::vector<double> row_norms(g.size.y);
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < g.size.y; y++) {
+		double norm = 0;
+		for (int x = 0; x < g.size.x; x++) {
+			float sum, diag, area;
+			mg_stencil(u, g, x, y, sum, diag, area);
+
+			float res = f[x + y*g.size.x] - (sum - diag*u[x + y*g.size.x])/area;
+			if (r) r[x + y*g.size.x] = res;
+			norm += res*res;
+		}
+		row_norms[y] = norm;
+	}
+	return pairwiseSum(&row_norms[0], g.size.y);
+}
+
+//red-black Gauss-Seidel sweeps of the poisson equation
+static void mg_smooth(float* u, float* f, const mg_grid& g, int sweeps) {
+	for (int i = 0; i < sweeps; i++) {
+		for (int colour = 0; colour < 2; colour++) {
+			//the cells of a colour only depend on those of the other, so the rows can be updated in parallel
+			#pragma omp parallel for schedule(static)
+			for (int y = 0; y < g.size.y; y++) {
+				for (int x = (y + colour) & 1; x < g.size.x; x += 2) {
+					float sum, diag, area;
+					mg_stencil(u, g, x, y, sum, diag, area);
+					if (diag > 0) u[x + y*g.size.x] = (sum - area*f[x + y*g.size.x])/diag;
+				}
+			}
+		}
+	}
+}
+
+//removes the area weighted mean of the given grid, making the right hand side compatible with the neumann boundaries
+static void mg_remove_mean(float* f, const mg_grid& g) {
+	std::vector<double> row_sums(g.size.y);
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < g.size.y; y++) {
+		double sum = 0;
+		for (int x = 0; x < g.size.x; x++) sum += f[x + y*g.size.x]*mg_width(g, x)*mg_height(g, y);
+		row_sums[y] = sum;
+	}
+	double mean = pairwiseSum(&row_sums[0], g.size.y);
+	mean /= ((g.size.x-1)*g.h + g.last_w)*((g.size.y-1)*g.h + g.last_h);
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < g.size.x*g.size.y; i++) f[i] -= mean;
+}
+
+//restricts the fine grid to the coarser one using the same 2x2 averaging as the mipmaps
+//the last coarse row and column also take in the leftover of odd sized grids, and their children differ in size,
+//so these are recomputed as area weighted averages
+static float* mg_restrict(float* fine, const mg_grid& f_g, const mg_grid& c_g) {
+	float* coarse = mipmap(fine, f_g.size);
+
+	for (int y = 0; y < c_g.size.y; y++) {
+		for (int x = 0; x < c_g.size.x; x++) {
+			if (x < c_g.size.x-1 && y < c_g.size.y-1) continue;
+			int x_end = (x == c_g.size.x-1) ? f_g.size.x : 2*x+2;
+			int y_end = (y == c_g.size.y-1) ? f_g.size.y : 2*y+2;
+
+			float sum = 0, area = 0;
+			for (int _y = 2*y; _y < y_end; _y++) {
+				for (int _x = 2*x; _x < x_end; _x++) {
+					float a = mg_width(f_g, _x)*mg_height(f_g, _y);
+					sum += a*fine[_x + _y*f_g.size.x];
+					area += a;
 				}
 			}
+			coarse[x + y*c_g.size.x] = sum/area;
+		}
+	}
+	return coarse;
+}
+
+//bilinearly interpolates the coarse grid and adds it to the fine grid
+//uses the same 9-3-3-1 weights as the interpolation of the attenuation function
+static void mg_prolong_add(float* coarse, int2 c_size, float* fine, int2 f_size) {
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < f_size.y; y++) {
+		for (int x = 0; x < f_size.x; x++) {
+			int c_x = std::min(x/2, c_size.x-1);
+			int c_y = std::min(y/2, c_size.y-1);
+
+			//neighbours need to be left or right dependent on where we are
+			int n_x = (x & 1) ? 1 : -1;
+			int n_y = (y & 1) ? 1 : -1;
+			if (c_x + n_x < 0 || c_x + n_x >= c_size.x) n_x = 0;
+			if (c_y + n_y < 0 || c_y + n_y >= c_size.y) n_y = 0;
+
+			fine[x + y*f_size.x] += (1.f/16.f)*(9.f*coarse[c_x       +  c_y       *c_size.x]
+											  + 3.f*coarse[c_x + n_x +  c_y       *c_size.x]
+											  + 3.f*coarse[c_x       + (c_y + n_y)*c_size.x]
+											  + 1.f*coarse[c_x + n_x + (c_y + n_y)*c_size.x]);
 		}
-		//printf("%d, %d\n", converged_pixels, img_size.x*img_size.y);
-		float* swap = prev_dr;
-		prev_dr = new_dr;
-		new_dr = swap;
+	}
+}
+
+//a single V-cycle improving u, the solution at the given level of the grid hierarchy
+static void mg_vcycle(std::vector<float*>& u, std::vector<float*>& f, std::vector<mg_grid>& grids, int level) {
+	const mg_grid& g = grids[level];
+
+	if (level == (int) grids.size()-1) {	//coarsest level is small enough to be solved by relaxation alone
+		mg_smooth(u[level], f[level], g, 2*(g.size.x + g.size.y));
+		return;
+	}
+
+	mg_smooth(u[level], f[level], g, 2);
+
+	//restrict the residual to the coarser grid
+	const mg_grid& c_g = grids[level+1];
+	float* r = (float*) calloc(g.size.x*g.size.y, sizeof(float));
+	mg_residual(u[level], f[level], r, g);
+	float* r_coarse = mg_restrict(r, g, c_g);
+	free(r);
+
+	mg_remove_mean(r_coarse, c_g);
+	memcpy(f[level+1], r_coarse, sizeof(float)*c_g.size.x*c_g.size.y);
+	free(r_coarse);
+
+	//coarse grid correction
+	memset(u[level+1], 0, sizeof(float)*c_g.size.x*c_g.size.y);
+	mg_vcycle(u, f, grids, level+1);
+	mg_prolong_add(u[level+1], c_g.size, u[level], g.size);
+
+	mg_smooth(u[level], f[level], g, 2);
+}
+
+float* GradDom::multigridSolver(float* lum, float* div_grad, float tolerance, int max_cycles, float* initial_guess) {
+
+	//grid hierarchy, each level being a mipmap of the previous one down to at least 4x4 cells
+	//images smaller than that are solved on the finest grid alone
+	std::vector<mg_grid> grids;
+	mg_grid grid = {img_size, 1.f, 1.f, 1.f};
+	grids.push_back(grid);
+	while (grid.size.x >= 8 && grid.size.y >= 8) {
+		//the last coarse cell takes in the last fine cell, plus one more if the size is odd
+		grid.last_w += (grid.size.x & 1) ? 2*grid.h : grid.h;
+		grid.last_h += (grid.size.y & 1) ? 2*grid.h : grid.h;
+		grid.size.x /= 2;
+		grid.size.y /= 2;
+		grid.h *= 2;
+		grids.push_back(grid);
+	}
+	const int num_levels = grids.size();
+
+	std::vector<float*> u(num_levels);	//solution at each level
+	std::vector<float*> f(num_levels);	//right hand side at each level
+	f[0] = (float*) calloc(img_size.x*img_size.y, sizeof(float));
+	memcpy(f[0], div_grad, sizeof(float)*img_size.x*img_size.y);
+	mg_remove_mean(f[0], grids[0]);
+	for (int level = 0; level < num_levels; level++) {
+		u[level] = (float*) calloc(grids[level].size.x*grids[level].size.y, sizeof(float));
+		if (level > 0) {
+			f[level] = mg_restrict(f[level-1], grids[level-1], grids[level]);
+			mg_remove_mean(f[level], grids[level]);
+		}
+	}
+
+	double start = omp_get_wtime();
+	if (initial_guess) {
+		memcpy(u[0], initial_guess, sizeof(float)*img_size.x*img_size.y);
+	}
+	else {
+		//full multigrid: the solution of each level is the initial guess of the next finer one
+		//a V-cycle overwrites the right hand side of the coarser levels, which have already been solved by then
+		for (int level = num_levels-1; level >= 0; level--) {
+			if (level < num_levels-1) mg_prolong_add(u[level+1], grids[level+1].size, u[level], grids[level].size);
+			mg_vcycle(u, f, grids, level);
+		}
+	}
+
+	//V-cycles on the finest level until the residual is small enough
+	double f_norm = 0;
+	for (int i = 0; i < img_size.x*img_size.y; i++) f_norm += f[0][i]*f[0][i];
+
+	int cycles = 0;
+	double r_norm = mg_residual(u[0], f[0], NULL, grids[0]);
+	while (r_norm > tolerance*tolerance*f_norm && cycles < max_cycles && !frameBudgetExceeded(cycles, start)) {
+		mg_vcycle(u, f, grids, 0);
+		r_norm = mg_residual(u[0], f[0], NULL, grids[0]);
+		cycles++;
+	}
+	reportStatus("Multigrid solver finished after %d V-cycles (relative residual %g)", cycles, sqrt(r_norm/f_norm));
+
+	//the solution is only defined up to a constant, so keep the average log luminance of the image
+	double mean_lum = 0, mean_dr = 0;
+	for (int i = 0; i < img_size.x*img_size.y; i++) {
+		mean_lum += lum[i];
+		mean_dr += u[0][i];
+	}
+	float shift = (mean_lum - mean_dr)/(img_size.x*img_size.y);
+
+	float* new_dr = u[0];
+	for (int i = 0; i < img_size.x*img_size.y; i++) new_dr[i] += shift;
+
+	for (int level = 0; level < num_levels; level++) {
+		if (level > 0) free(u[level]);
+		free(f[level]);
 	}
 
 	return new_dr;
 }
 
 
-bool GradDom::runReference(uchar* input, uchar* output) {
+float* GradDom::dctSolver(float* lum, float* div_grad) {
+	const int num_pixels = img_size.x*img_size.y;
+
+	double* coeffs = (double*) calloc(num_pixels, sizeof(double));
+	double mean_lum = 0;
+	for (int i = 0; i < num_pixels; i++) {
+		coeffs[i] = div_grad[i];
+		mean_lum += lum[i];
+	}
+	mean_lum /= num_pixels;
 
-	// Check for cached result
-	if (m_reference.data) {
+	dct2D(coeffs, img_size.x, img_size.y, false);
+
+	//eigenvalues of the laplacian are the sum of those of the second differences along x and y
+	std::vector<double> eigen_x(img_size.x), eigen_y(img_size.y);
+	for (int x = 0; x < img_size.x; x++) eigen_x[x] = 2*cos(M_PI*x/img_size.x) - 2;
+	for (int y = 0; y < img_size.y; y++) eigen_y[y] = 2*cos(M_PI*y/img_size.y) - 2;
+
+	#pragma omp parallel for
+	for (int y = 0; y < img_size.y; y++) {
+		for (int x = 0; x < img_size.x; x++) {
+			coeffs[x + y*img_size.x] /= eigen_x[x] + eigen_y[y];
+		}
+	}
+	//the solution is only defined up to a constant, so keep the average log luminance of the image
+	coeffs[0] = mean_lum*num_pixels;
+
+	dct2D(coeffs, img_size.x, img_size.y, true);
+
+	float* new_dr = (float*) calloc(num_pixels, sizeof(float));
+	for (int i = 0; i < num_pixels; i++) new_dr[i] = coeffs[i];
+	free(coeffs);
+
+	reportStatus("DCT solver finished");
+	return new_dr;
+}
+
+
+template <typename T>
+bool GradDom::reference(T* input, uchar* output) {
+
+	// Check for cached result, frames of a stream are never the same
+	if (m_reference.data && !streaming) {
 		memcpy(output, m_reference.data, img_size.x*img_size.y*NUM_CHANNELS);
 		reportStatus("Finished reference (cached)");
 		return true;
@@ -509,10 +980,14 @@ bool GradDom::runReference(uchar* input, uchar* output) {
 
 	//computing logarithmic luminace of the image
 	float* lum = (float*) calloc(img_size.x * img_size.y, sizeof(float));	//logarithm luminance
-	int2 pos;
-	for (pos.y = 0; pos.y < img_size.y; pos.y++) {
-		for (pos.x = 0; pos.x < img_size.x; pos.x++) {
-			lum[pos.x + pos.y*img_size.x] = log(getPixelLuminance(input, img_size, pos) + 0.000001);
+	ImageView<T, NUM_CHANNELS> in_image(input, img_size);
+	PixelView out_image(output, img_size);
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		T* in = in_image.row(y);
+		float* lum_row = lum + y*img_size.x;
+		for (int x = 0; x < img_size.x; x++) {
+			lum_row[x] = log(getLuminance(in + x*NUM_CHANNELS) + 0.000001);
 		}
 	}
 
@@ -522,6 +997,7 @@ bool GradDom::runReference(uchar* input, uchar* output) {
 	//luminance gradient in forward direction for x and y
 	float* grad_x = (float*) calloc(img_size.x * img_size.y, sizeof(float));	//H(x,y)
 	float* grad_y = (float*) calloc(img_size.x * img_size.y, sizeof(float));	//H(x,y)
+	#pragma omp parallel for schedule(static)
 	for (int y = 0; y < img_size.y; y++) {
 		for (int x = 0; x < img_size.x; x++) {
 			grad_x[x + y*img_size.x] = (x < img_size.x-1) ? (lum[x+1 +     y*img_size.x] - lum[x + y*img_size.x]) : 0;
@@ -533,6 +1009,7 @@ bool GradDom::runReference(uchar* input, uchar* output) {
 	//attenuated gradient achieved by using the previously computed attenuation function
 	float* att_grad_x = (float*) calloc(img_size.y * img_size.x, sizeof(float));	//G(x,y)
 	float* att_grad_y = (float*) calloc(img_size.y * img_size.x, sizeof(float));	//G(x,y)
+	#pragma omp parallel for schedule(static)
 	for (int y = 0; y < img_size.y; y++) {
 		for (int x = 0; x < img_size.x; x++) {
 			att_grad_x[x + y*img_size.x] = grad_x[x + y*img_size.x] * att_func[x + y*img_size.x];
@@ -540,38 +1017,38 @@ bool GradDom::runReference(uchar* input, uchar* output) {
 		}
 	}
 
-	//divG(x,y)
+	//divG(x,y), the gradients outside the image are taken to be zero which makes it consistent with neumann boundaries
 	float* div_grad = (float*) calloc(img_size.y * img_size.x, sizeof(float));
-	div_grad[0] = 0;
-	for (int x = 1; x < img_size.x; x++) {
-		div_grad[x] = att_grad_x[x] - att_grad_x[x-1];
-	}
-	for (int y = 1; y < img_size.y; y++) {
-		div_grad[y*img_size.x] = att_grad_y[y*img_size.x] - att_grad_y[(y-1)*img_size.x];
-		for (int x = 1; x < img_size.x; x++) {
-			div_grad[x + y*img_size.x] = (att_grad_x[x + y*img_size.x] - att_grad_x[(x-1) + y*img_size.x])
-										+ (att_grad_y[x + y*img_size.x] - att_grad_y[x + (y-1)*img_size.x]);
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		for (int x = 0; x < img_size.x; x++) {
+			div_grad[x + y*img_size.x] = (att_grad_x[x + y*img_size.x] - ((x > 0) ? att_grad_x[(x-1) + y*img_size.x] : 0))
+										+ (att_grad_y[x + y*img_size.x] - ((y > 0) ? att_grad_y[x + (y-1)*img_size.x] : 0));
 		}
 	}
 
-	float* new_dr = poissonSolver(lum, div_grad);
+	float* new_dr = solvePoisson(lum, div_grad);
 
-	float3 rgb;
-	for (pos.y = 0; pos.y < img_size.y; pos.y++) {
-		for (pos.x = 0; pos.x < img_size.x; pos.x++) {
-			//printf("%f, %f\n", lum[x + y*img_size.x], new_dr[x+y*img_size.x]);
-			rgb.x = pow(getPixel(input, img_size, pos, 0)/exp(lum[pos.x + pos.y*img_size.x]), sat)*exp(new_dr[pos.x + pos.y*img_size.x]);
-			rgb.y = pow(getPixel(input, img_size, pos, 1)/exp(lum[pos.x + pos.y*img_size.x]), sat)*exp(new_dr[pos.x + pos.y*img_size.x]);
-			rgb.z = pow(getPixel(input, img_size, pos, 2)/exp(lum[pos.x + pos.y*img_size.x]), sat)*exp(new_dr[pos.x + pos.y*img_size.x]);
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		T* in = in_image.row(y);
+		uchar* out = out_image.row(y);
+		float* lum_row = lum + y*img_size.x;
+		float* dr_row = new_dr + y*img_size.x;
+		for (int x = 0; x < img_size.x; x++) {
+			float3 rgb = getColour(in + x*NUM_CHANNELS);
+			rgb.x = pow(rgb.x/exp(lum_row[x]), sat)*exp(dr_row[x]);
+			rgb.y = pow(rgb.y/exp(lum_row[x]), sat)*exp(dr_row[x]);
+			rgb.z = pow(rgb.z/exp(lum_row[x]), sat)*exp(dr_row[x]);
 
-			setPixel(output, img_size, pos, 0, rgb.x);
-			setPixel(output, img_size, pos, 1, rgb.y);
-			setPixel(output, img_size, pos, 2, rgb.z);
+			setColour(out + x*NUM_CHANNELS, rgb);
 		}
 	}
 
 	reportStatus("Finished reference");
 
+	if (streaming) return true;
+
 	// Cache result
 	m_reference.width = img_size.x;
 	m_reference.height = img_size.y;
@@ -580,3 +1057,101 @@ bool GradDom::runReference(uchar* input, uchar* output) {
 
 	return true;
 }
+
+
+//divergence of the attenuated forward gradients at (x, y), those outside the image being zero
+static inline float divergence(float* lum, float* att_func, int2 size, int x, int y) {
+	int i = x + y*size.x;
+	float div = 0.f;
+	if (x < size.x-1) div += (lum[i+1] - lum[i])*att_func[i];
+	if (x > 0) div -= (lum[i] - lum[i-1])*att_func[i-1];
+	if (y < size.y-1) div += (lum[i+size.x] - lum[i])*att_func[i];
+	if (y > 0) div -= (lum[i] - lum[i-size.x])*att_func[i-size.x];
+	return div;
+}
+
+template <typename T>
+bool GradDom::native(T* input, uchar* output) {
+	reportStatus("Running native");
+
+	//computing logarithmic luminace of the image
+	float* lum = (float*) calloc(img_size.x * img_size.y, sizeof(float));	//logarithm luminance
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		T* in = input + y*img_size.x*NUM_CHANNELS;
+		for (int x = 0; x < img_size.x; x += NATIVE_WIDTH) {
+			int n = std::min(NATIVE_WIDTH, img_size.x-x);
+			floatv r, g, b;
+			load_pixels(in + x*NUM_CHANNELS, n, &r, &g, &b);
+			store_values(lum + x + y*img_size.x, n, vlog(luminance(r, g, b) + 0.000001f));
+		}
+	}
+
+	float* att_func = attenuate_func(lum);	//o(x,y)
+
+	//divG(x,y) of the attenuated gradients G(x,y), computed directly from the luminance and the attenuation function
+	float* div_grad = (float*) calloc(img_size.y * img_size.x, sizeof(float));
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		float* l = lum + y*img_size.x;
+		float* a = att_func + y*img_size.x;
+		float* div = div_grad + y*img_size.x;
+
+		//the first and last columns are left to the scalar code
+		div[0] = divergence(lum, att_func, img_size, 0, y);
+		int x = 1;
+		for ( ; x + NATIVE_WIDTH < img_size.x; x += NATIVE_WIDTH) {
+			floatv centre = vload(l + x);
+			floatv d = (vload(l + x+1) - centre)*vload(a + x) - (centre - vload(l + x-1))*vload(a + x-1);
+			if (y < img_size.y-1) d = d + (vload(l + x+img_size.x) - centre)*vload(a + x);
+			if (y > 0) d = d - (centre - vload(l + x-img_size.x))*vload(a + x-img_size.x);
+			vstore(div + x, d);
+		}
+		for ( ; x < img_size.x; x++) div[x] = divergence(lum, att_func, img_size, x, y);
+	}
+
+	float* new_dr = solvePoisson(lum, div_grad);
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		T* in = input + y*img_size.x*NUM_CHANNELS;
+		uchar* out = output + y*img_size.x*NUM_CHANNELS;
+		for (int x = 0; x < img_size.x; x += NATIVE_WIDTH) {
+			int n = std::min(NATIVE_WIDTH, img_size.x-x);
+			floatv r, g, b;
+			load_pixels(in + x*NUM_CHANNELS, n, &r, &g, &b);
+			floatv L = vexp(load_values(lum + x + y*img_size.x, n));
+			floatv Ld = vexp(load_values(new_dr + x + y*img_size.x, n));
+
+			store_pixels(out + x*NUM_CHANNELS, n,
+				clamp_colour(vpow(r/L, sat)*Ld),
+				clamp_colour(vpow(g/L, sat)*Ld),
+				clamp_colour(vpow(b/L, sat)*Ld));
+		}
+	}
+
+	free(lum);
+	free(att_func);
+	free(div_grad);
+	free(new_dr);
+
+	reportStatus("Finished native");
+
+	return true;
+}
+
+bool GradDom::runReference(uchar* input, uchar* output) {
+	return reference(input, output);
+}
+
+bool GradDom::runReference(float* input, uchar* output) {
+	return reference(input, output);
+}
+
+bool GradDom::runNative(uchar* input, uchar* output) {
+	return native(input, output);
+}
+
+bool GradDom::runNative(float* input, uchar* output) {
+	return native(input, output);
+}
@@ -8,33 +8,88 @@
 
 #include "Filter.h"
 
+//poisson solvers used by the serial implementation
+#define POISSON_JACOBI     (1<<1)	//iterative solver, red-black Gauss-Seidel like the OpenCL implementation
+#define POISSON_MULTIGRID  (1<<2)
+#define POISSON_DCT        (1<<3)
+
 namespace hdr
 {
 class GradDom : public Filter {
 public:
 	GradDom(float _adjust_alpha=0.1f, float _beta=0.85f, float _sat=0.5f);
+	virtual ~GradDom();
 
 	virtual bool setupOpenCL(cl_context_properties context_prop[], const Params& params);
-	virtual double runCLKernels(bool recomputeMapping);
+	virtual bool enqueueCLKernels(bool recomputeMapping);
 	virtual bool cleanupOpenCL();
 	virtual bool runReference(uchar* input, uchar* output);
+	virtual bool runReference(float* input, uchar* output);
+	virtual bool runNative(uchar* input, uchar* output);
+	virtual bool runNative(float* input, uchar* output);
 
 	//computes the attenuation function for the gradients
 	float* attenuate_func(float* lum);
 	//solves the poisson equation to derive a new compressed dynamic range
-	float* poissonSolver(float* lum, float* div_grad, float terminationCriterea=0.0005);
+	//the log luminance is used as the initial guess unless one is given
+	float* poissonSolver(float* lum, float* div_grad, float terminationCriterea=0.0005, float* initial_guess=NULL);
+	//solves the same poisson equation with neumann boundaries using full multigrid followed by V-cycles
+	//full multigrid is skipped when given an initial guess
+	float* multigridSolver(float* lum, float* div_grad, float tolerance=0.0001, int max_cycles=20, float* initial_guess=NULL);
+	//solves the same poisson equation directly, the neumann boundary laplacian being diagonal in the cosine basis
+	float* dctSolver(float* lum, float* div_grad);
+	//solves the poisson equation with the solver selected for the reference and native implementations
+	float* solvePoisson(float* lum, float* div_grad);
+	//enqueues the red-black iterations of the OpenCL poisson solver until it converges
+	bool poissonSolverCL();
+
+	//selects the poisson solver used by the serial implementation
+	void setPoissonSolver(int solver);
+
+	//streaming mode for successive frames of a video, the poisson solver starts from the previous frame's solution
+	//and is limited to the given number of iterations (V-cycles for multigrid) and seconds per frame, 0 meaning no limit
+	void setStreaming(bool enable, int iterations_per_frame=64, double time_per_frame=0);
+	//forgets the previous frame's solution, e.g. on a scene cut
+	void resetStream();
+
+	virtual bool setImageSize(int width, int height);
+	virtual bool setParameter(const char* name, float value);
 
 protected:
+	virtual bool setupMemory();
+	virtual void releaseMemory();
+	virtual bool setupKernelArgs();
+	//runReference and runNative for 8-bit and radiance input
+	template <typename T> bool reference(T* input, uchar* output);
+	template <typename T> bool native(T* input, uchar* output);
+
 	float adjust_alpha;	//to adjust the gradients at each mipmap level. gradients smaller than alpha are slightly magnified
 	float beta;	//used to attenuate larger gradients
 	float sat;	//increase this for more colourful pictures
+	int poisson_solver;	//poisson solver used by the serial implementation
+
+	//OpenCL poisson solver
+	float convergence;		//a pixel has converged once a red-black iteration changes it by less than this
+	int max_iterations;		//upper bound on the number of red-black iterations
+	int check_interval;		//number of red-black iterations between each convergence check
+
+	//streaming mode
+	bool streaming;			//successive calls are frames of a video
+	int frame_iterations;	//upper bound on the poisson solver iterations per frame
+	double frame_time;		//upper bound on the time in seconds spent by the poisson solver per frame
+	float* m_prev_dr;		//previous frame's solution of the reference
+	bool m_cl_warm;			//new_dr holds the previous frame's solution
+
+	//whether the poisson solver started at the given time has used up its budget for this frame
+	bool frameBudgetExceeded(int iterations, double start);
+	//iterations of the poisson solvers until the next convergence check, fewer than check_interval at the end of a frame's budget
+	int solverBatch(int iterations, double start) const;
 
 	//information regarding all mipmap levels
 	int num_mipmaps;
 	int* m_width;		//at index i this contains the width of the mipmap at index i
 	int* m_height;		//at index i this contains the height of the mipmap at index i
 	int* m_offset;		//at index i this contains the start point to store the mipmap at level i
-	float* m_divider;		//at index i this contains the value the pixels of gradient magnitude are going to be divided by	
 
 };
 }
\ No newline at end of file
@@ -12,6 +12,8 @@
 #include <omp.h>
 
 #include "HistEq.h"
+#include "Native.h"
+#include "opencl/scan.h"
 #include "opencl/histEq.h"
 
 using namespace hdr;
@@ -24,27 +26,21 @@ bool HistEq::setupOpenCL(cl_context_properties context_prop[], const Params& par
 	char flags[1024];
 	int hist_size = PIXEL_RANGE+1;
 
-	sprintf(flags, "-cl-fast-relaxed-math -D PIXEL_RANGE=%d -D HIST_SIZE=%d -D NUM_CHANNELS=%d -D WIDTH=%d -D HEIGHT=%d -D BUGGY_CL_GL=%d",
-			PIXEL_RANGE, hist_size, NUM_CHANNELS, img_size.x, img_size.y, BUGGY_CL_GL);
+	sprintf(flags, "-cl-fast-relaxed-math -D PIXEL_RANGE=%d -D HIST_SIZE=%d -D HIST_REPLICAS=%d -D NUM_CHANNELS=%d -D BUGGY_CL_GL=%d",
+			PIXEL_RANGE, hist_size, HIST_REPLICAS, NUM_CHANNELS, BUGGY_CL_GL);
 
-	if (!initCL(context_prop, params, histEq_kernel, flags)) return false;
+	std::string source = std::string(scan_kernel) + histEq_kernel;
+	if (!initCL(context_prop, params, source.c_str(), flags)) return false;
 
 
 	/////////////////////////////////////////////////////////////////kernels
 	cl_int err;
 
-	kernels["transfer_data"] = clCreateKernel(m_program, "transfer_data", &err);
-	CHECK_ERROR_OCL(err, "creating transfer_data kernel", return false);
-
 	//compute partial histogram
 	kernels["partial_hist"] = clCreateKernel(m_program, "partial_hist", &err);
 	CHECK_ERROR_OCL(err, "creating partial_hist kernel", return false);
 
-	//merge partial histograms
-	kernels["merge_hist"] = clCreateKernel(m_program, "merge_hist", &err);
-	CHECK_ERROR_OCL(err, "creating merge_hist kernel", return false);
-
-	//compute cdf of brightness histogram
+	//merge partial histograms and compute cdf of brightness histogram
 	kernels["hist_cdf"] = clCreateKernel(m_program, "hist_cdf", &err);
 	CHECK_ERROR_OCL(err, "creating hist_cdf kernel", return false);
 
@@ -55,36 +51,43 @@ bool HistEq::setupOpenCL(cl_context_properties context_prop[], const Params& par
 
 	/////////////////////////////////////////////////////////////////kernel sizes
 
-	kernel2DSizes("transfer_data");
 	kernel1DSizes("partial_hist");
 
-	//number of workgroups in transfer_data kernel
+	//number of workgroups in partial_hist kernel
 	int num_wg = (global_sizes["partial_hist"][0])/(local_sizes["partial_hist"][0]);
 	reportStatus("Number of work groups in partial_hist: %lu", num_wg);
 
-	//merge_hist kernel size	
-	reportStatus("---------------------------------Kernel merge_hist:");
-	local_sizes["merge_hist"] = (size_t*) calloc(2, sizeof(size_t));
-	global_sizes["merge_hist"] = (size_t*) calloc(2, sizeof(size_t));
-	local_sizes["merge_hist"][0] = hist_size;
-	global_sizes["merge_hist"][0] = hist_size;
-	reportStatus("Kernel sizes: Local=%lu Global=%lu", global_sizes["merge_hist"][0], local_sizes["merge_hist"][0]);
+	//a single work group scans the histogram, each work item adding up a pair of bins at first
+	reportStatus("---------------------------------Kernel hist_cdf:");
+	size_t max_wg_size;
+	err = clGetKernelWorkGroupInfo(kernels["hist_cdf"], m_device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_wg_size, NULL);
+	CHECK_ERROR_OCL(err, "getting CL_KERNEL_WORK_GROUP_SIZE", return false);
+
+	for (scan_size = 1; scan_size < hist_size; scan_size *= 2);
+	local_sizes["hist_cdf"] = (size_t*) calloc(2, sizeof(size_t));
+	global_sizes["hist_cdf"] = (size_t*) calloc(2, sizeof(size_t));
+	local_sizes["hist_cdf"][0] = std::max(std::min((size_t) scan_size/2, max_wg_size), (size_t) 1);
+	global_sizes["hist_cdf"][0] = local_sizes["hist_cdf"][0];
+	reportStatus("Kernel sizes: Local=%lu Global=%lu", local_sizes["hist_cdf"][0], global_sizes["hist_cdf"][0]);
 
-	kernel1DSizes("hist_cdf");
 	kernel2DSizes("hist_eq");
 
-	/////////////////////////////////////////////////////////////////allocating memory
+	if (!setupMemory()) return false;
+	return setupKernelArgs();
+}
+
+bool HistEq::setupMemory() {
+	cl_int err;
+	int hist_size = PIXEL_RANGE+1;
+	int num_wg = (global_sizes["partial_hist"][0])/(local_sizes["partial_hist"][0]);
 
 	mems["partial_hist"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(unsigned int)*hist_size*num_wg, NULL, &err);
 	CHECK_ERROR_OCL(err, "creating histogram memory", return false);
 
-	mems["merge_hist"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(unsigned int)*hist_size, NULL, &err);
-	CHECK_ERROR_OCL(err, "creating merge_hist memory", return false);
+	mems["cdf"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(unsigned int)*hist_size, NULL, &err);
+	CHECK_ERROR_OCL(err, "creating cdf memory", return false);
 
-	mems["image"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(float)*img_size.x*img_size.y*NUM_CHANNELS, NULL, &err);
-	CHECK_ERROR_OCL(err, "creating image memory", return false);
-
-	if (params.opengl) {
+	if (m_params.opengl) {
 		mem_images[0] = clCreateFromGLTexture2D(m_clContext, CL_MEM_READ_ONLY, GL_TEXTURE_2D, 0, in_tex, &err);
 		CHECK_ERROR_OCL(err, "creating gl input texture", return false);
 		
@@ -94,74 +97,67 @@ bool HistEq::setupOpenCL(cl_context_properties context_prop[], const Params& par
 	else {
 		cl_image_format format;
 		format.image_channel_order = CL_RGBA;
-		format.image_channel_data_type = CL_UNSIGNED_INT8;
+		format.image_channel_data_type = m_params.inputType;
 		mem_images[0] = clCreateImage2D(m_clContext, CL_MEM_READ_ONLY, &format, img_size.x, img_size.y, 0, NULL, &err);
 		CHECK_ERROR_OCL(err, "creating input image memory", return false);
-	
+
+		format.image_channel_data_type = CL_UNSIGNED_INT8;
 		mem_images[1] = clCreateImage2D(m_clContext, CL_MEM_WRITE_ONLY, &format, img_size.x, img_size.y, 0, NULL, &err);
 		CHECK_ERROR_OCL(err, "creating output image memory", return false);
 	}
 
-	/////////////////////////////////////////////////////////////////setting kernel arguements
+	return true;
+}
+
+void HistEq::releaseMemory() {
+	clReleaseMemObject(mem_images[0]);
+	clReleaseMemObject(mem_images[1]);
+	clReleaseMemObject(mems["cdf"]);
+	clReleaseMemObject(mems["partial_hist"]);
+}
 
-	err  = clSetKernelArg(kernels["transfer_data"], 0, sizeof(cl_mem), &mem_images[0]);
-	err |= clSetKernelArg(kernels["transfer_data"], 1, sizeof(cl_mem), &mems["image"]);
-	CHECK_ERROR_OCL(err, "setting transfer_data arguments", return false);
+bool HistEq::setupKernelArgs() {
+	cl_int err;
+	int num_wg = (global_sizes["partial_hist"][0])/(local_sizes["partial_hist"][0]);
 
-	err  = clSetKernelArg(kernels["partial_hist"], 0, sizeof(cl_mem), &mems["image"]);
+	err  = clSetKernelArg(kernels["partial_hist"], 0, sizeof(cl_mem), &mem_images[0]);
 	err |= clSetKernelArg(kernels["partial_hist"], 1, sizeof(cl_mem), &mems["partial_hist"]);
+	err |= clSetKernelArg(kernels["partial_hist"], 2, sizeof(cl_int2), &img_size);
 	CHECK_ERROR_OCL(err, "setting partial_hist arguments", return false);
 
-	err  = clSetKernelArg(kernels["merge_hist"], 0, sizeof(cl_mem), &mems["partial_hist"]);
-	err |= clSetKernelArg(kernels["merge_hist"], 1, sizeof(cl_mem), &mems["merge_hist"]);
-	err |= clSetKernelArg(kernels["merge_hist"], 2, sizeof(unsigned int), &num_wg);
-	CHECK_ERROR_OCL(err, "setting merge_hist arguments", return false);
-
-	err = clSetKernelArg(kernels["hist_cdf"], 0, sizeof(cl_mem), &mems["merge_hist"]);
+	err  = clSetKernelArg(kernels["hist_cdf"], 0, sizeof(cl_mem), &mems["partial_hist"]);
+	err |= clSetKernelArg(kernels["hist_cdf"], 1, sizeof(cl_mem), &mems["cdf"]);
+	err |= clSetKernelArg(kernels["hist_cdf"], 2, sizeof(int), &num_wg);
+	err |= clSetKernelArg(kernels["hist_cdf"], 3, sizeof(cl_uint)*scan_size, NULL);
+	err |= clSetKernelArg(kernels["hist_cdf"], 4, sizeof(int), &scan_size);
 	CHECK_ERROR_OCL(err, "setting hist_cdf arguments", return false);
 
-	err  = clSetKernelArg(kernels["hist_eq"], 0, sizeof(cl_mem), &mems["image"]);
+	err  = clSetKernelArg(kernels["hist_eq"], 0, sizeof(cl_mem), &mem_images[0]);
 	err |= clSetKernelArg(kernels["hist_eq"], 1, sizeof(cl_mem), &mem_images[1]);
-	err |= clSetKernelArg(kernels["hist_eq"], 2, sizeof(cl_mem), &mems["merge_hist"]);
+	err |= clSetKernelArg(kernels["hist_eq"], 2, sizeof(cl_mem), &mems["cdf"]);
+	err |= clSetKernelArg(kernels["hist_eq"], 3, sizeof(cl_int2), &img_size);
 	CHECK_ERROR_OCL(err, "setting histogram_equalisation arguments", return false);
 
 	return true;
 }
 
-double HistEq::runCLKernels(bool recomputeMapping) {
+bool HistEq::enqueueCLKernels(bool recomputeMapping) {
 	cl_int err;
-	double start = omp_get_wtime();
-
-	err = clEnqueueNDRangeKernel(m_queue, kernels["transfer_data"], 2, NULL, global_sizes["transfer_data"], local_sizes["transfer_data"], 0, NULL, NULL);
-	CHECK_ERROR_OCL(err, "enqueuing transfer_data kernel", return false);
-
-	err = clEnqueueNDRangeKernel(m_queue, kernels["partial_hist"], 1, NULL, &global_sizes["partial_hist"][0], &local_sizes["partial_hist"][0], 0, NULL, NULL);
+	err = enqueueKernel("partial_hist", 1);
 	CHECK_ERROR_OCL(err, "enqueuing partial_hist kernel", return false);
 
-	err = clEnqueueNDRangeKernel(m_queue, kernels["merge_hist"], 1, NULL, &global_sizes["merge_hist"][0], &local_sizes["merge_hist"][0], 0, NULL, NULL);
-	CHECK_ERROR_OCL(err, "enqueuing merge_hist kernel", return false);
-
-	err = clEnqueueNDRangeKernel(m_queue, kernels["hist_cdf"], 1, NULL, &global_sizes["hist_cdf"][0], &local_sizes["hist_cdf"][0], 0, NULL, NULL);
+	err = enqueueKernel("hist_cdf", 1);
 	CHECK_ERROR_OCL(err, "enqueuing hist_cdf kernel", return false);
 
-	err = clEnqueueNDRangeKernel(m_queue, kernels["hist_eq"], 2, NULL, global_sizes["hist_eq"], local_sizes["hist_eq"], 0, NULL, NULL);
+	err = enqueueKernel("hist_eq", 2);
 	CHECK_ERROR_OCL(err, "enqueuing histogram_equalisation kernel", return false);
 
-	err = clFinish(m_queue);
-	CHECK_ERROR_OCL(err, "running kernels", return false);
-
-	return omp_get_wtime() - start;
+	return true;
 }
 
 bool HistEq::cleanupOpenCL() {
-	clReleaseMemObject(mem_images[0]);
-	clReleaseMemObject(mem_images[1]);
-	clReleaseMemObject(mems["image"]);
-	clReleaseMemObject(mems["merge_hist"]);
-	clReleaseMemObject(mems["partial_hist"]);
-	clReleaseKernel(kernels["transfer_data"]);
+	releaseMemory();
 	clReleaseKernel(kernels["partial_hist"]);
-	clReleaseKernel(kernels["merge_hist"]);
 	clReleaseKernel(kernels["hist_cdf"]);
 	clReleaseKernel(kernels["hist_eq"]);
 	releaseCL();
@@ -169,7 +165,13 @@ bool HistEq::cleanupOpenCL() {
 }
 
 
-bool HistEq::runReference(uchar* input, uchar* output) {
+//histogram bin of a brightness, radiance brighter than 8-bit white going in the last one
+static inline int brightnessBin(float brightness) {
+	return std::min(std::max((int)(brightness + 0.5f), 0), PIXEL_RANGE);
+}
+
+template <typename T>
+bool HistEq::reference(T* input, uchar* output) {
 	// Check for cached result
 	if (m_reference.data) {
 		memcpy(output, m_reference.data, img_size.x*img_size.y*NUM_CHANNELS);
@@ -179,41 +181,44 @@ bool HistEq::runReference(uchar* input, uchar* output) {
 
 	const int hist_size = PIXEL_RANGE+1;
 	unsigned int brightness_hist[hist_size] = {0};
-	int brightness;
-	float red, green, blue;
 
 	reportStatus("Running reference");
-	int2 pos;
-	for (pos.y = 0; pos.y < img_size.y; pos.y++) {
-		for (pos.x = 0; pos.x < img_size.x; pos.x++) {
-			red   = getPixel(input, img_size, pos, 0);
-			green = getPixel(input, img_size, pos, 1);
-			blue  = getPixel(input, img_size, pos, 2);
-			brightness = std::max(std::max(red, green), blue);
-			brightness_hist[brightness] ++;
+	ImageView<T, NUM_CHANNELS> in_image(input, img_size);
+	PixelView out_image(output, img_size);
+
+	//every thread counts its rows in its own histogram, the counts are exact so merging them in any order gives the same result
+	#pragma omp parallel
+	{
+		unsigned int hist[hist_size] = {0};
+		#pragma omp for schedule(static)
+		for (int y = 0; y < img_size.y; y++) {
+			T* in = in_image.row(y);
+			for (int x = 0; x < img_size.x; x++) {
+				hist[brightnessBin(getBrightness(in + x*NUM_CHANNELS))] ++;
+			}
 		}
+		#pragma omp critical
+		for (int i = 0; i < hist_size; i++) brightness_hist[i] += hist[i];
 	}
 
 	for (int i = 1; i < hist_size; i++) {
 		brightness_hist[i] += brightness_hist[i-1];
 	}
 
-	float3 rgb;
-	float3 hsv;
-	for (pos.y = 0; pos.y < img_size.y; pos.y++) {
-		for (pos.x = 0; pos.x < img_size.x; pos.x++) {
-			rgb.x = getPixel(input, img_size, pos, 0);
-			rgb.y = getPixel(input, img_size, pos, 1);
-			rgb.z = getPixel(input, img_size, pos, 2);
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		T* in = in_image.row(y);
+		uchar* out = out_image.row(y);
+		for (int x = 0; x < img_size.x; x++) {
+			float3 rgb, hsv;
+			rgb = getColour(in + x*NUM_CHANNELS);
 			hsv = RGBtoHSV(rgb);		//Convert to HSV to get Hue and Saturation
 
-			hsv.z = ((hist_size-1)*(brightness_hist[(int)hsv.z] - brightness_hist[0]))
+			hsv.z = ((hist_size-1)*(brightness_hist[brightnessBin(hsv.z)] - brightness_hist[0]))
 						/(img_size.x*img_size.y - brightness_hist[0]);
 
 			rgb = HSVtoRGB(hsv);	//Convert back to RGB with the modified brightness for V
-			setPixel(output, img_size, pos, 0, rgb.x);
-			setPixel(output, img_size, pos, 1, rgb.y);
-			setPixel(output, img_size, pos, 2, rgb.z);
+			setColour(out + x*NUM_CHANNELS, rgb);
 		}
 	}
 
@@ -229,3 +234,77 @@ bool HistEq::runReference(uchar* input, uchar* output) {
 
 	return true;
 }
+
+
+template <typename T>
+bool HistEq::native(T* input, uchar* output) {
+	const int hist_size = PIXEL_RANGE+1;
+	const int num_pixels = img_size.x*img_size.y;
+	unsigned int brightness_hist[hist_size] = {0};
+
+	reportStatus("Running native");
+
+	//every thread counts its rows in its own histogram, the counts are exact so merging them in any order gives the same result
+	#pragma omp parallel
+	{
+		unsigned int hist[hist_size] = {0};
+		#pragma omp for schedule(static)
+		for (int i = 0; i < num_pixels; i++) {
+			hist[brightnessBin(getBrightness(input + i*NUM_CHANNELS))]++;
+		}
+		#pragma omp critical
+		for (int i = 0; i < hist_size; i++) brightness_hist[i] += hist[i];
+	}
+
+	for (int i = 1; i < hist_size; i++) {
+		brightness_hist[i] += brightness_hist[i-1];
+	}
+
+	//changing the brightness V of a pixel while keeping its hue and saturation scales all of its channels by the same factor
+	//so the conversions to and from HSV are replaced by multiplying each channel by the new brightness over the old one
+	float brightness[hist_size];
+	for (int i = 0; i < hist_size; i++) {
+		if (brightness_hist[0] == (unsigned int) num_pixels) brightness[i] = 0.f;	//the image is black
+		else brightness[i] = ((hist_size-1)*(brightness_hist[i] - brightness_hist[0]))/(num_pixels - brightness_hist[0]);
+	}
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		T* in = input + y*img_size.x*NUM_CHANNELS;
+		uchar* out = output + y*img_size.x*NUM_CHANNELS;
+		for (int x = 0; x < img_size.x; x += NATIVE_WIDTH) {
+			int n = std::min(NATIVE_WIDTH, img_size.x-x);
+			float old_v[NATIVE_WIDTH] = {0}, new_v[NATIVE_WIDTH] = {0};
+			for (int i = 0; i < n; i++) {
+				old_v[i] = getBrightness(in + (x+i)*NUM_CHANNELS);
+				new_v[i] = brightness[brightnessBin(old_v[i])];
+			}
+			floatv r, g, b;
+			load_pixels(in + x*NUM_CHANNELS, n, &r, &g, &b);
+			//multiplying first keeps the brightest channel exact, black pixels give NaN which is clamped to 0
+			floatv v = vload(new_v);
+			floatv old = vload(old_v);
+			store_pixels(out + x*NUM_CHANNELS, n, clamp_colour(r*v/old), clamp_colour(g*v/old), clamp_colour(b*v/old));
+		}
+	}
+
+	reportStatus("Finished native");
+
+	return true;
+}
+
+bool HistEq::runReference(uchar* input, uchar* output) {
+	return reference(input, output);
+}
+
+bool HistEq::runReference(float* input, uchar* output) {
+	return reference(input, output);
+}
+
+bool HistEq::runNative(uchar* input, uchar* output) {
+	return native(input, output);
+}
+
+bool HistEq::runNative(float* input, uchar* output) {
+	return native(input, output);
+}
@@ -8,6 +8,8 @@
 
 #include "Filter.h"
 
+#define HIST_REPLICAS 8	//copies of the local histogram in partial_hist, incremented by neighbouring work items
+
 namespace hdr
 {
 class HistEq : public Filter {
@@ -15,8 +17,21 @@ public:
 	HistEq();
 
 	virtual bool setupOpenCL(cl_context_properties context_prop[], const Params& params);
-	virtual double runCLKernels(bool recomputeMapping);
+	virtual bool enqueueCLKernels(bool recomputeMapping);
 	virtual bool cleanupOpenCL();
 	virtual bool runReference(uchar* input, uchar* output);
+	virtual bool runReference(float* input, uchar* output);
+	virtual bool runNative(uchar* input, uchar* output);
+	virtual bool runNative(float* input, uchar* output);
+
+protected:
+	virtual bool setupMemory();
+	virtual void releaseMemory();
+	virtual bool setupKernelArgs();
+	//runReference and runNative for 8-bit and radiance input
+	template <typename T> bool reference(T* input, uchar* output);
+	template <typename T> bool native(T* input, uchar* output);
+
+	int scan_size;	//number of bins scanned by hist_cdf, the histogram size rounded up to a power of two
 };
 }
@@ -0,0 +1,360 @@
+// Native.h (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#pragma once
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Filter.h"
+
+//the native implementations of the filters process NATIVE_WIDTH consecutive pixels of a row at a time
+//with AVX2 or SSE2, whichever the compiler targets, and with scalar code on any other CPU
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define NATIVE_WIDTH 8
+#elif defined(__SSE2__)
+	#include <emmintrin.h>
+	#define NATIVE_WIDTH 4
+#else
+	#define NATIVE_WIDTH 1
+#endif
+
+namespace hdr
+{
+#if NATIVE_WIDTH == 8
+
+struct floatv {
+	__m256 v;
+	floatv() {}
+	floatv(__m256 _v) : v(_v) {}
+	floatv(float x) : v(_mm256_set1_ps(x)) {}
+};
+
+static inline floatv operator+(floatv a, floatv b) { return _mm256_add_ps(a.v, b.v); }
+static inline floatv operator-(floatv a, floatv b) { return _mm256_sub_ps(a.v, b.v); }
+static inline floatv operator*(floatv a, floatv b) { return _mm256_mul_ps(a.v, b.v); }
+static inline floatv operator/(floatv a, floatv b) { return _mm256_div_ps(a.v, b.v); }
+//like maxps and minps, b is returned when either is NaN
+static inline floatv vmax(floatv a, floatv b) { return _mm256_max_ps(a.v, b.v); }
+static inline floatv vmin(floatv a, floatv b) { return _mm256_min_ps(a.v, b.v); }
+static inline floatv vsqrt(floatv a) { return _mm256_sqrt_ps(a.v); }
+static inline floatv vfloor(floatv a) { return _mm256_floor_ps(a.v); }
+static inline floatv vload(const float* p) { return _mm256_loadu_ps(p); }
+static inline void vstore(float* p, floatv a) { _mm256_storeu_ps(p, a.v); }
+
+//mask of the lanes where a < b, which vselect picks a or b with
+static inline floatv vless(floatv a, floatv b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+static inline floatv vselect(floatv mask, floatv a, floatv b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+
+//splits positive values into a mantissa in [0.5, 1) and an exponent, like frexp
+static inline floatv vfrexp(floatv a, floatv* e) {
+	__m256i bits = _mm256_castps_si256(a.v);
+	*e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+	bits = _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x807fffff)), _mm256_set1_epi32(0x3f000000));
+	return _mm256_castsi256_ps(bits);
+}
+
+//2^n for integral n in [-127, 127]
+static inline floatv vexp2i(floatv n) {
+	__m256i bits = _mm256_add_epi32(_mm256_cvttps_epi32(n.v), _mm256_set1_epi32(127));
+	return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 23));
+}
+
+//loads n <= NATIVE_WIDTH RGBA pixels, the missing ones being black
+static inline void load_pixels(const uchar* p, int n, floatv* r, floatv* g, floatv* b) {
+	uint32_t buf[NATIVE_WIDTH] = {0};
+	if (n < NATIVE_WIDTH) {
+		memcpy(buf, p, n*NUM_CHANNELS);
+		p = (const uchar*) buf;
+	}
+	__m256i px = _mm256_loadu_si256((const __m256i*) p);
+	__m256i mask = _mm256_set1_epi32(0xff);
+	r->v = _mm256_cvtepi32_ps(_mm256_and_si256(px, mask));
+	g->v = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 8), mask));
+	b->v = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 16), mask));
+}
+
+//loads the colours of n <= NATIVE_WIDTH RGBA radiance pixels, scaled to the range of 8-bit pixels, the rest being black
+//each half of the registers holds one of the two groups of 4 pixels, which are transposed within the halves
+static inline void load_pixels(const float* p, int n, floatv* r, floatv* g, floatv* b) {
+	float buf[NATIVE_WIDTH*NUM_CHANNELS] = {0};
+	if (n < NATIVE_WIDTH) {
+		memcpy(buf, p, n*NUM_CHANNELS*sizeof(float));
+		p = buf;
+	}
+	__m256 p0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p)), _mm_loadu_ps(p + 16), 1);
+	__m256 p1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 4)), _mm_loadu_ps(p + 20), 1);
+	__m256 p2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 8)), _mm_loadu_ps(p + 24), 1);
+	__m256 p3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 12)), _mm_loadu_ps(p + 28), 1);
+	__m256 rg01 = _mm256_unpacklo_ps(p0, p1);
+	__m256 ba01 = _mm256_unpackhi_ps(p0, p1);
+	__m256 rg23 = _mm256_unpacklo_ps(p2, p3);
+	__m256 ba23 = _mm256_unpackhi_ps(p2, p3);
+	__m256 scale = _mm256_set1_ps(PIXEL_RANGE);
+	r->v = _mm256_mul_ps(_mm256_shuffle_ps(rg01, rg23, _MM_SHUFFLE(1, 0, 1, 0)), scale);
+	g->v = _mm256_mul_ps(_mm256_shuffle_ps(rg01, rg23, _MM_SHUFFLE(3, 2, 3, 2)), scale);
+	b->v = _mm256_mul_ps(_mm256_shuffle_ps(ba01, ba23, _MM_SHUFFLE(1, 0, 1, 0)), scale);
+}
+
+//stores the colours of n <= NATIVE_WIDTH RGBA pixels, which must be within [0, PIXEL_RANGE], keeping their alpha
+static inline void store_pixels(uchar* p, int n, floatv r, floatv g, floatv b) {
+	uint32_t buf[NATIVE_WIDTH];
+	uchar* dst = p;
+	if (n < NATIVE_WIDTH) {
+		memcpy(buf, p, n*NUM_CHANNELS);
+		dst = (uchar*) buf;
+	}
+	__m256i px = _mm256_and_si256(_mm256_loadu_si256((const __m256i*) dst), _mm256_set1_epi32(0xff000000));
+	px = _mm256_or_si256(px, _mm256_cvttps_epi32(r.v));
+	px = _mm256_or_si256(px, _mm256_slli_epi32(_mm256_cvttps_epi32(g.v), 8));
+	px = _mm256_or_si256(px, _mm256_slli_epi32(_mm256_cvttps_epi32(b.v), 16));
+	_mm256_storeu_si256((__m256i*) dst, px);
+	if (n < NATIVE_WIDTH) memcpy(p, buf, n*NUM_CHANNELS);
+}
+
+#elif NATIVE_WIDTH == 4
+
+struct floatv {
+	__m128 v;
+	floatv() {}
+	floatv(__m128 _v) : v(_v) {}
+	floatv(float x) : v(_mm_set1_ps(x)) {}
+};
+
+static inline floatv operator+(floatv a, floatv b) { return _mm_add_ps(a.v, b.v); }
+static inline floatv operator-(floatv a, floatv b) { return _mm_sub_ps(a.v, b.v); }
+static inline floatv operator*(floatv a, floatv b) { return _mm_mul_ps(a.v, b.v); }
+static inline floatv operator/(floatv a, floatv b) { return _mm_div_ps(a.v, b.v); }
+//like maxps and minps, b is returned when either is NaN
+static inline floatv vmax(floatv a, floatv b) { return _mm_max_ps(a.v, b.v); }
+static inline floatv vmin(floatv a, floatv b) { return _mm_min_ps(a.v, b.v); }
+static inline floatv vsqrt(floatv a) { return _mm_sqrt_ps(a.v); }
+static inline floatv vload(const float* p) { return _mm_loadu_ps(p); }
+static inline void vstore(float* p, floatv a) { _mm_storeu_ps(p, a.v); }
+
+//mask of the lanes where a < b, which vselect picks a or b with
+static inline floatv vless(floatv a, floatv b) { return _mm_cmplt_ps(a.v, b.v); }
+static inline floatv vselect(floatv mask, floatv a, floatv b) {
+	return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+
+//SSE2 has no rounding instruction, so truncate and correct the negative values
+static inline floatv vfloor(floatv a) {
+	floatv t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+	return t - vselect(vless(a, t), 1.f, 0.f);
+}
+
+//splits positive values into a mantissa in [0.5, 1) and an exponent, like frexp
+static inline floatv vfrexp(floatv a, floatv* e) {
+	__m128i bits = _mm_castps_si128(a.v);
+	*e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(126)));
+	bits = _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x807fffff)), _mm_set1_epi32(0x3f000000));
+	return _mm_castsi128_ps(bits);
+}
+
+//2^n for integral n in [-127, 127]
+static inline floatv vexp2i(floatv n) {
+	__m128i bits = _mm_add_epi32(_mm_cvttps_epi32(n.v), _mm_set1_epi32(127));
+	return _mm_castsi128_ps(_mm_slli_epi32(bits, 23));
+}
+
+//loads n <= NATIVE_WIDTH RGBA pixels, the missing ones being black
+static inline void load_pixels(const uchar* p, int n, floatv* r, floatv* g, floatv* b) {
+	uint32_t buf[NATIVE_WIDTH] = {0};
+	if (n < NATIVE_WIDTH) {
+		memcpy(buf, p, n*NUM_CHANNELS);
+		p = (const uchar*) buf;
+	}
+	__m128i px = _mm_loadu_si128((const __m128i*) p);
+	__m128i mask = _mm_set1_epi32(0xff);
+	r->v = _mm_cvtepi32_ps(_mm_and_si128(px, mask));
+	g->v = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), mask));
+	b->v = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), mask));
+}
+
+//loads the colours of n <= NATIVE_WIDTH RGBA radiance pixels, scaled to the range of 8-bit pixels, the rest being black
+static inline void load_pixels(const float* p, int n, floatv* r, floatv* g, floatv* b) {
+	float buf[NATIVE_WIDTH*NUM_CHANNELS] = {0};
+	if (n < NATIVE_WIDTH) {
+		memcpy(buf, p, n*NUM_CHANNELS*sizeof(float));
+		p = buf;
+	}
+	__m128 p0 = _mm_loadu_ps(p), p1 = _mm_loadu_ps(p + 4), p2 = _mm_loadu_ps(p + 8), p3 = _mm_loadu_ps(p + 12);
+	_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+	__m128 scale = _mm_set1_ps(PIXEL_RANGE);
+	r->v = _mm_mul_ps(p0, scale);
+	g->v = _mm_mul_ps(p1, scale);
+	b->v = _mm_mul_ps(p2, scale);
+}
+
+//stores the colours of n <= NATIVE_WIDTH RGBA pixels, which must be within [0, PIXEL_RANGE], keeping their alpha
+static inline void store_pixels(uchar* p, int n, floatv r, floatv g, floatv b) {
+	uint32_t buf[NATIVE_WIDTH];
+	uchar* dst = p;
+	if (n < NATIVE_WIDTH) {
+		memcpy(buf, p, n*NUM_CHANNELS);
+		dst = (uchar*) buf;
+	}
+	__m128i px = _mm_and_si128(_mm_loadu_si128((const __m128i*) dst), _mm_set1_epi32(0xff000000));
+	px = _mm_or_si128(px, _mm_cvttps_epi32(r.v));
+	px = _mm_or_si128(px, _mm_slli_epi32(_mm_cvttps_epi32(g.v), 8));
+	px = _mm_or_si128(px, _mm_slli_epi32(_mm_cvttps_epi32(b.v), 16));
+	_mm_storeu_si128((__m128i*) dst, px);
+	if (n < NATIVE_WIDTH) memcpy(p, buf, n*NUM_CHANNELS);
+}
+
+#else
+
+struct floatv {
+	float v;
+	floatv() {}
+	floatv(float x) : v(x) {}
+};
+
+static inline floatv operator+(floatv a, floatv b) { return a.v + b.v; }
+static inline floatv operator-(floatv a, floatv b) { return a.v - b.v; }
+static inline floatv operator*(floatv a, floatv b) { return a.v * b.v; }
+static inline floatv operator/(floatv a, floatv b) { return a.v / b.v; }
+//b is returned when either is NaN, as with SSE
+static inline floatv vmax(floatv a, floatv b) { return a.v > b.v ? a.v : b.v; }
+static inline floatv vmin(floatv a, floatv b) { return a.v < b.v ? a.v : b.v; }
+static inline floatv vsqrt(floatv a) { return sqrtf(a.v); }
+static inline floatv vload(const float* p) { return *p; }
+static inline void vstore(float* p, floatv a) { *p = a.v; }
+static inline floatv vlog(floatv a) { return logf(vmax(a, FLT_MIN).v); }
+static inline floatv vexp(floatv a) { return expf(a.v); }
+
+static inline void load_pixels(const uchar* p, int n, floatv* r, floatv* g, floatv* b) {
+	r->v = p[0];
+	g->v = p[1];
+	b->v = p[2];
+}
+
+static inline void load_pixels(const float* p, int n, floatv* r, floatv* g, floatv* b) {
+	r->v = p[0]*PIXEL_RANGE;
+	g->v = p[1]*PIXEL_RANGE;
+	b->v = p[2]*PIXEL_RANGE;
+}
+
+static inline void store_pixels(uchar* p, int n, floatv r, floatv g, floatv b) {
+	p[0] = r.v;
+	p[1] = g.v;
+	p[2] = b.v;
+}
+
+#endif
+
+#if NATIVE_WIDTH > 1
+//natural logarithm and exponential, ported from the single precision functions of the Cephes library
+//logarithms of values smaller than FLT_MIN are those of FLT_MIN
+static inline floatv vlog(floatv x) {
+	floatv e;
+	x = vfrexp(vmax(x, FLT_MIN), &e);
+
+	//x is in [sqrt(0.5), sqrt(2)) from here on
+	floatv small = vless(x, 0.707106781186547524f);
+	e = e - vselect(small, 1.f, 0.f);
+	x = x - 1.f + vselect(small, x, 0.f);
+
+	floatv z = x*x;
+	floatv y = 7.0376836292E-2f;
+	y = y*x - 1.1514610310E-1f;
+	y = y*x + 1.1676998740E-1f;
+	y = y*x - 1.2420140846E-1f;
+	y = y*x + 1.4249322787E-1f;
+	y = y*x - 1.6668057665E-1f;
+	y = y*x + 2.0000714765E-1f;
+	y = y*x - 2.4999993993E-1f;
+	y = y*x + 3.3333331174E-1f;
+	y = y*x*z;
+
+	y = y + e*-2.12194440E-4f - z*0.5f;
+	return x + y + e*0.693359375f;
+}
+
+static inline floatv vexp(floatv x) {
+	x = vmin(vmax(x, -88.f), 88.f);
+
+	//exp(x) = 2^n * exp(x - n*log(2))
+	floatv n = vfloor(x*1.44269504088896341f + 0.5f);
+	x = x - n*0.693359375f + n*2.12194440E-4f;
+
+	floatv z = x*x;
+	floatv y = 1.9875691500E-4f;
+	y = y*x + 1.3981999507E-3f;
+	y = y*x + 8.3334519073E-3f;
+	y = y*x + 4.1665795894E-2f;
+	y = y*x + 1.6666665459E-1f;
+	y = y*x + 5.0000001201E-1f;
+	y = y*z + x + 1.f;
+	return y*vexp2i(n);
+}
+#endif
+
+//x^y for positive x, x = 0 giving a negligible value rather than 0
+static inline floatv vpow(floatv x, float y) {
+	return vexp(vlog(x)*y);
+}
+
+//clamps the colours to [0, PIXEL_RANGE] before they are stored, NaN becoming 0
+static inline floatv clamp_colour(floatv x) {
+	return vmin(vmax(x, 0.f), (float) PIXEL_RANGE);
+}
+
+//luminance of linear RGB, the Y of RGBtoXYZ
+static inline floatv luminance(floatv r, floatv g, floatv b) {
+	return r*0.2126f + g*0.7152f + b*0.0722f;
+}
+
+//1 for the first n lanes and 0 for the others
+static inline floatv lane_mask(int n) {
+	float m[NATIVE_WIDTH];
+	for (int i = 0; i < NATIVE_WIDTH; i++) m[i] = (i < n) ? 1.f : 0.f;
+	return vload(m);
+}
+
+//loads n <= NATIVE_WIDTH values, the missing ones being zero
+static inline floatv load_values(const float* p, int n) {
+	if (n == NATIVE_WIDTH) return vload(p);
+	float buf[NATIVE_WIDTH] = {0};
+	memcpy(buf, p, n*sizeof(float));
+	return vload(buf);
+}
+
+//stores the first n <= NATIVE_WIDTH values
+static inline void store_values(float* p, int n, floatv a) {
+	if (n == NATIVE_WIDTH) {
+		vstore(p, a);
+		return;
+	}
+	float buf[NATIVE_WIDTH];
+	vstore(buf, a);
+	memcpy(p, buf, n*sizeof(float));
+}
+
+//sum and maximum of the lanes, always added in the same order so the results don't depend on the schedule
+static inline float sum_lanes(floatv a) {
+	float buf[NATIVE_WIDTH];
+	vstore(buf, a);
+	float sum = 0.f;
+	for (int i = 0; i < NATIVE_WIDTH; i++) sum += buf[i];
+	return sum;
+}
+
+static inline float max_lanes(floatv a) {
+	float buf[NATIVE_WIDTH];
+	vstore(buf, a);
+	float max = buf[0];
+	for (int i = 1; i < NATIVE_WIDTH; i++) max = std::max(max, buf[i]);
+	return max;
+}
+}
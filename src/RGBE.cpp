@@ -0,0 +1,308 @@
+// RGBE.cpp (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include <cstdlib>
+#include <cstring>
+#include <math.h>
+
+#include "RGBE.h"
+
+using namespace hdr;
+
+//scanlines of this width are run-length encoded, a scanline starting with 2, 2 and its width
+static inline bool encodable(int width) {
+	return width >= 8 && width <= 0x7fff;
+}
+
+
+////////////
+// Reader //
+////////////
+
+RGBEReader::RGBEReader() {
+	m_file = NULL;
+	m_width = m_height = m_row = 0;
+	m_buffer_pos = m_buffer_end = 0;
+}
+
+RGBEReader::~RGBEReader() {
+	close();
+}
+
+void RGBEReader::close() {
+	if (m_file) fclose(m_file);
+	m_file = NULL;
+	m_buffer_pos = m_buffer_end = 0;
+}
+
+int RGBEReader::width() const {
+	return m_width;
+}
+
+int RGBEReader::height() const {
+	return m_height;
+}
+
+bool RGBEReader::fill() {
+	m_buffer_pos = 0;
+	m_buffer_end = fread(m_buffer, 1, RGBE_BUFFER_SIZE, m_file);
+	return m_buffer_end > 0;
+}
+
+int RGBEReader::getByte() {
+	if (m_buffer_pos == m_buffer_end && !fill()) return -1;
+	return m_buffer[m_buffer_pos++];
+}
+
+bool RGBEReader::getBytes(uchar* dst, int n) {
+	while (n > 0) {
+		if (m_buffer_pos == m_buffer_end && !fill()) return false;
+		int available = std::min(n, m_buffer_end - m_buffer_pos);
+		memcpy(dst, m_buffer + m_buffer_pos, available);
+		m_buffer_pos += available;
+		dst += available;
+		n -= available;
+	}
+	return true;
+}
+
+bool RGBEReader::getLine(std::string& line) {
+	line.clear();
+	int c;
+	while ((c = getByte()) >= 0 && c != '\n') line += (char) c;
+	return c >= 0;
+}
+
+bool RGBEReader::open(const char* path) {
+	close();
+	m_file = fopen(path, "rb");
+	if (!m_file) return false;
+
+	std::string line;
+	if (!getLine(line) || (line != "#?RADIANCE" && line != "#?RGBE")) {
+		close();
+		return false;
+	}
+
+	//variables of the header up to the empty line, only the format and exposure matter
+	float exposure = 1.f;
+	while (getLine(line) && !line.empty()) {
+		if (!line.compare(0, 7, "FORMAT=") && line != "FORMAT=32-bit_rle_rgbe") {
+			close();
+			return false;
+		}
+		if (!line.compare(0, 9, "EXPOSURE=")) exposure *= atof(line.c_str() + 9);
+	}
+
+	//the pixels must be stored a row at a time from the top left, which nearly every file is
+	char x_axis[3];
+	if (!getLine(line) || sscanf(line.c_str(), "-Y %d %2s %d", &m_height, x_axis, &m_width) != 3
+			|| strcmp(x_axis, "+X") || m_width <= 0 || m_height <= 0 || exposure <= 0.f) {
+		close();
+		return false;
+	}
+
+	//the mantissas are offset by half a step, as they were truncated by the writer
+	for (int e = 0; e < 256; e++) m_scale[e] = e ? ldexpf(1.f, e - (128+8))/exposure : 0.f;
+	m_rgbe.resize(m_width*4);
+	m_row = 0;
+	return true;
+}
+
+//flat scanlines, which may contain runs of the previous pixel in the old encoding
+bool RGBEReader::readFlat(const uchar first[4]) {
+	uchar* planes[4] = {&m_rgbe[0], &m_rgbe[m_width], &m_rgbe[2*m_width], &m_rgbe[3*m_width]};
+	uchar pixel[4];
+	memcpy(pixel, first, 4);
+	int shift = 0;
+	for (int x = 0; x < m_width; ) {
+		if (x > 0 && !getBytes(pixel, 4)) return false;
+		if (pixel[0] == 1 && pixel[1] == 1 && pixel[2] == 1) {
+			int count = pixel[3] << shift;
+			if (x == 0 || x + count > m_width) return false;
+			for (int c = 0; c < 4; c++) memset(planes[c] + x, planes[c][x-1], count);
+			x += count;
+			shift += 8;
+		}
+		else {
+			for (int c = 0; c < 4; c++) planes[c][x] = pixel[c];
+			x++;
+			shift = 0;
+		}
+	}
+	return true;
+}
+
+bool RGBEReader::readRGBE() {
+	if (!m_file || m_row == m_height) return false;
+	m_row++;
+
+	uchar start[4];
+	if (!getBytes(start, 4)) return false;
+	if (!encodable(m_width) || start[0] != 2 || start[1] != 2 || (start[2] & 0x80)) return readFlat(start);
+	if ((start[2] << 8 | start[3]) != m_width) return false;
+
+	//each component is stored in turn as runs of a byte and as literal bytes
+	for (int c = 0; c < 4; c++) {
+		uchar* plane = &m_rgbe[c*m_width];
+		for (int x = 0; x < m_width; ) {
+			int count = getByte();
+			if (count > 128) {
+				count -= 128;
+				int value = getByte();
+				if (value < 0 || x + count > m_width) return false;
+				memset(plane + x, value, count);
+			}
+			else if (count <= 0 || x + count > m_width || !getBytes(plane + x, count)) return false;
+			x += count;
+		}
+	}
+	return true;
+}
+
+bool RGBEReader::readScanline(float* rgba) {
+	if (!readRGBE()) return false;
+
+	const uchar* r = &m_rgbe[0];
+	const uchar* g = r + m_width;
+	const uchar* b = g + m_width;
+	const uchar* e = b + m_width;
+	for (int x = 0; x < m_width; x++) {
+		float scale = m_scale[e[x]];
+		rgba[x*NUM_CHANNELS + 0] = (r[x] + 0.5f)*scale;
+		rgba[x*NUM_CHANNELS + 1] = (g[x] + 0.5f)*scale;
+		rgba[x*NUM_CHANNELS + 2] = (b[x] + 0.5f)*scale;
+		rgba[x*NUM_CHANNELS + 3] = 1.f;
+	}
+	return true;
+}
+
+
+////////////
+// Writer //
+////////////
+
+RGBEWriter::RGBEWriter() {
+	m_file = NULL;
+	m_width = m_height = m_row = 0;
+	m_failed = false;
+}
+
+RGBEWriter::~RGBEWriter() {
+	close();
+}
+
+bool RGBEWriter::open(const char* path, int width, int height) {
+	close();
+	if (width <= 0 || height <= 0) return false;
+	m_file = fopen(path, "wb");
+	if (!m_file) return false;
+
+	m_width = width;
+	m_height = height;
+	m_row = 0;
+	m_failed = fprintf(m_file, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n", height, width) < 0;
+	m_rgbe.resize(width*4);
+	m_encoded.reserve(width*4 + width/32 + 8);
+	return !m_failed;
+}
+
+bool RGBEWriter::close() {
+	if (!m_file) return false;
+	bool complete = m_row == m_height && !m_failed;
+	complete = (fclose(m_file) == 0) && complete;
+	m_file = NULL;
+	return complete;
+}
+
+//negative radiance and NaN become 0, and radiance beyond the largest exponent the largest value
+static inline float clampRadiance(float x) {
+	static const float max_radiance = ldexpf(255.f/256, 127);
+	return (x > 0.f) ? std::min(x, max_radiance) : 0.f;
+}
+
+//the largest channel gives the exponent, the mantissas being truncated to 8 bits
+void RGBEWriter::setPixel(int x, float r, float g, float b) {
+	r = clampRadiance(r);
+	g = clampRadiance(g);
+	b = clampRadiance(b);
+	float v = std::max(std::max(r, g), b);
+	if (v < 1e-32f) {
+		for (int c = 0; c < 4; c++) m_rgbe[c*m_width + x] = 0;
+		return;
+	}
+	int e;
+	float scale = frexpf(v, &e)*256.f/v;
+	m_rgbe[x] = r*scale;
+	m_rgbe[m_width + x] = g*scale;
+	m_rgbe[2*m_width + x] = b*scale;
+	m_rgbe[3*m_width + x] = e + 128;
+}
+
+//appends the bytes as runs of at least RGBE_MIN_RUN equal bytes and the literal bytes between them
+static void encodeRuns(const uchar* data, int n, std::vector<uchar>& out) {
+	int cur = 0;
+	while (cur < n) {
+		int run_start = cur;
+		int run_count = 0, prev_count = 0;
+		while (run_count < RGBE_MIN_RUN && run_start < n) {
+			run_start += run_count;
+			prev_count = run_count;
+			run_count = 1;
+			while (run_start + run_count < n && run_count < 127 && data[run_start + run_count] == data[run_start]) run_count++;
+		}
+
+		//a short run straight before the long one is cheaper as a run than as literals
+		if (prev_count > 1 && prev_count == run_start - cur) {
+			out.push_back(128 + prev_count);
+			out.push_back(data[cur]);
+			cur = run_start;
+		}
+		while (cur < run_start) {
+			int count = std::min(run_start - cur, 128);
+			out.push_back(count);
+			out.insert(out.end(), data + cur, data + cur + count);
+			cur += count;
+		}
+		if (run_count >= RGBE_MIN_RUN) {
+			out.push_back(128 + run_count);
+			out.push_back(data[run_start]);
+			cur += run_count;
+		}
+	}
+}
+
+bool RGBEWriter::writeRGBE() {
+	if (!m_file || m_failed || m_row == m_height) return false;
+	m_row++;
+
+	m_encoded.clear();
+	if (encodable(m_width)) {
+		m_encoded.push_back(2);
+		m_encoded.push_back(2);
+		m_encoded.push_back(m_width >> 8);
+		m_encoded.push_back(m_width & 0xff);
+		for (int c = 0; c < 4; c++) encodeRuns(&m_rgbe[c*m_width], m_width, m_encoded);
+	}
+	else {
+		for (int x = 0; x < m_width; x++) {
+			for (int c = 0; c < 4; c++) m_encoded.push_back(m_rgbe[c*m_width + x]);
+		}
+	}
+
+	m_failed = fwrite(&m_encoded[0], 1, m_encoded.size(), m_file) != m_encoded.size();
+	return !m_failed;
+}
+
+bool RGBEWriter::writeScanline(const float* rgba) {
+	if (!m_file) return false;
+	for (int x = 0; x < m_width; x++) {
+		setPixel(x, rgba[x*NUM_CHANNELS + 0], rgba[x*NUM_CHANNELS + 1], rgba[x*NUM_CHANNELS + 2]);
+	}
+	return writeRGBE();
+}
@@ -0,0 +1,83 @@
+// RGBE.h (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Filter.h"
+
+#define RGBE_BUFFER_SIZE 65536	//bytes read from the file at a time
+#define RGBE_MIN_RUN 4			//shortest run of equal bytes worth encoding as a run
+
+namespace hdr
+{
+//reader of Radiance .hdr images, whose pixels are RGB mantissas sharing an exponent byte
+//scanlines are decoded one at a time, the run-length encoded ones component by component,
+//so only a scanline of RGBE pixels is held in memory whatever the size of the image
+//the radiance is scaled by the EXPOSURE of the header back to the values of the original image
+class RGBEReader {
+public:
+	RGBEReader();
+	~RGBEReader();
+
+	//parses the header, returns false if the file isn't a Radiance image stored from the top left
+	bool open(const char* path);
+	void close();
+
+	int width() const;
+	int height() const;
+
+	//decodes the next scanline, from the top, as width RGBA pixels of opaque radiance
+	bool readScanline(float* rgba);
+
+private:
+	FILE* m_file;
+	int m_width, m_height;
+	int m_row;	//scanlines decoded so far
+	float m_scale[256];	//radiance of a mantissa of 1 for each exponent
+	std::vector<uchar> m_rgbe;	//the R, G, B and E planes of the scanline being decoded
+
+	uchar m_buffer[RGBE_BUFFER_SIZE];
+	int m_buffer_pos, m_buffer_end;
+	bool fill();
+	int getByte();	//-1 at the end of the file
+	bool getBytes(uchar* dst, int n);
+	bool getLine(std::string& line);
+
+	bool readRGBE();
+	bool readFlat(const uchar first[4]);
+};
+
+//writer of Radiance .hdr images, the scanlines being run-length encoded as they are given
+class RGBEWriter {
+public:
+	RGBEWriter();
+	~RGBEWriter();
+
+	bool open(const char* path, int width, int height);
+	//returns false if fewer scanlines than the height were written or writing failed
+	bool close();
+
+	//encodes the next scanline, from the top, from width RGBA pixels of radiance
+	bool writeScanline(const float* rgba);
+
+private:
+	FILE* m_file;
+	int m_width, m_height;
+	int m_row;
+	bool m_failed;
+	std::vector<uchar> m_rgbe;	//the R, G, B and E planes of the scanline being encoded
+	std::vector<uchar> m_encoded;
+
+	void setPixel(int x, float r, float g, float b);
+	bool writeRGBE();
+};
+}
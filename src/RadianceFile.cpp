@@ -0,0 +1,184 @@
+// RadianceFile.cpp (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "RadianceFile.h"
+
+using namespace hdr;
+
+static inline bool littleEndian() {
+	const uint16_t one = 1;
+	return *(const uchar*) &one == 1;
+}
+
+static inline float swapBytes(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	bits = __builtin_bswap32(bits);
+	memcpy(&value, &bits, sizeof(bits));
+	return value;
+}
+
+RadianceFile::RadianceFile() {
+	m_map = NULL;
+	m_map_size = 0;
+	m_image.data = NULL;
+	m_image.width = m_image.height = 0;
+	m_in_place = false;
+}
+
+RadianceFile::~RadianceFile() {
+	close();
+}
+
+void RadianceFile::close() {
+	if (!m_in_place) free(m_image.data);
+	if (m_map) munmap(m_map, m_map_size);
+	m_map = NULL;
+	m_map_size = 0;
+	m_image.data = NULL;
+	m_image.width = m_image.height = 0;
+	m_in_place = false;
+}
+
+const RadianceImage& RadianceFile::image() const {
+	return m_image;
+}
+
+bool RadianceFile::inPlace() const {
+	return m_in_place;
+}
+
+bool RadianceFile::open(const char* path) {
+	close();
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size <= 0) {
+		::close(fd);
+		return false;
+	}
+
+	//a private mapping, so the pages stay those of the file unless something writes to them
+	m_map_size = st.st_size;
+	m_map = mmap(NULL, m_map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (m_map == MAP_FAILED) {
+		m_map = NULL;
+		return false;
+	}
+
+	const char* magic = (const char*) m_map;
+	bool ok = false;
+	if (m_map_size >= 2 && magic[0] == 'P' && (magic[1] == 'F' || magic[1] == 'f')) ok = openPFM();
+	else if (m_map_size >= strlen(RADIANCE_RAW_MAGIC) && !strncmp(magic, RADIANCE_RAW_MAGIC, strlen(RADIANCE_RAW_MAGIC))) ok = openRaw();
+	if (!ok) close();
+	return ok;
+}
+
+bool RadianceFile::openRaw() {
+	//the pixels are used as they are, so they must be in the byte order of the host
+	if (!littleEndian() || m_map_size < RADIANCE_RAW_HEADER) return false;
+
+	char header[RADIANCE_RAW_HEADER + 1];
+	memcpy(header, m_map, RADIANCE_RAW_HEADER);
+	header[RADIANCE_RAW_HEADER] = '\0';
+	int width, height;
+	if (sscanf(header, RADIANCE_RAW_MAGIC " %d %d", &width, &height) != 2 || width <= 0 || height <= 0) return false;
+	if ((m_map_size - RADIANCE_RAW_HEADER)/(sizeof(float)*NUM_CHANNELS)/width < (size_t) height) return false;
+
+	m_image.data = (float*) ((uchar*) m_map + RADIANCE_RAW_HEADER);
+	m_image.width = width;
+	m_image.height = height;
+	m_in_place = true;
+
+	//the filters read the whole image, so the kernel may as well start reading it ahead
+	madvise(m_map, RADIANCE_RAW_HEADER + (size_t) width*height*sizeof(float)*NUM_CHANNELS, MADV_WILLNEED);
+	return true;
+}
+
+bool RadianceFile::openPFM() {
+	//the header is "PF" or "Pf", the width, the height and the scale, each followed by a single whitespace character
+	const char* text = (const char*) m_map;
+	const char* end = text + m_map_size;
+	int channels = (text[1] == 'F') ? 3 : 1;
+	const char* p = text + 2;
+	char field[3][32];
+	for (int f = 0; f < 3; f++) {
+		while (p < end && isspace(*p)) p++;
+		int n = 0;
+		while (p < end && !isspace(*p) && n < 31) field[f][n++] = *p++;
+		field[f][n] = '\0';
+		if (p == end || !n) return false;
+	}
+	p++;
+
+	int width = atoi(field[0]);
+	int height = atoi(field[1]);
+	float scale = atof(field[2]);
+	if (width <= 0 || height <= 0 || scale == 0.f) return false;
+	size_t offset = p - text;
+	if ((m_map_size - offset)/(sizeof(float)*channels)/width < (size_t) height) return false;
+
+	//a negative scale marks little-endian floats, its magnitude being of no use to tone mapping
+	bool swap = (scale < 0.f) != littleEndian();
+	m_image.data = (float*) calloc((size_t) width*height*NUM_CHANNELS, sizeof(float));
+	if (!m_image.data) return false;
+	m_image.width = width;
+	m_image.height = height;
+	m_in_place = false;
+
+	const uchar* pixels = (const uchar*) m_map + offset;
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < height; y++) {
+		const uchar* src = pixels + (size_t) (height-1-y)*width*channels*sizeof(float);
+		float* dst = m_image.data + (size_t) y*width*NUM_CHANNELS;
+		for (int x = 0; x < width; x++) {
+			float rgb[3];
+			memcpy(rgb, src + (size_t) x*channels*sizeof(float), channels*sizeof(float));
+			for (int c = 0; c < 3; c++) {
+				float value = rgb[(channels == 3) ? c : 0];
+				dst[x*NUM_CHANNELS + c] = swap ? swapBytes(value) : value;
+			}
+			dst[x*NUM_CHANNELS + 3] = 1.f;
+		}
+	}
+
+	//the file has been read, the copy is the image from now on
+	munmap(m_map, m_map_size);
+	m_map = NULL;
+	m_map_size = 0;
+	return true;
+}
+
+bool RadianceFile::writeRaw(const char* path, const RadianceImage& image) {
+	if (!littleEndian() || !image.data) return false;
+	FILE* file = fopen(path, "wb");
+	if (!file) return false;
+
+	char header[RADIANCE_RAW_HEADER];
+	memset(header, ' ', RADIANCE_RAW_HEADER);
+	int length = snprintf(header, RADIANCE_RAW_HEADER, RADIANCE_RAW_MAGIC " %d %d", (int) image.width, (int) image.height);
+	header[length] = ' ';
+	header[RADIANCE_RAW_HEADER-1] = '\n';
+
+	size_t num_values = image.width*image.height*NUM_CHANNELS;
+	bool ok = fwrite(header, 1, RADIANCE_RAW_HEADER, file) == RADIANCE_RAW_HEADER
+		&& fwrite(image.data, sizeof(float), num_values, file) == num_values;
+	return (fclose(file) == 0) && ok;
+}
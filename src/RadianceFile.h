@@ -0,0 +1,49 @@
+// RadianceFile.h (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#pragma once
+
+#include <cstddef>
+
+#include "Filter.h"
+
+#define RADIANCE_RAW_HEADER 4096	//bytes of the header of raw radiance files, a page so the pixels are page aligned
+#define RADIANCE_RAW_MAGIC "RGBA32F"
+
+namespace hdr
+{
+//radiance images which are memory mapped rather than read, for large radiance maps
+//raw files are a text header "RGBA32F <width> <height>" padded with spaces to RADIANCE_RAW_HEADER bytes,
+//followed by the little-endian RGBA floats of the rows from the top, which is the RadianceImage layout,
+//so the image points into the mapping and the filters read the file in place, the pages being loaded as they are touched
+//PFM files hold RGB or grey rows from the bottom, so they are converted from the mapping to an RGBA image of opaque pixels
+class RadianceFile {
+public:
+	RadianceFile();
+	~RadianceFile();
+
+	//maps a .raw or .pfm file, returns false if it can't be mapped or isn't a radiance image
+	bool open(const char* path);
+	void close();
+
+	//valid until the file is closed, the pixels must not be written
+	const RadianceImage& image() const;
+	bool inPlace() const;	//whether the image is the mapping of the file rather than a copy
+
+	static bool writeRaw(const char* path, const RadianceImage& image);
+
+private:
+	void* m_map;
+	size_t m_map_size;
+	RadianceImage m_image;
+	bool m_in_place;
+
+	bool openRaw();
+	bool openPFM();
+};
+}
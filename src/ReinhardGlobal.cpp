@@ -6,7 +6,11 @@
 // license terms please see the LICENSE file distributed with this
 // source code.
 
+#include <algorithm>
+
 #include "ReinhardGlobal.h"
+#include "Native.h"
+#include "opencl/vector.h"
 #include "opencl/reinhardGlobal.h"
 
 using namespace hdr;
@@ -20,10 +24,11 @@ ReinhardGlobal::ReinhardGlobal(float _key, float _sat) : Filter() {
 bool ReinhardGlobal::setupOpenCL(cl_context_properties context_prop[], const Params& params) {
 
 	char flags[1024];
-	sprintf(flags, "-cl-fast-relaxed-math -D NUM_CHANNELS=%d -D WIDTH=%d -D HEIGHT=%d -D KEY=%f -D SAT=%f -D BUGGY_CL_GL=%d",
-				NUM_CHANNELS, img_size.x, img_size.y, key, sat, BUGGY_CL_GL);
+	sprintf(flags, "-cl-fast-relaxed-math -D NUM_CHANNELS=%d -D BUGGY_CL_GL=%d",
+				NUM_CHANNELS, BUGGY_CL_GL);
 
-	if (!initCL(context_prop, params, reinhardGlobal_kernel, flags)) return false;
+	std::string source = std::string(vector_kernel) + reinhardGlobal_kernel;
+	if (!initCL(context_prop, params, source.c_str(), flags)) return false;
 
 	cl_int err;
 
@@ -33,38 +38,37 @@ bool ReinhardGlobal::setupOpenCL(cl_context_properties context_prop[], const Par
 	kernels["computeLogAvgLum"] = clCreateKernel(m_program, "computeLogAvgLum", &err);
 	CHECK_ERROR_OCL(err, "creating computeLogAvgLum kernel", return false);
 
-	//this kernel computes log average luminance of the image
-	kernels["finalReduc"] = clCreateKernel(m_program, "finalReduc", &err);
-	CHECK_ERROR_OCL(err, "creating finalReduc kernel", return false);
-
 	//performs the reinhard global tone mapping operator
 	kernels["reinhardGlobal"] = clCreateKernel(m_program, "reinhardGlobal", &err);
 	CHECK_ERROR_OCL(err, "creating reinhardGlobal kernel", return false);
 
+	//tone maps with the luminance of the previous frame while computing that of this frame
+	kernels["reinhardGlobalFused"] = clCreateKernel(m_program, "reinhardGlobalFused", &err);
+	CHECK_ERROR_OCL(err, "creating reinhardGlobalFused kernel", return false);
+
 
 	/////////////////////////////////////////////////////////////////kernel sizes
 	reportStatus("\nKernels:");
 
-	kernel2DSizes("computeLogAvgLum");
-	kernel2DSizes("reinhardGlobal");
+	//the number of work groups sizes the reductions
+	kernel2DSizes("computeLogAvgLum", false, true);
+	kernel2DSizes("reinhardGlobal", true, true);
+	kernel2DSizes("reinhardGlobalFused", false, true);
 
-	reportStatus("---------------------------------Kernel finalReduc:");
+	if (!setupMemory()) return false;
+	if (!setupKernelArgs()) return false;
 
-		int num_wg = (global_sizes["computeLogAvgLum"][0]*global_sizes["computeLogAvgLum"][1])
-						/(local_sizes["computeLogAvgLum"][0]*local_sizes["computeLogAvgLum"][1]);
-		reportStatus("Number of work groups in computeLogAvgLum: %lu", num_wg);
-	
-		size_t* local = (size_t*) calloc(2, sizeof(size_t));
-		size_t* global = (size_t*) calloc(2, sizeof(size_t));
-		local[0] = num_wg;	//workgroup size for normal kernels
-		global[0] = num_wg;
-	
-		local_sizes["finalReduc"] = local;
-		global_sizes["finalReduc"] = global;
-		reportStatus("Kernel sizes: Local=%lu Global=%lu", local[0], global[0]);
+	reportStatus("\n");
 
+	return true;
+}
+
+bool ReinhardGlobal::setupMemory() {
+	cl_int err;
 
-	/////////////////////////////////////////////////////////////////allocating memory
+	//both reductions store the partial results of their work groups here
+	size_t num_wg = std::max(numWorkGroups("computeLogAvgLum"), numWorkGroups("reinhardGlobalFused"));
+	reportStatus("Number of work groups in the reductions: %lu", num_wg);
 
 	mems["logAvgLum"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(float)*num_wg, NULL, &err);
 	CHECK_ERROR_OCL(err, "creating logAvgLum memory", return false);
@@ -72,7 +76,17 @@ bool ReinhardGlobal::setupOpenCL(cl_context_properties context_prop[], const Par
 	mems["Lwhite"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(float)*num_wg, NULL, &err);
 	CHECK_ERROR_OCL(err, "creating Lwhite memory", return false);
 
-	if (params.opengl) {
+	//work groups which have finished the reduction, reset by the last one
+	cl_uint count = 0;
+	mems["count"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_uint), &count, &err);
+	CHECK_ERROR_OCL(err, "creating count memory", return false);
+
+	//log average luminance and Lwhite, which the fused kernel uses before they are first computed
+	float stats[2] = {1.f, 1.f};
+	mems["stats"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(stats), stats, &err);
+	CHECK_ERROR_OCL(err, "creating stats memory", return false);
+
+	if (m_params.opengl) {
 		mem_images[0] = clCreateFromGLTexture2D(m_clContext, CL_MEM_READ_ONLY, GL_TEXTURE_2D, 0, in_tex, &err);
 		CHECK_ERROR_OCL(err, "creating gl input texture", return false);
 		
@@ -82,72 +96,113 @@ bool ReinhardGlobal::setupOpenCL(cl_context_properties context_prop[], const Par
 	else {
 		cl_image_format format;
 		format.image_channel_order = CL_RGBA;
-		format.image_channel_data_type = CL_UNSIGNED_INT8;
+		format.image_channel_data_type = m_params.inputType;
 		mem_images[0] = clCreateImage2D(m_clContext, CL_MEM_READ_ONLY, &format, img_size.x, img_size.y, 0, NULL, &err);
 		CHECK_ERROR_OCL(err, "creating input image memory", return false);
-	
+
+		format.image_channel_data_type = CL_UNSIGNED_INT8;
 		mem_images[1] = clCreateImage2D(m_clContext, CL_MEM_WRITE_ONLY, &format, img_size.x, img_size.y, 0, NULL, &err);
 		CHECK_ERROR_OCL(err, "creating output image memory", return false);
 	}
 
-	/////////////////////////////////////////////////////////////////setting kernel arguements
+	return true;
+}
+
+void ReinhardGlobal::releaseMemory() {
+	clReleaseMemObject(mem_images[0]);
+	clReleaseMemObject(mem_images[1]);
+	clReleaseMemObject(mems["Lwhite"]);
+	clReleaseMemObject(mems["logAvgLum"]);
+	clReleaseMemObject(mems["count"]);
+	clReleaseMemObject(mems["stats"]);
+}
+
+bool ReinhardGlobal::setupKernelArgs() {
+	cl_int err;
 
 	err  = clSetKernelArg(kernels["computeLogAvgLum"], 0, sizeof(cl_mem), &mem_images[0]);
-	err  = clSetKernelArg(kernels["computeLogAvgLum"], 1, sizeof(cl_mem), &mems["logAvgLum"]);
-	err  = clSetKernelArg(kernels["computeLogAvgLum"], 2, sizeof(cl_mem), &mems["Lwhite"]);
-	err  = clSetKernelArg(kernels["computeLogAvgLum"], 3, sizeof(float*)*local_sizes["computeLogAvgLum"][0]*local_sizes["computeLogAvgLum"][1], NULL);
-	err  = clSetKernelArg(kernels["computeLogAvgLum"], 4, sizeof(float*)*local_sizes["computeLogAvgLum"][0]*local_sizes["computeLogAvgLum"][1], NULL);
+	err |= setReductionArgs("computeLogAvgLum", 1);
+	err |= clSetKernelArg(kernels["computeLogAvgLum"], 7, sizeof(cl_int2), &img_size);
 	CHECK_ERROR_OCL(err, "setting computeLogAvgLum arguments", return false);
 
-	err  = clSetKernelArg(kernels["finalReduc"], 0, sizeof(cl_mem), &mems["logAvgLum"]);
-	err  = clSetKernelArg(kernels["finalReduc"], 1, sizeof(cl_mem), &mems["Lwhite"]);
-	err  = clSetKernelArg(kernels["finalReduc"], 2, sizeof(unsigned int), &num_wg);
-	CHECK_ERROR_OCL(err, "setting finalReduc arguments", return false);
-
 	err  = clSetKernelArg(kernels["reinhardGlobal"], 0, sizeof(cl_mem), &mem_images[0]);
-	err  = clSetKernelArg(kernels["reinhardGlobal"], 1, sizeof(cl_mem), &mem_images[1]);
-	err  = clSetKernelArg(kernels["reinhardGlobal"], 2, sizeof(cl_mem), &mems["logAvgLum"]);
-	err  = clSetKernelArg(kernels["reinhardGlobal"], 3, sizeof(cl_mem), &mems["Lwhite"]);
+	err |= clSetKernelArg(kernels["reinhardGlobal"], 1, sizeof(cl_mem), &mem_images[1]);
+	err |= clSetKernelArg(kernels["reinhardGlobal"], 2, sizeof(cl_mem), &mems["stats"]);
+	err |= clSetKernelArg(kernels["reinhardGlobal"], 3, sizeof(cl_int2), &img_size);
+	err |= clSetKernelArg(kernels["reinhardGlobal"], 4, sizeof(float), &key);
+	err |= clSetKernelArg(kernels["reinhardGlobal"], 5, sizeof(float), &sat);
 	CHECK_ERROR_OCL(err, "setting globalTMO arguments", return false);
 
-	reportStatus("\n");
+	err  = clSetKernelArg(kernels["reinhardGlobalFused"], 0, sizeof(cl_mem), &mem_images[0]);
+	err |= clSetKernelArg(kernels["reinhardGlobalFused"], 1, sizeof(cl_mem), &mem_images[1]);
+	err |= setReductionArgs("reinhardGlobalFused", 2);
+	err |= clSetKernelArg(kernels["reinhardGlobalFused"], 8, sizeof(cl_int2), &img_size);
+	err |= clSetKernelArg(kernels["reinhardGlobalFused"], 9, sizeof(float), &key);
+	err |= clSetKernelArg(kernels["reinhardGlobalFused"], 10, sizeof(float), &sat);
+	CHECK_ERROR_OCL(err, "setting reinhardGlobalFused arguments", return false);
 
 	return true;
 }
 
-double ReinhardGlobal::runCLKernels(bool recomputeMapping) {
-	double start = omp_get_wtime();
+//the six arguments of reduceLogAvgLum following the image arguments of a kernel
+cl_int ReinhardGlobal::setReductionArgs(const char* name, cl_uint first) {
+	size_t local_mem = sizeof(float)*local_sizes[name][0]*local_sizes[name][1];
+	cl_int err;
+	err  = clSetKernelArg(kernels[name], first,   sizeof(cl_mem), &mems["logAvgLum"]);
+	err |= clSetKernelArg(kernels[name], first+1, sizeof(cl_mem), &mems["Lwhite"]);
+	err |= clSetKernelArg(kernels[name], first+2, local_mem, NULL);
+	err |= clSetKernelArg(kernels[name], first+3, local_mem, NULL);
+	err |= clSetKernelArg(kernels[name], first+4, sizeof(cl_mem), &mems["count"]);
+	err |= clSetKernelArg(kernels[name], first+5, sizeof(cl_mem), &mems["stats"]);
+	return err;
+}
+
+size_t ReinhardGlobal::numWorkGroups(const char* name) {
+	return (global_sizes[name][0]*global_sizes[name][1])/(local_sizes[name][0]*local_sizes[name][1]);
+}
+
+bool ReinhardGlobal::setParameter(const char* name, float value) {
+	if (!strcmp(name, "key")) key = value;
+	else if (!strcmp(name, "sat")) sat = value;
+	else return false;
 
+	clearReferenceCache();
+	if (m_program) return setupKernelArgs();
+	return true;
+}
+
+bool ReinhardGlobal::enqueueCLKernels(bool recomputeMapping) {
 	cl_int err;
-	err = clEnqueueNDRangeKernel(m_queue, kernels["computeLogAvgLum"], 2, NULL, global_sizes["computeLogAvgLum"], local_sizes["computeLogAvgLum"], 0, NULL, NULL);
-	CHECK_ERROR_OCL(err, "enqueuing computeLogAvgLum kernel", return false);
 
-	err = clEnqueueNDRangeKernel(m_queue, kernels["finalReduc"], 1, NULL, &global_sizes["finalReduc"][0], &local_sizes["finalReduc"][0], 0, NULL, NULL);
-	CHECK_ERROR_OCL(err, "enqueuing finalReduc kernel", return false);
+	//the luminance of the previous frame is good enough when the mapping need not be recomputed
+	if (!recomputeMapping) {
+		err = enqueueKernel("reinhardGlobalFused", 2);
+		CHECK_ERROR_OCL(err, "enqueuing reinhardGlobalFused kernel", return false);
+		return true;
+	}
 
-	err = clEnqueueNDRangeKernel(m_queue, kernels["reinhardGlobal"], 2, NULL, global_sizes["reinhardGlobal"], local_sizes["reinhardGlobal"], 0, NULL, NULL);
-	CHECK_ERROR_OCL(err, "enqueuing transfer_data kernel", return false);
+	err = enqueueKernel("computeLogAvgLum", 2);
+	CHECK_ERROR_OCL(err, "enqueuing computeLogAvgLum kernel", return false);
 
-	err = clFinish(m_queue);
-	CHECK_ERROR_OCL(err, "running kernels", return false);
-	return omp_get_wtime() - start;	
+	err = enqueueKernel("reinhardGlobal", 2);
+	CHECK_ERROR_OCL(err, "enqueuing reinhardGlobal kernel", return false);
+
+	return true;
 }
 
 
 bool ReinhardGlobal::cleanupOpenCL() {
-	clReleaseMemObject(mem_images[0]);
-	clReleaseMemObject(mem_images[1]);
-	clReleaseMemObject(mems["Lwhite"]);
-	clReleaseMemObject(mems["logAvgLum"]);
+	releaseMemory();
 	clReleaseKernel(kernels["computeLogAvgLum"]);
-	clReleaseKernel(kernels["finalReduc"]);
 	clReleaseKernel(kernels["reinhardGlobal"]);
+	clReleaseKernel(kernels["reinhardGlobalFused"]);
 	releaseCL();
 	return true;
 }
 
 
-bool ReinhardGlobal::runReference(uchar* input, uchar* output) {
+template <typename T>
+bool ReinhardGlobal::reference(T* input, uchar* output) {
 
 	// Check for cached result
 	if (m_reference.data) {
@@ -157,41 +212,49 @@ bool ReinhardGlobal::runReference(uchar* input, uchar* output) {
 	}
 
 	reportStatus("Running reference");
-
-	float logAvgLum = 0.f;
-	float Lwhite = 0.f;	//smallest luminance that'll be mapped to pure white
-
-	int2 pos;
-	for (pos.y = 0; pos.y < img_size.y; pos.y++) {
-		for (pos.x = 0; pos.x < img_size.x; pos.x++) {
-			float lum = getPixelLuminance(input, img_size, pos);
+	ImageView<T, NUM_CHANNELS> in_image(input, img_size);
+	PixelView out_image(output, img_size);
+
+	//log average and maximum luminance of each row, reduced in a fixed order so the result doesn't depend on the threads
+	std::vector<double> row_logAvgLum(img_size.y);
+	std::vector<float> row_Lwhite(img_size.y);
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		double logAvgLum = 0;
+		float Lwhite = 0.f;
+		T* in = in_image.row(y);
+		for (int x = 0; x < img_size.x; x++) {
+			float lum = getLuminance(in + x*NUM_CHANNELS);
 			logAvgLum += log(lum + 0.000001);
 
 			if (lum > Lwhite) Lwhite = lum;
 		}
+		row_logAvgLum[y] = logAvgLum;
+		row_Lwhite[y] = Lwhite;
 	}
-	logAvgLum = exp(logAvgLum/(img_size.x*img_size.y));
+	float logAvgLum = exp(pairwiseSum(&row_logAvgLum[0], img_size.y)/(img_size.x*img_size.y));
+	float Lwhite = *std::max_element(row_Lwhite.begin(), row_Lwhite.end());	//smallest luminance that'll be mapped to pure white
 
 	//Global Tone-mapping operator
-	for (pos.y = 0; pos.y < img_size.y; pos.y++) {
-		for (pos.x = 0; pos.x < img_size.x; pos.x++) {
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		T* in = in_image.row(y);
+		uchar* out = out_image.row(y);
+		for (int x = 0; x < img_size.x; x++) {
 			float3 rgb, xyz;
-			rgb.x = getPixel(input, img_size, pos, 0);
-			rgb.y = getPixel(input, img_size, pos, 1);
-			rgb.z = getPixel(input, img_size, pos, 2);
+			rgb = getColour(in + x*NUM_CHANNELS);
 
 			xyz = RGBtoXYZ(rgb);
 
 			float L  = (key/logAvgLum) * xyz.y;
 			float Ld = (L * (1.f + L/(Lwhite * Lwhite)) )/(1.f + L);
 
-			rgb.x = pow(rgb.x/xyz.y, sat) * Ld;
-			rgb.y = pow(rgb.y/xyz.y, sat) * Ld;
-			rgb.z = pow(rgb.z/xyz.y, sat) * Ld;
+			rgb.x = pow(rgb.x/xyz.y, sat) * Ld*PIXEL_RANGE;
+			rgb.y = pow(rgb.y/xyz.y, sat) * Ld*PIXEL_RANGE;
+			rgb.z = pow(rgb.z/xyz.y, sat) * Ld*PIXEL_RANGE;
 
-			setPixel(output, img_size, pos, 0, rgb.x*PIXEL_RANGE);
-			setPixel(output, img_size, pos, 1, rgb.y*PIXEL_RANGE);
-			setPixel(output, img_size, pos, 2, rgb.z*PIXEL_RANGE);
+			setColour(out + x*NUM_CHANNELS, rgb);
 		}
 	}
 
@@ -204,4 +267,74 @@ bool ReinhardGlobal::runReference(uchar* input, uchar* output) {
 	memcpy(m_reference.data, output, img_size.x*img_size.y*NUM_CHANNELS);
 
 	return true;
-}
\ No newline at end of file
+}
+
+template <typename T>
+bool ReinhardGlobal::native(T* input, uchar* output) {
+	reportStatus("Running native");
+
+	//log average and maximum luminance of each row, reduced in a fixed order so the result doesn't depend on the threads
+	std::vector<double> row_logAvgLum(img_size.y);
+	std::vector<float> row_Lwhite(img_size.y);
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		T* in = input + y*img_size.x*NUM_CHANNELS;
+		floatv logAvgLum = 0.f;
+		floatv Lwhite = 0.f;
+		for (int x = 0; x < img_size.x; x += NATIVE_WIDTH) {
+			int n = std::min(NATIVE_WIDTH, img_size.x-x);
+			floatv r, g, b;
+			load_pixels(in + x*NUM_CHANNELS, n, &r, &g, &b);
+			floatv lum = luminance(r, g, b);
+			logAvgLum = logAvgLum + vlog(lum + 0.000001f)*lane_mask(n);
+			Lwhite = vmax(Lwhite, lum);
+		}
+		row_logAvgLum[y] = sum_lanes(logAvgLum);
+		row_Lwhite[y] = max_lanes(Lwhite);
+	}
+
+	float logAvgLum = exp(pairwiseSum(&row_logAvgLum[0], img_size.y)/(img_size.x*img_size.y));
+	float Lwhite = *std::max_element(row_Lwhite.begin(), row_Lwhite.end());	//smallest luminance that'll be mapped to pure white
+
+	//Global Tone-mapping operator
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		T* in = input + y*img_size.x*NUM_CHANNELS;
+		uchar* out = output + y*img_size.x*NUM_CHANNELS;
+		for (int x = 0; x < img_size.x; x += NATIVE_WIDTH) {
+			int n = std::min(NATIVE_WIDTH, img_size.x-x);
+			floatv r, g, b;
+			load_pixels(in + x*NUM_CHANNELS, n, &r, &g, &b);
+			floatv Y = luminance(r, g, b);
+
+			floatv L  = Y*(key/logAvgLum);
+			floatv Ld = (L*(L/(Lwhite*Lwhite) + 1.f))/(L + 1.f)*PIXEL_RANGE;
+
+			store_pixels(out + x*NUM_CHANNELS, n,
+				clamp_colour(vpow(r/Y, sat)*Ld),
+				clamp_colour(vpow(g/Y, sat)*Ld),
+				clamp_colour(vpow(b/Y, sat)*Ld));
+		}
+	}
+
+	reportStatus("Finished native");
+
+	return true;
+}
+
+bool ReinhardGlobal::runReference(uchar* input, uchar* output) {
+	return reference(input, output);
+}
+
+bool ReinhardGlobal::runReference(float* input, uchar* output) {
+	return reference(input, output);
+}
+
+bool ReinhardGlobal::runNative(uchar* input, uchar* output) {
+	return native(input, output);
+}
+
+bool ReinhardGlobal::runNative(float* input, uchar* output) {
+	return native(input, output);
+}
@@ -15,11 +15,24 @@ public:
 	ReinhardGlobal(float _key=0.18f, float _sat=1.6f);
 
 	virtual bool setupOpenCL(cl_context_properties context_prop[], const Params& params);
-	virtual double runCLKernels(bool recomputeMapping);
+	virtual bool enqueueCLKernels(bool recomputeMapping);
 	virtual bool cleanupOpenCL();
 	virtual bool runReference(uchar* input, uchar* output);
+	virtual bool runReference(float* input, uchar* output);
+	virtual bool runNative(uchar* input, uchar* output);
+	virtual bool runNative(float* input, uchar* output);
+	virtual bool setParameter(const char* name, float value);
 
 protected:
+	virtual bool setupMemory();
+	virtual void releaseMemory();
+	virtual bool setupKernelArgs();
+	//runReference and runNative for 8-bit and radiance input
+	template <typename T> bool reference(T* input, uchar* output);
+	template <typename T> bool native(T* input, uchar* output);
+	cl_int setReductionArgs(const char* name, cl_uint first);
+	size_t numWorkGroups(const char* name);
+
 	float key;	//increase this to allow for more contrast in the darker regions
 	float sat;	//increase this for more colourful pictures
 };
@@ -14,6 +14,9 @@
 #include <vector>
 
 #include "ReinhardLocal.h"
+#include "Native.h"
+#include "opencl/vector.h"
+#include "opencl/mipmap.h"
 #include "opencl/reinhardLocal.h"
 
 using namespace hdr;
@@ -25,15 +28,18 @@ ReinhardLocal::ReinhardLocal(float _key, float _sat, float _epsilon, float _phi)
 	epsilon = _epsilon;
 	phi = _phi;
 	num_mipmaps = 8;
+	m_store_mapping = false;
+	m_mapping_stored = false;
 }
 
 bool ReinhardLocal::setupOpenCL(cl_context_properties context_prop[], const Params& params) {
 
 	char flags[1024];
-	sprintf(flags, "-cl-fast-relaxed-math -D NUM_CHANNELS=%d -D WIDTH=%d -D HEIGHT=%d -D NUM_MIPMAPS=%d -D KEY=%f -D SAT=%f -D EPSILON=%f -D PHI=%f -D BUGGY_CL_GL=%d",
-				NUM_CHANNELS, img_size.x, img_size.y, num_mipmaps, key, sat, epsilon, phi, BUGGY_CL_GL);
+	sprintf(flags, "-cl-fast-relaxed-math -D NUM_CHANNELS=%d -D NUM_MIPMAPS=%d -D BUGGY_CL_GL=%d",
+				NUM_CHANNELS, num_mipmaps, BUGGY_CL_GL);
 
-	if (!initCL(context_prop, params, reinhardLocal_kernel, flags)) {
+	std::string source = std::string(vector_kernel) + mipmap_kernel + reinhardLocal_kernel;
+	if (!initCL(context_prop, params, source.c_str(), flags)) {
 		return false;
 	}
 
@@ -45,29 +51,29 @@ bool ReinhardLocal::setupOpenCL(cl_context_properties context_prop[], const Para
 	kernels["computeLogAvgLum"] = clCreateKernel(m_program, "computeLogAvgLum", &err);
 	CHECK_ERROR_OCL(err, "creating computeLogAvgLum kernel", return false);
 
-	//computes the next mipmap level of the provided data
-	kernels["channel_mipmap"] = clCreateKernel(m_program, "channel_mipmap", &err);
-	CHECK_ERROR_OCL(err, "creating channel_mipmap kernel", return false);
+	//computes the mipmap levels of the luminance, several at a time
+	kernels["mipmap_pyramid"] = clCreateKernel(m_program, "mipmap_pyramid", &err);
+	CHECK_ERROR_OCL(err, "creating mipmap_pyramid kernel", return false);
 
 	//this kernel computes log average luminance of the image
 	kernels["finalReduc"] = clCreateKernel(m_program, "finalReduc", &err);
 	CHECK_ERROR_OCL(err, "creating finalReduc kernel", return false);
 
-	//computes the operation to be applied to each pixel
+	//computes the operation to be applied to each pixel and applies it
 	kernels["reinhardLocal"] = clCreateKernel(m_program, "reinhardLocal", &err);
 	CHECK_ERROR_OCL(err, "creating reinhardLocal kernel", return false);
 
-	//performs the actual tonemapping using the Ld_array computed in the previous function
+	//performs the actual tonemapping using the Ld_array stored by reinhardLocal
 	kernels["tonemap"] = clCreateKernel(m_program, "tonemap", &err);
 	CHECK_ERROR_OCL(err, "creating tonemap kernel", return false);
 
 	/////////////////////////////////////////////////////////////////kernel sizes
 	reportStatus("\nKernels:");
 
-	kernel2DSizes("computeLogAvgLum");
-	kernel2DSizes("channel_mipmap");
-	kernel2DSizes("reinhardLocal");
-	kernel2DSizes("tonemap");
+	kernel2DSizes("computeLogAvgLum", false, true);	//the number of work groups sizes the reduction
+	kernel2DSizes("mipmap_pyramid", false);	//the work groups hold a tile in local memory
+	kernel2DSizes("reinhardLocal", true, true);
+	kernel2DSizes("tonemap", true, true);
 
 
 	reportStatus("---------------------------------Kernel finalReduc:");
@@ -85,8 +91,16 @@ bool ReinhardLocal::setupOpenCL(cl_context_properties context_prop[], const Para
 		global_sizes["finalReduc"] = global;
 		reportStatus("Kernel sizes: Local=%lu Global=%lu", local[0], global[0]);
 
+	if (!setupMemory()) return false;
+	if (!setupKernelArgs()) return false;
 
-	/////////////////////////////////////////////////////////////////allocating memory
+	reportStatus("\n\n");
+
+	return true;
+}
+
+bool ReinhardLocal::setupMemory() {
+	cl_int err;
 
 	//initialising information regarding all mipmap levels
 	m_width = (int*) calloc(num_mipmaps, sizeof(int));
@@ -115,13 +129,14 @@ bool ReinhardLocal::setupOpenCL(cl_context_properties context_prop[], const Para
 	mems["m_offset"] = clCreateBuffer(m_clContext, CL_MEM_COPY_HOST_PTR, sizeof(int)*num_mipmaps, m_offset, &err);
 	CHECK_ERROR_OCL(err, "creating m_offset memory", return false);
 
-	mems["logAvgLum"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(float)*num_wg, NULL, &err);
+	mems["logAvgLum"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(float)*global_sizes["finalReduc"][0], NULL, &err);
 	CHECK_ERROR_OCL(err, "creating logAvgLum memory", return false);
 
 	mems["Ld_array"] = clCreateBuffer(m_clContext, CL_MEM_READ_WRITE, sizeof(float)*img_size.x*img_size.y, NULL, &err);
 	CHECK_ERROR_OCL(err, "creating Ld_array memory", return false);
+	m_mapping_stored = false;
 
-	if (params.opengl) {
+	if (m_params.opengl) {
 		mem_images[0] = clCreateFromGLTexture2D(m_clContext, CL_MEM_READ_ONLY, GL_TEXTURE_2D, 0, in_tex, &err);
 		CHECK_ERROR_OCL(err, "creating gl input texture", return false);
 		
@@ -131,94 +146,130 @@ bool ReinhardLocal::setupOpenCL(cl_context_properties context_prop[], const Para
 	else {
 		cl_image_format format;
 		format.image_channel_order = CL_RGBA;
-		format.image_channel_data_type = CL_UNSIGNED_INT8;
+		format.image_channel_data_type = m_params.inputType;
 		mem_images[0] = clCreateImage2D(m_clContext, CL_MEM_READ_ONLY, &format, img_size.x, img_size.y, 0, NULL, &err);
 		CHECK_ERROR_OCL(err, "creating input image memory", return false);
-	
+
+		format.image_channel_data_type = CL_UNSIGNED_INT8;
 		mem_images[1] = clCreateImage2D(m_clContext, CL_MEM_WRITE_ONLY, &format, img_size.x, img_size.y, 0, NULL, &err);
 		CHECK_ERROR_OCL(err, "creating output image memory", return false);
 	}
 
-	/////////////////////////////////////////////////////////////////setting kernel arguements
+	return true;
+}
+
+void ReinhardLocal::releaseMemory() {
+	clReleaseMemObject(mem_images[0]);
+	clReleaseMemObject(mem_images[1]);
+	clReleaseMemObject(mems["Ld_array"]);
+	clReleaseMemObject(mems["lumMips"]);
+	clReleaseMemObject(mems["m_width"]);
+	clReleaseMemObject(mems["m_height"]);
+	clReleaseMemObject(mems["m_offset"]);
+	clReleaseMemObject(mems["logAvgLum"]);
+	free(m_width);
+	free(m_height);
+	free(m_offset);
+}
+
+bool ReinhardLocal::setupKernelArgs() {
+	cl_int err;
 
 	err  = clSetKernelArg(kernels["computeLogAvgLum"], 0, sizeof(cl_mem), &mem_images[0]);
 	err  = clSetKernelArg(kernels["computeLogAvgLum"], 1, sizeof(cl_mem), &mems["lumMips"]);
 	err  = clSetKernelArg(kernels["computeLogAvgLum"], 2, sizeof(cl_mem), &mems["logAvgLum"]);
 	err  = clSetKernelArg(kernels["computeLogAvgLum"], 3, sizeof(float*)*local_sizes["computeLogAvgLum"][0]*local_sizes["computeLogAvgLum"][1], NULL);
+	err  = clSetKernelArg(kernels["computeLogAvgLum"], 4, sizeof(cl_int2), &img_size);
 	CHECK_ERROR_OCL(err, "setting computeLogAvgLum arguments", return false);
 
-	err  = clSetKernelArg(kernels["channel_mipmap"], 0, sizeof(cl_mem), &mems["lumMips"]);
-	CHECK_ERROR_OCL(err, "setting channel_mipmap arguments", return false);
+	err  = clSetKernelArg(kernels["mipmap_pyramid"], 0, sizeof(cl_mem), &mems["lumMips"]);
+	err  = clSetKernelArg(kernels["mipmap_pyramid"], 1, sizeof(cl_mem), &mems["m_width"]);
+	err  = clSetKernelArg(kernels["mipmap_pyramid"], 2, sizeof(cl_mem), &mems["m_height"]);
+	err  = clSetKernelArg(kernels["mipmap_pyramid"], 3, sizeof(cl_mem), &mems["m_offset"]);
+	CHECK_ERROR_OCL(err, "setting mipmap_pyramid arguments", return false);
 
 	err  = clSetKernelArg(kernels["finalReduc"], 0, sizeof(cl_mem), &mems["logAvgLum"]);
+	unsigned int num_wg = global_sizes["finalReduc"][0];
 	err  = clSetKernelArg(kernels["finalReduc"], 1, sizeof(unsigned int), &num_wg);
+	err  = clSetKernelArg(kernels["finalReduc"], 2, sizeof(cl_int2), &img_size);
 	CHECK_ERROR_OCL(err, "setting finalReduc arguments", return false);
 
-	err  = clSetKernelArg(kernels["reinhardLocal"], 0, sizeof(cl_mem), &mems["Ld_array"]);
-	err  = clSetKernelArg(kernels["reinhardLocal"], 1, sizeof(cl_mem), &mems["lumMips"]);
-	err  = clSetKernelArg(kernels["reinhardLocal"], 2, sizeof(cl_mem), &mems["m_width"]);
-	err  = clSetKernelArg(kernels["reinhardLocal"], 3, sizeof(cl_mem), &mems["m_offset"]);
-	err  = clSetKernelArg(kernels["reinhardLocal"], 4, sizeof(cl_mem), &mems["logAvgLum"]);
+	err  = clSetKernelArg(kernels["reinhardLocal"], 0, sizeof(cl_mem), &mem_images[0]);
+	err  = clSetKernelArg(kernels["reinhardLocal"], 1, sizeof(cl_mem), &mem_images[1]);
+	err  = clSetKernelArg(kernels["reinhardLocal"], 2, sizeof(cl_mem), &mems["Ld_array"]);
+	err  = clSetKernelArg(kernels["reinhardLocal"], 3, sizeof(cl_mem), &mems["lumMips"]);
+	err  = clSetKernelArg(kernels["reinhardLocal"], 4, sizeof(cl_mem), &mems["m_width"]);
+	err  = clSetKernelArg(kernels["reinhardLocal"], 5, sizeof(cl_mem), &mems["m_offset"]);
+	err  = clSetKernelArg(kernels["reinhardLocal"], 6, sizeof(cl_mem), &mems["logAvgLum"]);
+	err  = clSetKernelArg(kernels["reinhardLocal"], 7, sizeof(cl_int2), &img_size);
+	err  = clSetKernelArg(kernels["reinhardLocal"], 8, sizeof(float), &key);
+	err  = clSetKernelArg(kernels["reinhardLocal"], 9, sizeof(float), &sat);
+	err  = clSetKernelArg(kernels["reinhardLocal"], 10, sizeof(float), &epsilon);
+	err  = clSetKernelArg(kernels["reinhardLocal"], 11, sizeof(float), &phi);
 	CHECK_ERROR_OCL(err, "setting reinhardLocal arguments", return false);
 
 	err  = clSetKernelArg(kernels["tonemap"], 0, sizeof(cl_mem), &mem_images[0]);
 	err  = clSetKernelArg(kernels["tonemap"], 1, sizeof(cl_mem), &mem_images[1]);
 	err  = clSetKernelArg(kernels["tonemap"], 2, sizeof(cl_mem), &mems["Ld_array"]);
+	err  = clSetKernelArg(kernels["tonemap"], 3, sizeof(cl_int2), &img_size);
+	err  = clSetKernelArg(kernels["tonemap"], 4, sizeof(float), &sat);
 	CHECK_ERROR_OCL(err, "setting tonemap arguments", return false);
 
-	reportStatus("\n\n");
-
 	return true;
 }
 
-double ReinhardLocal::runCLKernels(bool recomputeMapping) {
-	double start = omp_get_wtime();
+bool ReinhardLocal::setParameter(const char* name, float value) {
+	if (!strcmp(name, "key")) key = value;
+	else if (!strcmp(name, "sat")) sat = value;
+	else if (!strcmp(name, "epsilon")) epsilon = value;
+	else if (!strcmp(name, "phi")) phi = value;
+	else return false;
+
+	if (strcmp(name, "sat")) m_mapping_stored = false;	//the stored mappings don't depend on the saturation
+	clearReferenceCache();
+	if (m_program) return setupKernelArgs();
+	return true;
+}
 
+bool ReinhardLocal::enqueueCLKernels(bool recomputeMapping) {
 	cl_int err;
+
+	//the mappings are only stored once a frame asks to reuse them, from then on every recomputed frame stores them
+	if (!recomputeMapping && !m_mapping_stored) {
+		m_store_mapping = true;
+		recomputeMapping = true;
+	}
+
 	if (recomputeMapping) {
-		err = clEnqueueNDRangeKernel(m_queue, kernels["computeLogAvgLum"], 2, NULL, global_sizes["computeLogAvgLum"], local_sizes["computeLogAvgLum"], 0, NULL, NULL);
+		err = enqueueKernel("computeLogAvgLum", 2);
 		CHECK_ERROR_OCL(err, "enqueuing computeLogAvgLum kernel", return false);
 	
-		err = clEnqueueNDRangeKernel(m_queue, kernels["finalReduc"], 1, NULL, &global_sizes["finalReduc"][0], &local_sizes["finalReduc"][0], 0, NULL, NULL);
+		err = enqueueKernel("finalReduc", 1);
 		CHECK_ERROR_OCL(err, "enqueuing finalReduc kernel", return false);
 	
 		//creating mipmaps
-		for (int level=1; level<num_mipmaps; level++) {
-			err  = clSetKernelArg(kernels["channel_mipmap"], 1, sizeof(int), &m_width[level-1]);
-			err  = clSetKernelArg(kernels["channel_mipmap"], 2, sizeof(int), &m_offset[level-1]);
-			err  = clSetKernelArg(kernels["channel_mipmap"], 3, sizeof(int), &m_width[level]);
-			err  = clSetKernelArg(kernels["channel_mipmap"], 4, sizeof(int), &m_height[level]);
-			err  = clSetKernelArg(kernels["channel_mipmap"], 5, sizeof(int), &m_offset[level]);
-			CHECK_ERROR_OCL(err, "setting channel_mipmap arguments", return false);
-	
-			err = clEnqueueNDRangeKernel(m_queue, kernels["channel_mipmap"], 2, NULL, global_sizes["channel_mipmap"], local_sizes["channel_mipmap"], 0, NULL, NULL);
-			CHECK_ERROR_OCL(err, "enqueuing channel_mipmap kernel", return false);
-		}
-	
-		err = clEnqueueNDRangeKernel(m_queue, kernels["reinhardLocal"], 2, NULL, global_sizes["reinhardLocal"], local_sizes["reinhardLocal"], 0, NULL, NULL);
-		CHECK_ERROR_OCL(err, "enqueuing reinhardLocal kernel", return false);
-	}
+		if (!enqueueMipmapPyramid(num_mipmaps)) return false;
 
-	err = clEnqueueNDRangeKernel(m_queue, kernels["tonemap"], 2, NULL, global_sizes["tonemap"], local_sizes["tonemap"], 0, NULL, NULL);
-	CHECK_ERROR_OCL(err, "enqueuing tonemap kernel", return false);
+		int store_mapping = m_store_mapping;
+		err  = clSetKernelArg(kernels["reinhardLocal"], 12, sizeof(int), &store_mapping);
+		CHECK_ERROR_OCL(err, "setting reinhardLocal arguments", return false);
 
-	err = clFinish(m_queue);
+		err = enqueueKernel("reinhardLocal", 2);
+		CHECK_ERROR_OCL(err, "enqueuing reinhardLocal kernel", return false);
+		m_mapping_stored = m_store_mapping;
+	}
+	else {
+		err = enqueueKernel("tonemap", 2);
+		CHECK_ERROR_OCL(err, "enqueuing tonemap kernel", return false);
+	}
 
-	CHECK_ERROR_OCL(err, "running kernels", return false);
-	return omp_get_wtime() - start;	
+	return true;
 }
 
 bool ReinhardLocal::cleanupOpenCL() {
-	clReleaseMemObject(mem_images[0]);
-	clReleaseMemObject(mem_images[1]);
-	clReleaseMemObject(mems["Ld_array"]);
-	clReleaseMemObject(mems["lumMips"]);
-	clReleaseMemObject(mems["m_width"]);
-	clReleaseMemObject(mems["m_height"]);
-	clReleaseMemObject(mems["m_offset"]);
-	clReleaseMemObject(mems["logAvgLum"]);
+	releaseMemory();
 	clReleaseKernel(kernels["computeLogAvgLum"]);
-	clReleaseKernel(kernels["channel_mipmap"]);
+	clReleaseKernel(kernels["mipmap_pyramid"]);
 	clReleaseKernel(kernels["finalReduc"]);
 	clReleaseKernel(kernels["reinhardLocal"]);
 	clReleaseKernel(kernels["tonemap"]);
@@ -227,7 +278,8 @@ bool ReinhardLocal::cleanupOpenCL() {
 }
 
 
-bool ReinhardLocal::runReference(uchar* input, uchar* output) {
+template <typename T>
+bool ReinhardLocal::reference(T* input, uchar* output) {
 
 	// Check for cached result
 	if (m_reference.data) {
@@ -244,32 +296,43 @@ bool ReinhardLocal::runReference(uchar* input, uchar* output) {
 	mipmap_sizes[0] = img_size;
 
 
-	float logAvgLum = 0.f;
-	float lum = 0.f;
-	int2 pos;
+	//log average luminance of each row, reduced in a fixed order so the result doesn't depend on the threads
+	std::vector<double> row_logAvgLum(img_size.y);
 	mipmap_pyramid[0] = (float*) calloc(img_size.x*img_size.y, sizeof(float));
-	for (pos.y = 0; pos.y < img_size.y; pos.y++) {
-		for (pos.x = 0; pos.x < img_size.x; pos.x++) {
-			lum = getPixelLuminance(input, img_size, pos);
-			mipmap_pyramid[0][pos.x + pos.y*img_size.x] = lum; 
+	ImageView<T, NUM_CHANNELS> in_image(input, img_size);
+	PixelView out_image(output, img_size);
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		double logAvgLum = 0;
+		T* in = in_image.row(y);
+		float* lum_row = mipmap_pyramid[0] + y*img_size.x;
+		for (int x = 0; x < img_size.x; x++) {
+			float lum = getLuminance(in + x*NUM_CHANNELS);
+			lum_row[x] = lum;
 			logAvgLum += log(lum + 0.000001);
 		}
+		row_logAvgLum[y] = logAvgLum;
 	}
-	logAvgLum = exp(logAvgLum/((float)(img_size.x*img_size.y)));
+	float logAvgLum = exp(pairwiseSum(&row_logAvgLum[0], img_size.y)/(img_size.x*img_size.y));
 
 	float factor = key/logAvgLum;
 
-	float scale_sq[num_mipmaps-1];
-	float k[num_mipmaps-1];	//product of multiple constants
+	float k[num_mipmaps-1];	//product of multiple constants, k[i] being used to compare levels i and i+1
 	for (int i=1; i<num_mipmaps; i++) {
 		mipmap_pyramid[i] = mipmap(mipmap_pyramid[i-1], mipmap_sizes[i-1]);
 		mipmap_sizes[i] = (int2){mipmap_sizes[i-1].x/2, mipmap_sizes[i-1].y/2};
-		k[i] = pow(2.f, phi)*key/pow(pow(2, i-1), 2);
+		k[i-1] = pow(2.f, phi)*key/pow(pow(2, i-1), 2);
 	}
-
-	int2 centre;
-	int2 surround;
-	for (pos.y = 0; pos.y < img_size.y; pos.y++) {
+	//the centre and surround of the pixels at the right and bottom edges may be past odd sized levels
+	std::vector<ValueView> levels;
+	for (int i=0; i<num_mipmaps; i++) levels.push_back(ValueView(mipmap_pyramid[i], mipmap_sizes[i]));
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		T* in = in_image.row(y);
+		uchar* out = out_image.row(y);
+		int2 pos, centre, surround;
+		pos.y = y;
 		for (pos.x = 0; pos.x < img_size.x; pos.x++) {
 
 			float local_logAvgLum = 0.f;
@@ -283,8 +346,8 @@ bool ReinhardLocal::runReference(uchar* input, uchar* output) {
 				surround.x = centre.x/2;
 				surround.y = centre.y/2;
 
-				centre_logAvgLum = getValue(mipmap_pyramid[i], mipmap_sizes[i], centre)*factor;
-				surround_logAvgLum = getValue(mipmap_pyramid[i+1], mipmap_sizes[i+1], surround)*factor;
+				centre_logAvgLum = *levels[i].clampedPixel(centre.x, centre.y)*factor;
+				surround_logAvgLum = *levels[i+1].clampedPixel(surround.x, surround.y)*factor;
 
 				cs_diff = centre_logAvgLum - surround_logAvgLum;
 				cs_diff = cs_diff >= 0 ? cs_diff : -cs_diff;
@@ -299,9 +362,7 @@ bool ReinhardLocal::runReference(uchar* input, uchar* output) {
 			}
 
 			float3 rgb, xyz;
-			rgb.x = getPixel(input, img_size, pos, 0);
-			rgb.y = getPixel(input, img_size, pos, 1);
-			rgb.z = getPixel(input, img_size, pos, 2);
+			rgb = getColour(in + pos.x*NUM_CHANNELS);
 
 			xyz = RGBtoXYZ(rgb);
 
@@ -311,9 +372,7 @@ bool ReinhardLocal::runReference(uchar* input, uchar* output) {
 			rgb.y = (pow(rgb.y/xyz.y, sat) * Ld)*PIXEL_RANGE;
 			rgb.z = (pow(rgb.z/xyz.y, sat) * Ld)*PIXEL_RANGE;
 
-			setPixel(output, img_size, pos, 0, rgb.x);
-			setPixel(output, img_size, pos, 1, rgb.y);
-			setPixel(output, img_size, pos, 2, rgb.z);
+			setColour(out + pos.x*NUM_CHANNELS, rgb);
 		}
 	}
 
@@ -328,4 +387,111 @@ bool ReinhardLocal::runReference(uchar* input, uchar* output) {
 	memcpy(m_reference.data, output, img_size.x*img_size.y*NUM_CHANNELS);
 
 	return true;
-}
\ No newline at end of file
+}
+
+template <typename T>
+bool ReinhardLocal::native(T* input, uchar* output) {
+	reportStatus("Running native");
+
+	std::vector<float*> mipmap_pyramid(num_mipmaps);	//the complete mipmap pyramid
+	std::vector<int2> mipmap_sizes(num_mipmaps);	//width and height of each of the mipmap
+	mipmap_sizes[0] = img_size;
+
+	//luminance of the image and log average luminance of each row, reduced in a fixed order so the result doesn't depend on the threads
+	mipmap_pyramid[0] = (float*) calloc(img_size.x*img_size.y, sizeof(float));
+	std::vector<double> row_logAvgLum(img_size.y);
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		T* in = input + y*img_size.x*NUM_CHANNELS;
+		float* lum_row = mipmap_pyramid[0] + y*img_size.x;
+		floatv logAvgLum = 0.f;
+		for (int x = 0; x < img_size.x; x += NATIVE_WIDTH) {
+			int n = std::min(NATIVE_WIDTH, img_size.x-x);
+			floatv r, g, b;
+			load_pixels(in + x*NUM_CHANNELS, n, &r, &g, &b);
+			floatv lum = luminance(r, g, b);
+			store_values(lum_row + x, n, lum);
+			logAvgLum = logAvgLum + vlog(lum + 0.000001f)*lane_mask(n);
+		}
+		row_logAvgLum[y] = sum_lanes(logAvgLum);
+	}
+
+	float factor = key/exp(pairwiseSum(&row_logAvgLum[0], img_size.y)/(img_size.x*img_size.y));
+
+	float k[num_mipmaps-1];	//product of multiple constants, k[i] being used to compare levels i and i+1
+	for (int i=1; i<num_mipmaps; i++) {
+		mipmap_pyramid[i] = mipmap(mipmap_pyramid[i-1], mipmap_sizes[i-1]);
+		mipmap_sizes[i] = (int2){mipmap_sizes[i-1].x/2, mipmap_sizes[i-1].y/2};
+		k[i-1] = pow(2.f, phi)*key/pow(pow(2, i-1), 2);
+	}
+	//the centre and surround of the pixels at the right and bottom edges may be past odd sized levels
+	std::vector<ValueView> levels;
+	for (int i=0; i<num_mipmaps; i++) levels.push_back(ValueView(mipmap_pyramid[i], mipmap_sizes[i]));
+
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < img_size.y; y++) {
+		T* in = input + y*img_size.x*NUM_CHANNELS;
+		uchar* out = output + y*img_size.x*NUM_CHANNELS;
+
+		//the scale selection branches for each pixel, so only the tone mapping is vectorised
+		std::vector<float> mappings(img_size.x);
+		int2 pos, centre, surround;
+		pos.y = y;
+		for (pos.x = 0; pos.x < img_size.x; pos.x++) {
+			float local_logAvgLum = 0.f;
+			surround = pos;
+			for (int i=0; i<num_mipmaps-1; i++) {
+				centre = surround;
+				surround.x = centre.x/2;
+				surround.y = centre.y/2;
+
+				float centre_logAvgLum = *levels[i].clampedPixel(centre.x, centre.y)*factor;
+				float surround_logAvgLum = *levels[i+1].clampedPixel(surround.x, surround.y)*factor;
+
+				float v = fabs(centre_logAvgLum - surround_logAvgLum)/(k[i] + centre_logAvgLum);
+				if (v > epsilon) {
+					local_logAvgLum = centre_logAvgLum;
+					break;
+				}
+				else local_logAvgLum = surround_logAvgLum;
+			}
+			mappings[pos.x] = factor/(1.f + local_logAvgLum)*PIXEL_RANGE;
+		}
+
+		for (int x = 0; x < img_size.x; x += NATIVE_WIDTH) {
+			int n = std::min(NATIVE_WIDTH, img_size.x-x);
+			floatv r, g, b;
+			load_pixels(in + x*NUM_CHANNELS, n, &r, &g, &b);
+			floatv Y = luminance(r, g, b);
+			floatv Ld = Y*load_values(&mappings[x], n);
+
+			store_pixels(out + x*NUM_CHANNELS, n,
+				clamp_colour(vpow(r/Y, sat)*Ld),
+				clamp_colour(vpow(g/Y, sat)*Ld),
+				clamp_colour(vpow(b/Y, sat)*Ld));
+		}
+	}
+
+	for (int i = 0; i < num_mipmaps; i++) free(mipmap_pyramid[i]);
+
+	reportStatus("Finished native");
+
+	return true;
+}
+
+bool ReinhardLocal::runReference(uchar* input, uchar* output) {
+	return reference(input, output);
+}
+
+bool ReinhardLocal::runReference(float* input, uchar* output) {
+	return reference(input, output);
+}
+
+bool ReinhardLocal::runNative(uchar* input, uchar* output) {
+	return native(input, output);
+}
+
+bool ReinhardLocal::runNative(float* input, uchar* output) {
+	return native(input, output);
+}
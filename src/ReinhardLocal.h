@@ -15,11 +15,22 @@ public:
 	ReinhardLocal(float _key=0.18f, float _sat=1.6f, float _epsilon=0.05, float _phi=8.0);
 
 	virtual bool setupOpenCL(cl_context_properties context_prop[], const Params& params);
-	virtual double runCLKernels(bool recomputeMapping);
+	virtual bool enqueueCLKernels(bool recomputeMapping);
 	virtual bool cleanupOpenCL();
 	virtual bool runReference(uchar* input, uchar* output);
+	virtual bool runReference(float* input, uchar* output);
+	virtual bool runNative(uchar* input, uchar* output);
+	virtual bool runNative(float* input, uchar* output);
+	virtual bool setParameter(const char* name, float value);
 
 protected:
+	virtual bool setupMemory();
+	virtual void releaseMemory();
+	virtual bool setupKernelArgs();
+	//runReference and runNative for 8-bit and radiance input
+	template <typename T> bool reference(T* input, uchar* output);
+	template <typename T> bool native(T* input, uchar* output);
+
 	float key;	//increase this to allow for more contrast in the darker regions
 	float sat;	//increase this for more colourful pictures
 	float epsilon;	//serves as an edge enhancing parameter
@@ -31,5 +42,8 @@ protected:
 	int* m_height;		//at index i this contains the height of the mipmap at index i
 	int* m_offset;		//at index i this contains the start point to store the mipmap at level i
 
+	bool m_store_mapping;	//whether reinhardLocal stores its mappings in Ld_array, set once a frame has reused them
+	bool m_mapping_stored;	//whether Ld_array holds the mappings of the current parameters
+
 };
 }
\ No newline at end of file
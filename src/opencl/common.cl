@@ -0,0 +1,34 @@
+// common.cl (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+//a function to read an OpenGL texture pixel when using Snapdragon's Android OpenCL implementation
+//the values read are mapped back to [0, 255] through gl_to_cl_table, which the host builds from the GL-CL mappings
+//and prepends to the program in __constant memory, consult the read-me
+#if BUGGY_CL_GL
+float GL_to_CL(uint val) {
+	return gl_to_cl_table[min(val, (uint)(GL_TO_CL_TABLE_SIZE-1))];
+}
+#else
+float GL_to_CL(uint val) {
+	return (float)val;
+}
+#endif
+
+//reads a pixel of an input image as floats in the range of 8-bit pixels, the alpha channel included
+//the radiance images of RADIANCE_INPUT programs, of floats or half floats, are scaled so that 1 is 8-bit white
+//but their brighter values aren't clipped
+const sampler_t input_sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_NEAREST;
+
+float4 read_input(__read_only image2d_t image, const int2 pos) {
+#if RADIANCE_INPUT
+	return read_imagef(image, input_sampler, pos)*255.f;
+#else
+	uint4 pixel = read_imageui(image, input_sampler, pos);
+	return (float4)(GL_to_CL(pixel.x), GL_to_CL(pixel.y), GL_to_CL(pixel.z), pixel.w);
+#endif
+}
@@ -0,0 +1,36 @@
+static const char *common_kernel =
+"// common.cl (HDR)\n"
+"// Copyright (c) 2014, Amir Chohan,\n"
+"// University of Bristol. All rights reserved.\n"
+"//\n"
+"// This program is provided under a three-clause BSD license. For full\n"
+"// license terms please see the LICENSE file distributed with this\n"
+"// source code.\n"
+"\n"
+"//a function to read an OpenGL texture pixel when using Snapdragon's Android OpenCL implementation\n"
+"//the values read are mapped back to [0, 255] through gl_to_cl_table, which the host builds from the GL-CL mappings\n"
+"//and prepends to the program in __constant memory, consult the read-me\n"
+"#if BUGGY_CL_GL\n"
+"float GL_to_CL(uint val) {\n"
+"	return gl_to_cl_table[min(val, (uint)(GL_TO_CL_TABLE_SIZE-1))];\n"
+"}\n"
+"#else\n"
+"float GL_to_CL(uint val) {\n"
+"	return (float)val;\n"
+"}\n"
+"#endif\n"
+"\n"
+"//reads a pixel of an input image as floats in the range of 8-bit pixels, the alpha channel included\n"
+"//the radiance images of RADIANCE_INPUT programs, of floats or half floats, are scaled so that 1 is 8-bit white\n"
+"//but their brighter values aren't clipped\n"
+"const sampler_t input_sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_NEAREST;\n"
+"\n"
+"float4 read_input(__read_only image2d_t image, const int2 pos) {\n"
+"#if RADIANCE_INPUT\n"
+"	return read_imagef(image, input_sampler, pos)*255.f;\n"
+"#else\n"
+"	uint4 pixel = read_imageui(image, input_sampler, pos);\n"
+"	return (float4)(GL_to_CL(pixel.x), GL_to_CL(pixel.y), GL_to_CL(pixel.z), pixel.w);\n"
+"#endif\n"
+"}\n"
+;
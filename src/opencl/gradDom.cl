@@ -6,57 +6,28 @@
 // license terms please see the LICENSE file distributed with this
 // source code.
 
-float GL_to_CL(uint val);
-float3 RGBtoXYZ(float3 rgb);
-
-const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_NEAREST;
-
 //this kernel computes logLum
 kernel void computeLogLum( 	__read_only image2d_t image,
-							__global float* logLum) {
-
-	int2 pos;
-	uint4 pixel;
-	float lum;
-	for (pos.y = get_global_id(1); pos.y < HEIGHT; pos.y += get_global_size(1)) {
-		for (pos.x = get_global_id(0); pos.x < WIDTH; pos.x += get_global_size(0)) {
-			pixel = read_imageui(image, sampler, pos);
-			lum = GL_to_CL(pixel.x)*0.2126
-				+ GL_to_CL(pixel.y)*0.7152
-				+ GL_to_CL(pixel.z)*0.0722;
-			logLum[pos.x + pos.y*WIDTH] = log(lum + 0.000001);
-		}
-	}
-}
+							__global float* logLum,
+							const int2 img_size) {
 
-//computes the next level mipmap
-kernel void channel_mipmap(	__global float* mipmap,	//array containing all the mipmap levels
-							const int prev_width,	//width of the previous mipmap
-							const int prev_offset, 	//start point of the previous mipmap 
-							const int m_width,		//width of the mipmap being generated
-							const int m_height,		//height of the mipmap being generated
-							const int m_offset) { 	//start point to store the current mipmap
 	int2 pos;
-	for (pos.y = get_global_id(1); pos.y < m_height; pos.y += get_global_size(1)) {
-		for (pos.x = get_global_id(0); pos.x < m_width; pos.x += get_global_size(0)) {
-			int _x = 2*pos.x;
-			int _y = 2*pos.y;
-			mipmap[pos.x + pos.y*m_width + m_offset] = 	(mipmap[_x + _y*prev_width + prev_offset]
-														+ mipmap[_x+1 + _y*prev_width + prev_offset]
-														+ mipmap[_x + (_y+1)*prev_width + prev_offset]
-														+ mipmap[(_x+1) + (_y+1)*prev_width + prev_offset])/4.f;
+	floatv r, g, b, a;
+	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {
+		for (pos.x = get_global_id(0)*VECTOR_WIDTH; pos.x < img_size.x; pos.x += get_global_size(0)*VECTOR_WIDTH) {
+			read_pixels(image, pos, img_size.x, &r, &g, &b, &a);
+			write_values(logLum, pos.x + pos.y*img_size.x, img_size.x - pos.x, log(luminance(r, g, b) + 0.000001f));
 		}
 	}
 }
 
-//computing gradient magnitude using central differences at level k
+//computing gradient magnitude using central differences at every level
 kernel void gradient_mag(	__global float* lum,		//array containing all the luminance mipmap levels
 							__global float* gradient,	//array to store all the gradients at different levels
-							const int g_width,			//width of the gradient being generated
-							const int g_height,			//height of the gradient being generated
-							const int offset,			//start point to store the current gradient
-							const float divider) { 	
-	//k_av_grad = 0.f;
+							__global int* m_width,		//width of each of the mipmaps
+							__global int* m_height,		//height of each of the mipmaps
+							__global int* m_offset,		//start point of each of the mipmaps
+							const int num_levels) {
 	int x_west;
 	int x_east;
 	int y_north;
@@ -64,71 +35,82 @@ kernel void gradient_mag(	__global float* lum,		//array containing all the lumin
 	float x_grad;
 	float y_grad;
 	int2 pos;
-	for (pos.y = get_global_id(1); pos.y < g_height; pos.y += get_global_size(1)) {
-		for (pos.x = get_global_id(0); pos.x < g_width; pos.x += get_global_size(0)) {
-			x_west  = clamp(pos.x-1, 0, g_width-1);
-			x_east  = clamp(pos.x+1, 0, g_width-1);
-			y_north = clamp(pos.y-1, 0, g_height-1);
-			y_south = clamp(pos.y+1, 0, g_height-1);
+	for (int level = 0; level < num_levels; level++) {
+		const int g_width = m_width[level];
+		const int g_height = m_height[level];
+		const int offset = m_offset[level];
+		const float divider = 2 << level;	//the distance between the neighbours at this level
+
+		for (pos.y = get_global_id(1); pos.y < g_height; pos.y += get_global_size(1)) {
+			for (pos.x = get_global_id(0); pos.x < g_width; pos.x += get_global_size(0)) {
+				x_west  = clamp(pos.x-1, 0, g_width-1);
+				x_east  = clamp(pos.x+1, 0, g_width-1);
+				y_north = clamp(pos.y-1, 0, g_height-1);
+				y_south = clamp(pos.y+1, 0, g_height-1);
 
-			x_grad = (lum[x_west + pos.y*g_width + offset]  - lum[x_east + pos.y*g_width + offset])/divider;
-			y_grad = (lum[pos.x + y_south*g_width + offset] - lum[pos.x + y_north*g_width + offset])/divider;
+				x_grad = (lum[x_west + pos.y*g_width + offset]  - lum[x_east + pos.y*g_width + offset])/divider;
+				y_grad = (lum[pos.x + y_south*g_width + offset] - lum[pos.x + y_north*g_width + offset])/divider;
 
-			gradient[pos.x + pos.y*g_width + offset] = sqrt(pow(x_grad, 2.f) + pow(y_grad, 2.f));
+				gradient[pos.x + pos.y*g_width + offset] = sqrt(pow(x_grad, 2.f) + pow(y_grad, 2.f));
+			}
 		}
 	}
 }
 
-//used to compute the average gradient for the specified mipmap level
+//used to compute the average gradient of every mipmap level
+//the partial sums of each level are stored after those of the previous one
 kernel void partialReduc(	__global float* gradient,	//array containing all the luminance gradient mipmap levels
 							__global float* gradient_partial_sum,
 							__local float* gradient_loc,
-							const int height,	//height of the given mipmap
-							const int width,	//width of the given mipmap
-							const int g_offset) {	///index denoting the start point of the mipmap gradient array
+							__global int* m_width,	//width of each of the mipmaps
+							__global int* m_height,	//height of each of the mipmaps
+							__global int* m_offset,	//start point of each of the mipmaps
+							const int num_levels) {
 
-	float gradient_acc = 0.f;
+	const int lid = get_local_id(0);	//local id in one dimension
+	for (int level = 0; level < num_levels; level++) {
+		float gradient_acc = 0.f;
 
-	for (int gid = get_global_id(0); gid < height*width; gid += get_global_size(0)) {
-		gradient_acc += gradient[g_offset + gid];
-	}
+		for (int gid = get_global_id(0); gid < m_height[level]*m_width[level]; gid += get_global_size(0)) {
+			gradient_acc += gradient[m_offset[level] + gid];
+		}
 
-	const int lid = get_local_id(0);	//local id in one dimension
-	gradient_loc[lid] = gradient_acc;
+		gradient_loc[lid] = gradient_acc;
 
-	// Perform parallel reduction
-	barrier(CLK_LOCAL_MEM_FENCE);
+		// Perform parallel reduction
+		barrier(CLK_LOCAL_MEM_FENCE);
 
-	for(int offset = get_local_size(0)/2; offset > 0; offset = offset/2) {
-		if (lid < offset) {
-			gradient_loc[lid] += gradient_loc[lid + offset];
+		for(int offset = get_local_size(0)/2; offset > 0; offset = offset/2) {
+			if (lid < offset) {
+				gradient_loc[lid] += gradient_loc[lid + offset];
+			}
+			barrier(CLK_LOCAL_MEM_FENCE);
 		}
-		barrier(CLK_LOCAL_MEM_FENCE);
-	}
 
-	const int group_id = get_group_id(0);
-	if (lid == 0) {
-		gradient_partial_sum[group_id] = gradient_loc[0];
+		if (lid == 0) {
+			gradient_partial_sum[get_group_id(0) + level*get_num_groups(0)] = gradient_loc[0];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);	//gradient_loc is reused by the next level
 	}
 }
 
-//used to compute the average gradient for the specified mipmap level
+//computes alpha of every mipmap level from the average gradients, one work item per level
 kernel void finalReduc(	__global float* gradient_partial_sum,
 						__global float* alphas,	//array containg alpha for each mipmap level
-						const int mipmap_level,
-						const int width,	//width of the given mipmap
-						const int height,	//height of the given mipmap
-						const unsigned int num_reduc_bins) {
-	if (get_global_id(0)==0) {
+						__global int* m_width,	//width of each of the mipmaps
+						__global int* m_height,	//height of each of the mipmaps
+						const int num_levels,
+						const unsigned int num_reduc_bins,	//partial sums of each level
+						const float adjust_alpha) {	//gradients smaller than alpha are slightly magnified
+	for (int level = get_global_id(0); level < num_levels; level += get_global_size(0)) {
 
 		float sum_grads = 0.f;
 	
 		for (int i=0; i<num_reduc_bins; i++) {
-			sum_grads += gradient_partial_sum[i];
+			sum_grads += gradient_partial_sum[i + level*num_reduc_bins];
 		}
-		alphas[mipmap_level] = ADJUST_ALPHA*exp(sum_grads/((float)width*height));
+		alphas[level] = adjust_alpha*exp(sum_grads/((float)m_width[level]*m_height[level]));
 	}
-	else return;
 }
 
 //computes attenuation function of the coarsest level mipmap
@@ -137,10 +119,11 @@ kernel void coarsest_level_attenfunc(	__global float* gradient,	//array containi
 										__global float* k_alpha,	//array containing alpha for each mipmap
 										const int width,	//width of the coarsest level mipmap
 										const int height,	//height of the coarsest level mipmap
-										const int offset) {	//index where the data about the coarsest level mipmap starts in gradient array and atten_func array
+										const int offset,	//index where the data about the coarsest level mipmap starts in gradient array and atten_func array
+										const float beta) {	//used to attenuate larger gradients
 
 	for (int gid = get_global_id(0); gid < width*height; gid+= get_global_size(0) ) {
-		atten_func[gid+offset] = (k_alpha[0]/gradient[gid+offset])*pow(gradient[gid+offset]/k_alpha[0], (float)BETA);
+		atten_func[gid+offset] = (k_alpha[0]/gradient[gid+offset])*pow(gradient[gid+offset]/k_alpha[0], beta);
 	}
 }
 
@@ -154,7 +137,8 @@ kernel void atten_func(	__global float* gradient,	//array containing all the lum
 						const int c_width,	//width of the coarser mipmap
 						const int c_height,	//height of the coarser mipmap
 						const int c_offset,	//index where the data about the coarser mipmap level starts in gradient array and atten_func array
-						const int level) {	//current mipmap level
+						const int level,	//current mipmap level
+						const float beta) {	//used to attenuate larger gradients
 	int2 pos;
 	int2 c_pos;
 	int2 neighbour;
@@ -184,7 +168,7 @@ kernel void atten_func(	__global float* gradient,	//array containing all the lum
 								+ 3.0*atten_func[c_pos.x 				+ (c_pos.y+neighbour.y)		*c_width	+ c_offset]
 								+ 1.0*atten_func[c_pos.x+neighbour.x 	+ (c_pos.y+neighbour.y)		*c_width	+ c_offset];
 
-				k_xy_scale_factor = (k_alpha[level]/gradient[pos.x + pos.y*width + offset])*pow(gradient[pos.x + pos.y*width + offset]/k_alpha[level], (float)BETA);
+				k_xy_scale_factor = (k_alpha[level]/gradient[pos.x + pos.y*width + offset])*pow(gradient[pos.x + pos.y*width + offset]/k_alpha[level], beta);
 				atten_func[pos.x + pos.y*width + offset] = (1.f/16.f)*(k_xy_atten_func)*k_xy_scale_factor;
 			}
 			else atten_func[pos.x + pos.y*width + offset] = 0.f;
@@ -196,57 +180,94 @@ kernel void atten_func(	__global float* gradient,	//array containing all the lum
 kernel void grad_atten(	__global float* atten_grad_x,	//array to store the attenuated gradient in x dimension
 						__global float* atten_grad_y,	//array to store the attenuated gradeint in y dimension
 						__global float* lum,			//original luminance of the image
-						__global float* atten_func) {	//attenuation function
+						__global float* atten_func,	//attenuation function
+						const int2 img_size) {
 	int2 pos;
 	float2 grad;
-	for (pos.y = get_global_id(1); pos.y < HEIGHT; pos.y += get_global_size(1)) {
-		for (pos.x = get_global_id(0); pos.x < WIDTH; pos.x += get_global_size(0)) {	
-			grad.x = (pos.x < WIDTH-1 ) ? (lum[pos.x+1 +  	 pos.y*WIDTH] - lum[pos.x + pos.y*WIDTH]) : 0;
-			grad.y = (pos.y < HEIGHT-1) ? (lum[pos.x   + (pos.y+1)*WIDTH] - lum[pos.x + pos.y*WIDTH]) : 0;
-			atten_grad_x[pos.x + pos.y*WIDTH] = grad.x*atten_func[pos.x + pos.y*WIDTH];
-			atten_grad_y[pos.x + pos.y*WIDTH] = grad.y*atten_func[pos.x + pos.y*WIDTH];
+	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {
+		for (pos.x = get_global_id(0); pos.x < img_size.x; pos.x += get_global_size(0)) {	
+			grad.x = (pos.x < img_size.x-1 ) ? (lum[pos.x+1 +  	 pos.y*img_size.x] - lum[pos.x + pos.y*img_size.x]) : 0;
+			grad.y = (pos.y < img_size.y-1) ? (lum[pos.x   + (pos.y+1)*img_size.x] - lum[pos.x + pos.y*img_size.x]) : 0;
+			atten_grad_x[pos.x + pos.y*img_size.x] = grad.x*atten_func[pos.x + pos.y*img_size.x];
+			atten_grad_y[pos.x + pos.y*img_size.x] = grad.y*atten_func[pos.x + pos.y*img_size.x];
 		}
 	}
 }
 
 //computes the divergence field of the attenuated gradients
+//the gradients outside the image are taken to be zero which makes it consistent with neumann boundaries
 kernel void divG(	__global float* atten_grad_x,	//attenuated gradient in x direction
 					__global float* atten_grad_y,	//attenuated gradient in y direction
-					__global float* div_grad) {		//array to store the divergence field of the gradients
-	div_grad[0] = 0;
+					__global float* div_grad,		//array to store the divergence field of the gradients
+					const int2 img_size) {
 	int2 pos;
-	for (pos.x = get_global_id(0) + 1; pos.x < WIDTH; pos.x += get_global_size(0)) {
-		div_grad[pos.x] = atten_grad_x[pos.x] - atten_grad_x[pos.x-1];
-	}
-	for (pos.y = get_global_id(1) + 1; pos.y < HEIGHT; pos.y += get_global_size(1)) {
-		div_grad[pos.y*WIDTH] = atten_grad_y[pos.y*WIDTH] - atten_grad_y[(pos.y-1)*WIDTH];
-		for (pos.x = get_global_id(0)+1; pos.x < WIDTH; pos.x += get_global_size(0)) {
-			div_grad[pos.x + pos.y*WIDTH] 	= (atten_grad_x[pos.x + pos.y*WIDTH] - atten_grad_x[(pos.x-1) + pos.y*WIDTH])
-											+ (atten_grad_y[pos.x + pos.y*WIDTH] - atten_grad_y[pos.x + (pos.y-1)*WIDTH]);
+	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {
+		for (pos.x = get_global_id(0); pos.x < img_size.x; pos.x += get_global_size(0)) {
+			div_grad[pos.x + pos.y*img_size.x] 	= (atten_grad_x[pos.x + pos.y*img_size.x] - ((pos.x > 0) ? atten_grad_x[(pos.x-1) + pos.y*img_size.x] : 0))
+											+ (atten_grad_y[pos.x + pos.y*img_size.x] - ((pos.y > 0) ? atten_grad_y[pos.x + (pos.y-1)*img_size.x] : 0));
 		}
-	}	
+	}
 }
 
+//performs one red-black Gauss-Seidel sweep of the poisson equation, updating only the pixels of the given colour
+//pixels which change by more than the convergence criteria are counted in unconverged
+kernel void poisson_rb(	__global float* dr,				//current estimate of the compressed dynamic range, updated in place
+						__global float* div_grad,		//divergence field of the attenuated gradients
+						__global uint* unconverged,		//number of pixels which haven't converged yet
+						const float convergence,		//a pixel has converged once it changes by less than this
+						const int colour,				//0 to update the red pixels, 1 to update the black pixels
+						const int2 img_size) {
+	__local uint l_unconverged;
+	const int lid = get_local_id(0) + get_local_id(1)*get_local_size(0);
+	if (lid == 0) l_unconverged = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	int2 pos;
+	float prev, new_dr, diff;
+	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {
+		for (int i = get_global_id(0); i < (img_size.x+1)/2; i += get_global_size(0)) {
+			pos.x = 2*i + ((pos.y + colour) & 1);	//pixels of the same colour are two apart in each row
+			if (pos.x >= img_size.x) continue;
+
+			prev  = ((pos.x-1 >= 0)      ? dr[pos.x-1 +     pos.y*img_size.x] : 0)
+				  + ((pos.x+1 < img_size.x)  ? dr[pos.x+1 +     pos.y*img_size.x] : 0)
+				  + ((pos.y-1 >= 0)      ? dr[pos.x   + (pos.y-1)*img_size.x] : 0)
+				  + ((pos.y+1 < img_size.y) ? dr[pos.x   + (pos.y+1)*img_size.x] : 0);
 
-//convert an RGB pixel to XYZ format
-float3 RGBtoXYZ(float3 rgb) {
-	float3 xyz;
-	xyz.x = rgb.x*0.4124 + rgb.y*0.3576 + rgb.z*0.1805;
-	xyz.y = rgb.x*0.2126 + rgb.y*0.7152 + rgb.z*0.0722;
-	xyz.z = rgb.x*0.0193 + rgb.y*0.1192 + rgb.z*0.9505;
-	return xyz;
+			new_dr = 0.25f*(prev - div_grad[pos.x + pos.y*img_size.x]);
+			diff = new_dr - dr[pos.x + pos.y*img_size.x];
+			diff = (diff >= 0) ? diff : -diff;
+			dr[pos.x + pos.y*img_size.x] = new_dr;
+
+			if (diff >= convergence) atomic_inc(&l_unconverged);
+		}
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (lid == 0 && l_unconverged != 0) atomic_add(unconverged, l_unconverged);
 }
 
-//a function to read an OpenGL texture pixel when using Snapdragon's Android OpenCL implementation
-float GL_to_CL(uint val) {
-	if (BUGGY_CL_GL) {
-		if (val >= 14340) return round(0.1245790*val - 1658.44);	//>=128
-		if (val >= 13316) return round(0.0622869*val - 765.408);	//>=64
-		if (val >= 12292) return round(0.0311424*val - 350.800);	//>=32
-		if (val >= 11268) return round(0.0155702*val - 159.443);	//>=16
-	
-		float v = (float) val;
-		return round(0.0000000000000125922*pow(v,4.f) - 0.00000000026729*pow(v,3.f) + 0.00000198135*pow(v,2.f) - 0.00496681*v - 0.0000808829);
+//reconstructs the colour image from the compressed dynamic range computed by the poisson solver
+kernel void tonemap(__read_only image2d_t input_image,
+					__write_only image2d_t output_image,
+					__global float* lum,	//original log luminance of the image
+					__global float* dr,		//compressed log luminance of the image
+					const int2 img_size,
+					const float sat) {
+	int2 pos;
+	floatv r, g, b, a;
+	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {
+		for (pos.x = get_global_id(0)*VECTOR_WIDTH; pos.x < img_size.x; pos.x += get_global_size(0)*VECTOR_WIDTH) {
+			read_pixels(input_image, pos, img_size.x, &r, &g, &b, &a);
+
+			int remaining = img_size.x - pos.x;
+			floatv L  = exp(read_values(lum, pos.x + pos.y*img_size.x, remaining));
+			floatv Ld = exp(read_values(dr, pos.x + pos.y*img_size.x, remaining));
+
+			write_pixels(output_image, pos, img_size.x,
+				pow(r/L, (floatv)sat)*Ld,
+				pow(g/L, (floatv)sat)*Ld,
+				pow(b/L, (floatv)sat)*Ld, a);
+		}
 	}
-	else return (float)val;
-}
\ No newline at end of file
+}
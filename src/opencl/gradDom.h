@@ -0,0 +1,275 @@
+static const char *gradDom_kernel =
+"// gradDom.cl (HDR)\n"
+"// Copyright (c) 2014, Amir Chohan,\n"
+"// University of Bristol. All rights reserved.\n"
+"//\n"
+"// This program is provided under a three-clause BSD license. For full\n"
+"// license terms please see the LICENSE file distributed with this\n"
+"// source code.\n"
+"\n"
+"//this kernel computes logLum\n"
+"kernel void computeLogLum( 	__read_only image2d_t image,\n"
+"							__global float* logLum,\n"
+"							const int2 img_size) {\n"
+"\n"
+"	int2 pos;\n"
+"	floatv r, g, b, a;\n"
+"	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {\n"
+"		for (pos.x = get_global_id(0)*VECTOR_WIDTH; pos.x < img_size.x; pos.x += get_global_size(0)*VECTOR_WIDTH) {\n"
+"			read_pixels(image, pos, img_size.x, &r, &g, &b, &a);\n"
+"			write_values(logLum, pos.x + pos.y*img_size.x, img_size.x - pos.x, log(luminance(r, g, b) + 0.000001f));\n"
+"		}\n"
+"	}\n"
+"}\n"
+"\n"
+"//computing gradient magnitude using central differences at every level\n"
+"kernel void gradient_mag(	__global float* lum,		//array containing all the luminance mipmap levels\n"
+"							__global float* gradient,	//array to store all the gradients at different levels\n"
+"							__global int* m_width,		//width of each of the mipmaps\n"
+"							__global int* m_height,		//height of each of the mipmaps\n"
+"							__global int* m_offset,		//start point of each of the mipmaps\n"
+"							const int num_levels) {\n"
+"	int x_west;\n"
+"	int x_east;\n"
+"	int y_north;\n"
+"	int y_south;\n"
+"	float x_grad;\n"
+"	float y_grad;\n"
+"	int2 pos;\n"
+"	for (int level = 0; level < num_levels; level++) {\n"
+"		const int g_width = m_width[level];\n"
+"		const int g_height = m_height[level];\n"
+"		const int offset = m_offset[level];\n"
+"		const float divider = 2 << level;	//the distance between the neighbours at this level\n"
+"\n"
+"		for (pos.y = get_global_id(1); pos.y < g_height; pos.y += get_global_size(1)) {\n"
+"			for (pos.x = get_global_id(0); pos.x < g_width; pos.x += get_global_size(0)) {\n"
+"				x_west\t= clamp(pos.x-1, 0, g_width-1);\n"
+"				x_east\t= clamp(pos.x+1, 0, g_width-1);\n"
+"				y_north = clamp(pos.y-1, 0, g_height-1);\n"
+"				y_south = clamp(pos.y+1, 0, g_height-1);\n"
+"\n"
+"				x_grad = (lum[x_west + pos.y*g_width + offset]\t- lum[x_east + pos.y*g_width + offset])/divider;\n"
+"				y_grad = (lum[pos.x + y_south*g_width + offset] - lum[pos.x + y_north*g_width + offset])/divider;\n"
+"\n"
+"				gradient[pos.x + pos.y*g_width + offset] = sqrt(pow(x_grad, 2.f) + pow(y_grad, 2.f));\n"
+"			}\n"
+"		}\n"
+"	}\n"
+"}\n"
+"\n"
+"//used to compute the average gradient of every mipmap level\n"
+"//the partial sums of each level are stored after those of the previous one\n"
+"kernel void partialReduc(	__global float* gradient,	//array containing all the luminance gradient mipmap levels\n"
+"							__global float* gradient_partial_sum,\n"
+"							__local float* gradient_loc,\n"
+"							__global int* m_width,	//width of each of the mipmaps\n"
+"							__global int* m_height,	//height of each of the mipmaps\n"
+"							__global int* m_offset,	//start point of each of the mipmaps\n"
+"							const int num_levels) {\n"
+"\n"
+"	const int lid = get_local_id(0);	//local id in one dimension\n"
+"	for (int level = 0; level < num_levels; level++) {\n"
+"		float gradient_acc = 0.f;\n"
+"\n"
+"		for (int gid = get_global_id(0); gid < m_height[level]*m_width[level]; gid += get_global_size(0)) {\n"
+"			gradient_acc += gradient[m_offset[level] + gid];\n"
+"		}\n"
+"\n"
+"		gradient_loc[lid] = gradient_acc;\n"
+"\n"
+"		// Perform parallel reduction\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+"\n"
+"		for(int offset = get_local_size(0)/2; offset > 0; offset = offset/2) {\n"
+"			if (lid < offset) {\n"
+"				gradient_loc[lid] += gradient_loc[lid + offset];\n"
+"			}\n"
+"			barrier(CLK_LOCAL_MEM_FENCE);\n"
+"		}\n"
+"\n"
+"		if (lid == 0) {\n"
+"			gradient_partial_sum[get_group_id(0) + level*get_num_groups(0)] = gradient_loc[0];\n"
+"		}\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);	//gradient_loc is reused by the next level\n"
+"	}\n"
+"}\n"
+"\n"
+"//computes alpha of every mipmap level from the average gradients, one work item per level\n"
+"kernel void finalReduc(	__global float* gradient_partial_sum,\n"
+"						__global float* alphas,	//array containg alpha for each mipmap level\n"
+"						__global int* m_width,	//width of each of the mipmaps\n"
+"						__global int* m_height,	//height of each of the mipmaps\n"
+"						const int num_levels,\n"
+"						const unsigned int num_reduc_bins,	//partial sums of each level\n"
+"						const float adjust_alpha) {	//gradients smaller than alpha are slightly magnified\n"
+"	for (int level = get_global_id(0); level < num_levels; level += get_global_size(0)) {\n"
+"\n"
+"		float sum_grads = 0.f;\n"
+"	\n"
+"		for (int i=0; i<num_reduc_bins; i++) {\n"
+"			sum_grads += gradient_partial_sum[i + level*num_reduc_bins];\n"
+"		}\n"
+"		alphas[level] = adjust_alpha*exp(sum_grads/((float)m_width[level]*m_height[level]));\n"
+"	}\n"
+"}\n"
+"\n"
+"//computes attenuation function of the coarsest level mipmap\n"
+"kernel void coarsest_level_attenfunc(	__global float* gradient,	//array containing all the luminance gradient mipmap levels\n"
+"										__global float* atten_func,	//arrray to store attenuation function for each mipmap\n"
+"										__global float* k_alpha,	//array containing alpha for each mipmap\n"
+"										const int width,	//width of the coarsest level mipmap\n"
+"										const int height,	//height of the coarsest level mipmap\n"
+"										const int offset,	//index where the data about the coarsest level mipmap starts in gradient array and atten_func array\n"
+"										const float beta) {	//used to attenuate larger gradients\n"
+"\n"
+"	for (int gid = get_global_id(0); gid < width*height; gid+= get_global_size(0) ) {\n"
+"		atten_func[gid+offset] = (k_alpha[0]/gradient[gid+offset])*pow(gradient[gid+offset]/k_alpha[0], beta);\n"
+"	}\n"
+"}\n"
+"\n"
+"//computes attenuation function of a given mipmap\n"
+"kernel void atten_func(	__global float* gradient,	//array containing all the luminance gradient mipmap levels\n"
+"						__global float* atten_func,	//arrray to store attenuation function for each mipmap\n"
+"						__global float* k_alpha,	//array containing alpha for each mipmap\n"
+"						const int width,	//width of the given mipmap\n"
+"						const int height,	//height of the given mipmap\n"
+"						const int offset,	//index where the data about the given mipmap level starts in gradient array and atten_func array\n"
+"						const int c_width,	//width of the coarser mipmap\n"
+"						const int c_height,	//height of the coarser mipmap\n"
+"						const int c_offset,	//index where the data about the coarser mipmap level starts in gradient array and atten_func array\n"
+"						const int level,	//current mipmap level\n"
+"						const float beta) {	//used to attenuate larger gradients\n"
+"	int2 pos;\n"
+"	int2 c_pos;\n"
+"	int2 neighbour;\n"
+"	float k_xy_atten_func;\n"
+"	float k_xy_scale_factor;\n"
+"	for (pos.y = get_global_id(1); pos.y < height; pos.y += get_global_size(1)) {\n"
+"		for (pos.x = get_global_id(0); pos.x < width; pos.x += get_global_size(0)) {\n"
+"			if (gradient[pos.x + pos.y*width + offset] != 0) {\n"
+"\n"
+"				c_pos = pos/2;	//position in the coarser grid\n"
+"\n"
+"				//neighbours need to be left or right dependent on where we are\n"
+"				neighbour.x = (pos.x & 1) ? 1 : -1;\n"
+"				neighbour.y = (pos.y & 1) ? 1 : -1;\n"
+"\n"
+"\n"
+"				//this stops us from going out of bounds\n"
+"				if ((c_pos.x + neighbour.x) < 0) neighbour.x = 0;\n"
+"				if ((c_pos.y + neighbour.y) < 0) neighbour.y = 0;\n"
+"				if ((c_pos.x + neighbour.x) >= c_width)\tneighbour.x = 0;\n"
+"				if ((c_pos.y + neighbour.y) >= c_height) neighbour.y = 0;\n"
+"				if (c_pos.x == c_width)\tc_pos.x -= 1;\n"
+"				if (c_pos.y == c_height) c_pos.y -= 1;\n"
+"\n"
+"				k_xy_atten_func = 9.0*atten_func[c_pos.x 				+ c_pos.y					*c_width	+ c_offset]\n"
+"								+ 3.0*atten_func[c_pos.x+neighbour.x 	+ c_pos.y					*c_width	+ c_offset]\n"
+"								+ 3.0*atten_func[c_pos.x 				+ (c_pos.y+neighbour.y)		*c_width	+ c_offset]\n"
+"								+ 1.0*atten_func[c_pos.x+neighbour.x 	+ (c_pos.y+neighbour.y)		*c_width	+ c_offset];\n"
+"\n"
+"				k_xy_scale_factor = (k_alpha[level]/gradient[pos.x + pos.y*width + offset])*pow(gradient[pos.x + pos.y*width + offset]/k_alpha[level], beta);\n"
+"				atten_func[pos.x + pos.y*width + offset] = (1.f/16.f)*(k_xy_atten_func)*k_xy_scale_factor;\n"
+"			}\n"
+"			else atten_func[pos.x + pos.y*width + offset] = 0.f;\n"
+"		}\n"
+"	}\n"
+"}\n"
+"\n"
+"//finds gradients in x and y direction and attenuates them using the previously computed attenuation function\n"
+"kernel void grad_atten(	__global float* atten_grad_x,	//array to store the attenuated gradient in x dimension\n"
+"						__global float* atten_grad_y,	//array to store the attenuated gradeint in y dimension\n"
+"						__global float* lum,			//original luminance of the image\n"
+"						__global float* atten_func,	//attenuation function\n"
+"						const int2 img_size) {\n"
+"	int2 pos;\n"
+"	float2 grad;\n"
+"	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {\n"
+"		for (pos.x = get_global_id(0); pos.x < img_size.x; pos.x += get_global_size(0)) {	\n"
+"			grad.x = (pos.x < img_size.x-1 ) ? (lum[pos.x+1 +\t	 pos.y*img_size.x] - lum[pos.x + pos.y*img_size.x]) : 0;\n"
+"			grad.y = (pos.y < img_size.y-1) ? (lum[pos.x\t + (pos.y+1)*img_size.x] - lum[pos.x + pos.y*img_size.x]) : 0;\n"
+"			atten_grad_x[pos.x + pos.y*img_size.x] = grad.x*atten_func[pos.x + pos.y*img_size.x];\n"
+"			atten_grad_y[pos.x + pos.y*img_size.x] = grad.y*atten_func[pos.x + pos.y*img_size.x];\n"
+"		}\n"
+"	}\n"
+"}\n"
+"\n"
+"//computes the divergence field of the attenuated gradients\n"
+"//the gradients outside the image are taken to be zero which makes it consistent with neumann boundaries\n"
+"kernel void divG(	__global float* atten_grad_x,	//attenuated gradient in x direction\n"
+"					__global float* atten_grad_y,	//attenuated gradient in y direction\n"
+"					__global float* div_grad,		//array to store the divergence field of the gradients\n"
+"					const int2 img_size) {\n"
+"	int2 pos;\n"
+"	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {\n"
+"		for (pos.x = get_global_id(0); pos.x < img_size.x; pos.x += get_global_size(0)) {\n"
+"			div_grad[pos.x + pos.y*img_size.x] 	= (atten_grad_x[pos.x + pos.y*img_size.x] - ((pos.x > 0) ? atten_grad_x[(pos.x-1) + pos.y*img_size.x] : 0))\n"
+"											+ (atten_grad_y[pos.x + pos.y*img_size.x] - ((pos.y > 0) ? atten_grad_y[pos.x + (pos.y-1)*img_size.x] : 0));\n"
+"		}\n"
+"	}\n"
+"}\n"
+"\n"
+"//performs one red-black Gauss-Seidel sweep of the poisson equation, updating only the pixels of the given colour\n"
+"//pixels which change by more than the convergence criteria are counted in unconverged\n"
+"kernel void poisson_rb(	__global float* dr,				//current estimate of the compressed dynamic range, updated in place\n"
+"						__global float* div_grad,		//divergence field of the attenuated gradients\n"
+"						__global uint* unconverged,		//number of pixels which haven't converged yet\n"
+"						const float convergence,		//a pixel has converged once it changes by less than this\n"
+"						const int colour,				//0 to update the red pixels, 1 to update the black pixels\n"
+"						const int2 img_size) {\n"
+"	__local uint l_unconverged;\n"
+"	const int lid = get_local_id(0) + get_local_id(1)*get_local_size(0);\n"
+"	if (lid == 0) l_unconverged = 0;\n"
+"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+"\n"
+"	int2 pos;\n"
+"	float prev, new_dr, diff;\n"
+"	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {\n"
+"		for (int i = get_global_id(0); i < (img_size.x+1)/2; i += get_global_size(0)) {\n"
+"			pos.x = 2*i + ((pos.y + colour) & 1);	//pixels of the same colour are two apart in each row\n"
+"			if (pos.x >= img_size.x) continue;\n"
+"\n"
+"			prev\t= ((pos.x-1 >= 0)\t\t\t? dr[pos.x-1 +\t\t pos.y*img_size.x] : 0)\n"
+"				\t+ ((pos.x+1 < img_size.x)\t? dr[pos.x+1 +\t\t pos.y*img_size.x] : 0)\n"
+"				\t+ ((pos.y-1 >= 0)\t\t\t? dr[pos.x\t + (pos.y-1)*img_size.x] : 0)\n"
+"				\t+ ((pos.y+1 < img_size.y) ? dr[pos.x\t + (pos.y+1)*img_size.x] : 0);\n"
+"\n"
+"			new_dr = 0.25f*(prev - div_grad[pos.x + pos.y*img_size.x]);\n"
+"			diff = new_dr - dr[pos.x + pos.y*img_size.x];\n"
+"			diff = (diff >= 0) ? diff : -diff;\n"
+"			dr[pos.x + pos.y*img_size.x] = new_dr;\n"
+"\n"
+"			if (diff >= convergence) atomic_inc(&l_unconverged);\n"
+"		}\n"
+"	}\n"
+"\n"
+"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+"	if (lid == 0 && l_unconverged != 0) atomic_add(unconverged, l_unconverged);\n"
+"}\n"
+"\n"
+"//reconstructs the colour image from the compressed dynamic range computed by the poisson solver\n"
+"kernel void tonemap(__read_only image2d_t input_image,\n"
+"					__write_only image2d_t output_image,\n"
+"					__global float* lum,	//original log luminance of the image\n"
+"					__global float* dr,		//compressed log luminance of the image\n"
+"					const int2 img_size,\n"
+"					const float sat) {\n"
+"	int2 pos;\n"
+"	floatv r, g, b, a;\n"
+"	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {\n"
+"		for (pos.x = get_global_id(0)*VECTOR_WIDTH; pos.x < img_size.x; pos.x += get_global_size(0)*VECTOR_WIDTH) {\n"
+"			read_pixels(input_image, pos, img_size.x, &r, &g, &b, &a);\n"
+"\n"
+"			int remaining = img_size.x - pos.x;\n"
+"			floatv L\t= exp(read_values(lum, pos.x + pos.y*img_size.x, remaining));\n"
+"			floatv Ld = exp(read_values(dr, pos.x + pos.y*img_size.x, remaining));\n"
+"\n"
+"			write_pixels(output_image, pos, img_size.x,\n"
+"				pow(r/L, (floatv)sat)*Ld,\n"
+"				pow(g/L, (floatv)sat)*Ld,\n"
+"				pow(b/L, (floatv)sat)*Ld, a);\n"
+"		}\n"
+"	}\n"
+"}\n"
+;
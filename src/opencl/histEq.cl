@@ -6,94 +6,91 @@
 // license terms please see the LICENSE file distributed with this
 // source code.
 
-float GL_to_CL(uint val);
-float3 RGBtoHSV(uint4 rgb);
+float3 RGBtoHSV(float4 rgb);
 uint4 HSVtoRGB(float3 hsv);
 
-const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_NEAREST;
-
-//use this one for android because android's opencl specification is buggy
-kernel void transfer_data(__read_only image2d_t input_image, __global float* image) {
-	int2 pos;
-	uint4 pixel;
-	for (pos.y = get_global_id(1); pos.y < HEIGHT; pos.y += get_global_size(1)) {
-		for (pos.x = get_global_id(0); pos.x < WIDTH; pos.x += get_global_size(0)) {
-			pixel = read_imageui(input_image, sampler, pos);
-			image[(pos.x + pos.y*WIDTH)*NUM_CHANNELS + 0] = GL_to_CL(pixel.x);
-			image[(pos.x + pos.y*WIDTH)*NUM_CHANNELS + 1] = GL_to_CL(pixel.y);
-			image[(pos.x + pos.y*WIDTH)*NUM_CHANNELS + 2] = GL_to_CL(pixel.z);		
-			image[(pos.x + pos.y*WIDTH)*NUM_CHANNELS + 3] = GL_to_CL(pixel.w);
-		}
-	}
+//histogram bin of a brightness, radiance brighter than 8-bit white going in the last one
+int brightness_bin(float brightness) {
+	return clamp((int)(brightness + 0.5f), 0, HIST_SIZE-1);
 }
 
-//computes the histogram for brightness
-kernel void partial_hist(__global float* image, __global uint* partial_histogram) {
+//computes the histogram for brightness of the pixels read by each work group
+//neighbouring work items increment different copies of the local histogram, the copies of a bin being adjacent
+//so that pixels of the same brightness, which are common, don't serialise on a single counter
+kernel void partial_hist(__read_only image2d_t input_image, __global uint* partial_histogram, const int2 img_size) {
 	const int global_size = get_global_size(0);
 	const int group_size = get_local_size(0);
 	const int group_id = get_group_id(0);
 	const int lid = get_local_id(0);
+	const int replica = lid % HIST_REPLICAS;
 
-	__local uint l_hist[HIST_SIZE];
-	for (int i = lid; i < HIST_SIZE; i+=group_size) {
+	__local uint l_hist[HIST_SIZE*HIST_REPLICAS];
+	for (int i = lid; i < HIST_SIZE*HIST_REPLICAS; i+=group_size) {
 		l_hist[i] = 0;
 	}
+	barrier(CLK_LOCAL_MEM_FENCE);
 
+	int2 pos;
+	float4 pixel;
 	int brightness;
-	for (int i = get_global_id(0); i < WIDTH*HEIGHT; i += global_size) {
-		brightness = max(max(image[i*NUM_CHANNELS + 0], image[i*NUM_CHANNELS + 1]), image[i*NUM_CHANNELS + 2]);
-		barrier(CLK_LOCAL_MEM_FENCE);
-		atomic_inc(&l_hist[brightness]);
+	for (int i = get_global_id(0); i < img_size.x*img_size.y; i += global_size) {
+		pos.x = i % img_size.x;
+		pos.y = i / img_size.x;
+		pixel = read_input(input_image, pos);
+		brightness = brightness_bin(max(max(pixel.x, pixel.y), pixel.z));
+		atomic_inc(&l_hist[brightness*HIST_REPLICAS + replica]);
 	}
-
 	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//combine the copies
 	for (int i = lid; i < HIST_SIZE; i+=group_size) {
-		partial_histogram[i + group_id * HIST_SIZE] = l_hist[i];
+		uint sum = 0;
+		for (int r = 0; r < HIST_REPLICAS; r++) sum += l_hist[i*HIST_REPLICAS + r];
+		partial_histogram[i + group_id * HIST_SIZE] = sum;
 	}
 }
 
 
-//requires global work group size to be equal to HIST_SIZE
-kernel void merge_hist(	__global uint* partial_histogram,
-						__global uint* histogram,
-						const int num_hists) {	//number of histograms in partial histogram, i.e number of workgroups in previous kernel
-	const int gid = get_global_id(0);
-
-	uint sum = 0;
-	for(uint i = 0; i < num_hists; i++) {
-		sum += partial_histogram[gid + i*HIST_SIZE];
+//merges the partial histograms and computes the cdf of the brightness histogram, in a single work group
+//the scan covers scan_size bins, the smallest power of two of at least HIST_SIZE
+kernel void hist_cdf(	__global uint* partial_histogram,
+						__global uint* cdf,
+						const int num_hists,	//number of histograms in partial histogram, i.e number of workgroups in previous kernel
+						__local uint* scan,
+						const int scan_size) {
+	const int lid = get_local_id(0);
+	const int local_size = get_local_size(0);
+
+	for (int i = lid; i < scan_size; i += local_size) {
+		uint sum = 0;
+		if (i < HIST_SIZE) {
+			for (int h = 0; h < num_hists; h++) {
+				sum += partial_histogram[i + h*HIST_SIZE];
+			}
+			cdf[i] = sum;
+		}
+		scan[i] = sum;
 	}
 
-	histogram[gid] = sum;
-}
-
-//TODO: even though this takes barely anytime at all, could look into parrallel scan in future
-//computes the cdf of the brightness histogram
-kernel void hist_cdf( __global uint* hist) {
-	const int gid = get_global_id(0);
+	exclusive_scan(scan, scan_size);
 
-	if (gid==0)
-		for (int i=1; i<HIST_SIZE; i++) {
-			hist[i] += hist[i-1];
-		}
+	//each work item adds the bins it merged, which makes the scan inclusive
+	for (int i = lid; i < HIST_SIZE; i += local_size) {
+		cdf[i] += scan[i];
+	}
 }
 
 //kernel to perform histogram equalisation using the modified brightness cdf
-kernel void histogram_equalisation(__global float* image, write_only image2d_t output_image, __global uint* brightness_cdf) {
+kernel void histogram_equalisation(__read_only image2d_t input_image, write_only image2d_t output_image, __global uint* brightness_cdf, const int2 img_size) {
 	int2 pos;
 	uint4 pixel;
 	float3 hsv;
-	for (pos.y = get_global_id(1); pos.y < HEIGHT; pos.y += get_global_size(1)) {
-		for (pos.x = get_global_id(0); pos.x < WIDTH; pos.x += get_global_size(0)) {
-			pixel.x = image[(pos.x + pos.y*WIDTH)*NUM_CHANNELS + 0];
-			pixel.y = image[(pos.x + pos.y*WIDTH)*NUM_CHANNELS + 1];
-			pixel.z = image[(pos.x + pos.y*WIDTH)*NUM_CHANNELS + 2];
-			pixel.w = image[(pos.x + pos.y*WIDTH)*NUM_CHANNELS + 3];
-
-			hsv = RGBtoHSV(pixel);		//Convert to HSV to get Hue and Saturation
+	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {
+		for (pos.x = get_global_id(0); pos.x < img_size.x; pos.x += get_global_size(0)) {
+			hsv = RGBtoHSV(read_input(input_image, pos));		//Convert to HSV to get Hue and Saturation
 
-			hsv.z = ((HIST_SIZE-1)*(brightness_cdf[(int)hsv.z] - brightness_cdf[0]))
-						/(HEIGHT*WIDTH - brightness_cdf[0]);
+			hsv.z = ((HIST_SIZE-1)*(brightness_cdf[brightness_bin(hsv.z)] - brightness_cdf[0]))
+						/(img_size.x*img_size.y - brightness_cdf[0]);
 
 			pixel = HSVtoRGB(hsv);	//Convert back to RGB with the modified brightness for V
 
@@ -102,7 +99,7 @@ kernel void histogram_equalisation(__global float* image, write_only image2d_t o
 	}
 }
 
-float3 RGBtoHSV(uint4 rgb) {
+float3 RGBtoHSV(float4 rgb) {
 	float r = rgb.x;
 	float g = rgb.y;
 	float b = rgb.z;
@@ -183,17 +180,3 @@ uint4 HSVtoRGB(float3 hsv) {
 	}
 	return rgb;
 }
-
-//a function to read an OpenGL texture pixel when using Snapdragon's Android OpenCL implementation
-float GL_to_CL(uint val) {
-	if (BUGGY_CL_GL) {
-		if (val >= 14340) return round(0.1245790*val - 1658.44);	//>=128
-		if (val >= 13316) return round(0.0622869*val - 765.408);	//>=64
-		if (val >= 12292) return round(0.0311424*val - 350.800);	//>=32
-		if (val >= 11268) return round(0.0155702*val - 159.443);	//>=16
-	
-		float v = (float) val;
-		return round(0.0000000000000125922*pow(v,4.f) - 0.00000000026729*pow(v,3.f) + 0.00000198135*pow(v,2.f) - 0.00496681*v - 0.0000808829);
-	}
-	else return (float)val;
-}
\ No newline at end of file
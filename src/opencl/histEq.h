@@ -0,0 +1,184 @@
+static const char *histEq_kernel =
+"// histEq.cl (HDR)\n"
+"// Copyright (c) 2014, Amir Chohan,\n"
+"// University of Bristol. All rights reserved.\n"
+"//\n"
+"// This program is provided under a three-clause BSD license. For full\n"
+"// license terms please see the LICENSE file distributed with this\n"
+"// source code.\n"
+"\n"
+"float3 RGBtoHSV(float4 rgb);\n"
+"uint4 HSVtoRGB(float3 hsv);\n"
+"\n"
+"//histogram bin of a brightness, radiance brighter than 8-bit white going in the last one\n"
+"int brightness_bin(float brightness) {\n"
+"	return clamp((int)(brightness + 0.5f), 0, HIST_SIZE-1);\n"
+"}\n"
+"\n"
+"//computes the histogram for brightness of the pixels read by each work group\n"
+"//neighbouring work items increment different copies of the local histogram, the copies of a bin being adjacent\n"
+"//so that pixels of the same brightness, which are common, don't serialise on a single counter\n"
+"kernel void partial_hist(__read_only image2d_t input_image, __global uint* partial_histogram, const int2 img_size) {\n"
+"	const int global_size = get_global_size(0);\n"
+"	const int group_size = get_local_size(0);\n"
+"	const int group_id = get_group_id(0);\n"
+"	const int lid = get_local_id(0);\n"
+"	const int replica = lid % HIST_REPLICAS;\n"
+"\n"
+"	__local uint l_hist[HIST_SIZE*HIST_REPLICAS];\n"
+"	for (int i = lid; i < HIST_SIZE*HIST_REPLICAS; i+=group_size) {\n"
+"		l_hist[i] = 0;\n"
+"	}\n"
+"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+"\n"
+"	int2 pos;\n"
+"	float4 pixel;\n"
+"	int brightness;\n"
+"	for (int i = get_global_id(0); i < img_size.x*img_size.y; i += global_size) {\n"
+"		pos.x = i % img_size.x;\n"
+"		pos.y = i / img_size.x;\n"
+"		pixel = read_input(input_image, pos);\n"
+"		brightness = brightness_bin(max(max(pixel.x, pixel.y), pixel.z));\n"
+"		atomic_inc(&l_hist[brightness*HIST_REPLICAS + replica]);\n"
+"	}\n"
+"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+"\n"
+"	//combine the copies\n"
+"	for (int i = lid; i < HIST_SIZE; i+=group_size) {\n"
+"		uint sum = 0;\n"
+"		for (int r = 0; r < HIST_REPLICAS; r++) sum += l_hist[i*HIST_REPLICAS + r];\n"
+"		partial_histogram[i + group_id * HIST_SIZE] = sum;\n"
+"	}\n"
+"}\n"
+"\n"
+"\n"
+"//merges the partial histograms and computes the cdf of the brightness histogram, in a single work group\n"
+"//the scan covers scan_size bins, the smallest power of two of at least HIST_SIZE\n"
+"kernel void hist_cdf(	__global uint* partial_histogram,\n"
+"						__global uint* cdf,\n"
+"						const int num_hists,	//number of histograms in partial histogram, i.e number of workgroups in previous kernel\n"
+"						__local uint* scan,\n"
+"						const int scan_size) {\n"
+"	const int lid = get_local_id(0);\n"
+"	const int local_size = get_local_size(0);\n"
+"\n"
+"	for (int i = lid; i < scan_size; i += local_size) {\n"
+"		uint sum = 0;\n"
+"		if (i < HIST_SIZE) {\n"
+"			for (int h = 0; h < num_hists; h++) {\n"
+"				sum += partial_histogram[i + h*HIST_SIZE];\n"
+"			}\n"
+"			cdf[i] = sum;\n"
+"		}\n"
+"		scan[i] = sum;\n"
+"	}\n"
+"\n"
+"	exclusive_scan(scan, scan_size);\n"
+"\n"
+"	//each work item adds the bins it merged, which makes the scan inclusive\n"
+"	for (int i = lid; i < HIST_SIZE; i += local_size) {\n"
+"		cdf[i] += scan[i];\n"
+"	}\n"
+"}\n"
+"\n"
+"//kernel to perform histogram equalisation using the modified brightness cdf\n"
+"kernel void histogram_equalisation(__read_only image2d_t input_image, write_only image2d_t output_image, __global uint* brightness_cdf, const int2 img_size) {\n"
+"	int2 pos;\n"
+"	uint4 pixel;\n"
+"	float3 hsv;\n"
+"	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {\n"
+"		for (pos.x = get_global_id(0); pos.x < img_size.x; pos.x += get_global_size(0)) {\n"
+"			hsv = RGBtoHSV(read_input(input_image, pos));		//Convert to HSV to get Hue and Saturation\n"
+"\n"
+"			hsv.z = ((HIST_SIZE-1)*(brightness_cdf[brightness_bin(hsv.z)] - brightness_cdf[0]))\n"
+"						/(img_size.x*img_size.y - brightness_cdf[0]);\n"
+"\n"
+"			pixel = HSVtoRGB(hsv);	//Convert back to RGB with the modified brightness for V\n"
+"\n"
+"			write_imageui(output_image, pos, pixel);\n"
+"		}\n"
+"	}\n"
+"}\n"
+"\n"
+"float3 RGBtoHSV(float4 rgb) {\n"
+"	float r = rgb.x;\n"
+"	float g = rgb.y;\n"
+"	float b = rgb.z;\n"
+"	float rgb_min, rgb_max, delta;\n"
+"	rgb_min = min(min(r, g), b);\n"
+"	rgb_max = max(max(r, g), b);\n"
+"\n"
+"	float3 hsv;\n"
+"\n"
+"	hsv.z = rgb_max;	//Brightness\n"
+"	delta = rgb_max - rgb_min;\n"
+"	if(rgb_max != 0) hsv.y = delta/rgb_max;//Saturation\n"
+"	else {	// r = g = b = 0	//Saturation = 0, Value is undefined\n"
+"		hsv.y = 0;\n"
+"		hsv.x = -1;\n"
+"		return hsv;\n"
+"	}\n"
+"\n"
+"	//Hue\n"
+"	if(r == rgb_max) 		hsv.x = (g-b)/delta;\n"
+"	else if(g == rgb_max) 	hsv.x = (b-r)/delta + 2;\n"
+"	else 			 		hsv.x = (r-g)/delta + 4;\n"
+"	hsv.x *= 60;				\n"
+"	if( hsv.x < 0 ) hsv.x += 360;\n"
+"\n"
+"	return hsv;\n"
+"}\n"
+"\n"
+"uint4 HSVtoRGB(float3 hsv) {\n"
+"	int i;\n"
+"	float h = hsv.x;\n"
+"	float s = hsv.y;\n"
+"	float v = hsv.z;\n"
+"	float f, p, q, t;\n"
+"	uint4 rgb;\n"
+"	rgb.w = 0;\n"
+"	if( s == 0 ) { // achromatic (grey)\n"
+"		rgb.x = rgb.y = rgb.z = v;\n"
+"		return rgb;\n"
+"	}\n"
+"	h /= 60;			// sector 0 to 5\n"
+"	i = floor( h );\n"
+"	f = h - i;			// factorial part of h\n"
+"	p = v * ( 1 - s );\n"
+"	q = v * ( 1 - s * f );\n"
+"	t = v * ( 1 - s * ( 1 - f ) );\n"
+"	switch( i ) {\n"
+"		case 0:\n"
+"			rgb.x = v;\n"
+"			rgb.y = t;\n"
+"			rgb.z = p;\n"
+"			break;\n"
+"		case 1:\n"
+"			rgb.x = q;\n"
+"			rgb.y = v;\n"
+"			rgb.z = p;\n"
+"			break;\n"
+"		case 2:\n"
+"			rgb.x = p;\n"
+"			rgb.y = v;\n"
+"			rgb.z = t;\n"
+"			break;\n"
+"		case 3:\n"
+"			rgb.x = p;\n"
+"			rgb.y = q;\n"
+"			rgb.z = v;\n"
+"			break;\n"
+"		case 4:\n"
+"			rgb.x = t;\n"
+"			rgb.y = p;\n"
+"			rgb.z = v;\n"
+"			break;\n"
+"		default:		// case 5:\n"
+"			rgb.x = v;\n"
+"			rgb.y = p;\n"
+"			rgb.z = q;\n"
+"			break;\n"
+"	}\n"
+"	return rgb;\n"
+"}\n"
+;
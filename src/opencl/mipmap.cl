@@ -0,0 +1,79 @@
+// mipmap.cl (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+//computes num_levels mipmap levels from level first_level-1, each pixel being the average of 2x2 pixels of the previous level
+//every work group reads a tile of the previous level and keeps halving it in local memory
+//so the local size must be divisible by 2^(num_levels-1) in both dimensions
+kernel void mipmap_pyramid(	__global float* mipmap,	//array containing all the mipmap levels
+							__global int* m_width,	//width of each of the mipmaps
+							__global int* m_height,	//height of each of the mipmaps
+							__global int* m_offset,	//start point of each of the mipmaps
+							const int first_level,	//first level being generated
+							const int num_levels,	//number of levels being generated
+							__local float* tile) {	//one value for each work item
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int tile_width = get_local_size(0);
+	const int tile_height = get_local_size(1);
+
+	const int prev_width = m_width[first_level-1];
+	const int prev_offset = m_offset[first_level-1];
+	const int num_tiles_x = (m_width[first_level] + tile_width-1)/tile_width;
+	const int num_tiles_y = (m_height[first_level] + tile_height-1)/tile_height;
+
+	int2 tile_pos, pos;
+	for (tile_pos.y = get_group_id(1); tile_pos.y < num_tiles_y; tile_pos.y += get_num_groups(1)) {
+		for (tile_pos.x = get_group_id(0); tile_pos.x < num_tiles_x; tile_pos.x += get_num_groups(0)) {
+
+			//the first level is computed from global memory
+			int level = first_level;
+			pos.x = tile_pos.x*tile_width + lx;
+			pos.y = tile_pos.y*tile_height + ly;
+			float value = 0.f;
+			if (pos.x < m_width[level] && pos.y < m_height[level]) {
+				int _x = 2*pos.x;
+				int _y = 2*pos.y;
+				value = (mipmap[_x + _y*prev_width + prev_offset]
+						+ mipmap[_x+1 + _y*prev_width + prev_offset]
+						+ mipmap[_x + (_y+1)*prev_width + prev_offset]
+						+ mipmap[(_x+1) + (_y+1)*prev_width + prev_offset])/4.f;
+				mipmap[pos.x + pos.y*m_width[level] + m_offset[level]] = value;
+			}
+			tile[lx + ly*tile_width] = value;
+			barrier(CLK_LOCAL_MEM_FENCE);
+
+			//the following ones from the tile, which is halved in both dimensions at every level
+			int width = tile_width;
+			int height = tile_height;
+			for (int i = 1; i < num_levels; i++) {
+				level = first_level + i;
+				width /= 2;
+				height /= 2;
+				bool active = lx < width && ly < height;
+
+				if (active) {
+					value = (tile[2*lx + 2*ly*tile_width]
+							+ tile[2*lx+1 + 2*ly*tile_width]
+							+ tile[2*lx + (2*ly+1)*tile_width]
+							+ tile[2*lx+1 + (2*ly+1)*tile_width])/4.f;
+				}
+				barrier(CLK_LOCAL_MEM_FENCE);
+
+				if (active) {
+					tile[lx + ly*tile_width] = value;
+					pos.x = tile_pos.x*width + lx;
+					pos.y = tile_pos.y*height + ly;
+					if (pos.x < m_width[level] && pos.y < m_height[level]) {
+						mipmap[pos.x + pos.y*m_width[level] + m_offset[level]] = value;
+					}
+				}
+				barrier(CLK_LOCAL_MEM_FENCE);
+			}
+		}
+	}
+}
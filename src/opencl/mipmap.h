@@ -0,0 +1,81 @@
+static const char *mipmap_kernel =
+"// mipmap.cl (HDR)\n"
+"// Copyright (c) 2014, Amir Chohan,\n"
+"// University of Bristol. All rights reserved.\n"
+"//\n"
+"// This program is provided under a three-clause BSD license. For full\n"
+"// license terms please see the LICENSE file distributed with this\n"
+"// source code.\n"
+"\n"
+"//computes num_levels mipmap levels from level first_level-1, each pixel being the average of 2x2 pixels of the previous level\n"
+"//every work group reads a tile of the previous level and keeps halving it in local memory\n"
+"//so the local size must be divisible by 2^(num_levels-1) in both dimensions\n"
+"kernel void mipmap_pyramid(	__global float* mipmap,	//array containing all the mipmap levels\n"
+"							__global int* m_width,	//width of each of the mipmaps\n"
+"							__global int* m_height,	//height of each of the mipmaps\n"
+"							__global int* m_offset,	//start point of each of the mipmaps\n"
+"							const int first_level,	//first level being generated\n"
+"							const int num_levels,	//number of levels being generated\n"
+"							__local float* tile) {	//one value for each work item\n"
+"	const int lx = get_local_id(0);\n"
+"	const int ly = get_local_id(1);\n"
+"	const int tile_width = get_local_size(0);\n"
+"	const int tile_height = get_local_size(1);\n"
+"\n"
+"	const int prev_width = m_width[first_level-1];\n"
+"	const int prev_offset = m_offset[first_level-1];\n"
+"	const int num_tiles_x = (m_width[first_level] + tile_width-1)/tile_width;\n"
+"	const int num_tiles_y = (m_height[first_level] + tile_height-1)/tile_height;\n"
+"\n"
+"	int2 tile_pos, pos;\n"
+"	for (tile_pos.y = get_group_id(1); tile_pos.y < num_tiles_y; tile_pos.y += get_num_groups(1)) {\n"
+"		for (tile_pos.x = get_group_id(0); tile_pos.x < num_tiles_x; tile_pos.x += get_num_groups(0)) {\n"
+"\n"
+"			//the first level is computed from global memory\n"
+"			int level = first_level;\n"
+"			pos.x = tile_pos.x*tile_width + lx;\n"
+"			pos.y = tile_pos.y*tile_height + ly;\n"
+"			float value = 0.f;\n"
+"			if (pos.x < m_width[level] && pos.y < m_height[level]) {\n"
+"				int _x = 2*pos.x;\n"
+"				int _y = 2*pos.y;\n"
+"				value = (mipmap[_x + _y*prev_width + prev_offset]\n"
+"						+ mipmap[_x+1 + _y*prev_width + prev_offset]\n"
+"						+ mipmap[_x + (_y+1)*prev_width + prev_offset]\n"
+"						+ mipmap[(_x+1) + (_y+1)*prev_width + prev_offset])/4.f;\n"
+"				mipmap[pos.x + pos.y*m_width[level] + m_offset[level]] = value;\n"
+"			}\n"
+"			tile[lx + ly*tile_width] = value;\n"
+"			barrier(CLK_LOCAL_MEM_FENCE);\n"
+"\n"
+"			//the following ones from the tile, which is halved in both dimensions at every level\n"
+"			int width = tile_width;\n"
+"			int height = tile_height;\n"
+"			for (int i = 1; i < num_levels; i++) {\n"
+"				level = first_level + i;\n"
+"				width /= 2;\n"
+"				height /= 2;\n"
+"				bool active = lx < width && ly < height;\n"
+"\n"
+"				if (active) {\n"
+"					value = (tile[2*lx + 2*ly*tile_width]\n"
+"							+ tile[2*lx+1 + 2*ly*tile_width]\n"
+"							+ tile[2*lx + (2*ly+1)*tile_width]\n"
+"							+ tile[2*lx+1 + (2*ly+1)*tile_width])/4.f;\n"
+"				}\n"
+"				barrier(CLK_LOCAL_MEM_FENCE);\n"
+"\n"
+"				if (active) {\n"
+"					tile[lx + ly*tile_width] = value;\n"
+"					pos.x = tile_pos.x*width + lx;\n"
+"					pos.y = tile_pos.y*height + ly;\n"
+"					if (pos.x < m_width[level] && pos.y < m_height[level]) {\n"
+"						mipmap[pos.x + pos.y*m_width[level] + m_offset[level]] = value;\n"
+"					}\n"
+"				}\n"
+"				barrier(CLK_LOCAL_MEM_FENCE);\n"
+"			}\n"
+"		}\n"
+"	}\n"
+"}\n"
+;
@@ -6,135 +6,169 @@
 // license terms please see the LICENSE file distributed with this
 // source code.
 
-float GL_to_CL(uint val);
-float3 RGBtoXYZ(float3 rgb);
-
-const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_NEAREST;
-
-//this kernel computes logAvgLum and Lwhite by performing reduction
-//the results are stored in an array of size num_work_groups
-kernel void computeLogAvgLum( 	__read_only image2d_t image,
-								__global float* logAvgLum,
-								__global float* Lwhite,
-								__local float* Lwhite_loc,
-								__local float* logAvgLum_loc) {
-
-	float lum;
-	float Lwhite_acc = 0.f;		//maximum luminance in the image
-	float logAvgLum_acc = 0.f;
+//reduces the per work-item sums of log luminance and maximum luminance of the image in a single launch
+//every work group stores its partial results, the last one to finish combines them into stats
+//stats holds the log average luminance followed by Lwhite, and count must be zero before the launch
+void reduceLogAvgLum(	float logAvgLum_acc,
+						float Lwhite_acc,
+						volatile __global float* logAvgLum,
+						volatile __global float* Lwhite,
+						__local float* logAvgLum_loc,
+						__local float* Lwhite_loc,
+						__local bool* last_group,
+						volatile __global uint* count,
+						__global float* stats,
+						const int2 img_size) {
+
+	const int lid = get_local_id(0) + get_local_id(1)*get_local_size(0);	//local id in one dimension
+	const int local_size = get_local_size(0)*get_local_size(1);
+	const int num_work_groups = get_num_groups(0)*get_num_groups(1);
+	const int group_id = get_group_id(0) + get_group_id(1)*get_num_groups(0);
+
+	for (int pass = 0; pass < 2; pass++) {
+		Lwhite_loc[lid] = Lwhite_acc;
+		logAvgLum_loc[lid] = logAvgLum_acc;
+
+		// Perform parallel reduction
+		barrier(CLK_LOCAL_MEM_FENCE);
 
-	int2 pos;
-	uint4 pixel;
-	for (pos.y = get_global_id(1); pos.y < HEIGHT; pos.y += get_global_size(1)) {
-		for (pos.x = get_global_id(0); pos.x < WIDTH; pos.x += get_global_size(0)) {
-			pixel = read_imageui(image, sampler, pos);
-			lum = GL_to_CL(pixel.x)*0.2126
-				+ GL_to_CL(pixel.y)*0.7152
-				+ GL_to_CL(pixel.z)*0.0722;
-
-			Lwhite_acc = (lum > Lwhite_acc) ? lum : Lwhite_acc;
-			logAvgLum_acc += log(lum + 0.000001);
+		for(int offset = local_size/2; offset > 0; offset = offset/2) {
+			if (lid < offset) {
+				Lwhite_loc[lid] = (Lwhite_loc[lid+offset] > Lwhite_loc[lid]) ? Lwhite_loc[lid+offset] : Lwhite_loc[lid];
+				logAvgLum_loc[lid] += logAvgLum_loc[lid + offset];
+			}
+			barrier(CLK_LOCAL_MEM_FENCE);
 		}
-	}
 
-	pos.x = get_local_id(0);
-	pos.y = get_local_id(1);
-	const int lid = pos.x + pos.y*get_local_size(0);	//local id in one dimension
-	Lwhite_loc[lid] = Lwhite_acc;
-	logAvgLum_loc[lid] = logAvgLum_acc;
+		if (pass == 1) break;
 
-	// Perform parallel reduction
-	barrier(CLK_LOCAL_MEM_FENCE);
-
-	for(int offset = (get_local_size(0)*get_local_size(1))/2; offset > 0; offset = offset/2) {
-		if (lid < offset) {
-			Lwhite_loc[lid] = (Lwhite_loc[lid+offset] > Lwhite_loc[lid]) ? Lwhite_loc[lid+offset] : Lwhite_loc[lid];
-			logAvgLum_loc[lid] += logAvgLum_loc[lid + offset];
+		//the partial results must be visible to the other work groups before the count is incremented
+		//mem_fence only orders them within this work item, they are volatile so they bypass non-coherent caches
+		if (lid == 0) {
+			Lwhite[group_id] = Lwhite_loc[0];
+			logAvgLum[group_id] = logAvgLum_loc[0];
+			mem_fence(CLK_GLOBAL_MEM_FENCE);
+			*last_group = (atomic_inc(count) == num_work_groups-1);
 		}
 		barrier(CLK_LOCAL_MEM_FENCE);
+		if (!*last_group) return;
+
+		//the last work group reduces the partial results of all the work groups
+		Lwhite_acc = 0.f;
+		logAvgLum_acc = 0.f;
+		for (int i = lid; i < num_work_groups; i += local_size) {
+			Lwhite_acc = (Lwhite[i] > Lwhite_acc) ? Lwhite[i] : Lwhite_acc;
+			logAvgLum_acc += logAvgLum[i];
+		}
 	}
 
-	const int num_work_groups = get_global_size(0)/get_local_size(0);	//number of workgroups in x dim
-	const int group_id = get_group_id(0) + get_group_id(1)*num_work_groups;
 	if (lid == 0) {
-		Lwhite[group_id] = Lwhite_loc[0];
-		logAvgLum[group_id] = logAvgLum_loc[0];
+		stats[0] = exp(logAvgLum_loc[0]/((float)img_size.x*img_size.y));
+		stats[1] = Lwhite_loc[0];
+		*count = 0;	//ready for the next launch
 	}
 }
 
-//combines the results of computeLogAvgLum kernel
-kernel void finalReduc(	__global float* logAvgLum_acc,
-						__global float* Lwhite_acc,
-						const unsigned int num_reduc_bins) {
-	if (get_global_id(0)==0) {
-
-		float Lwhite = 0.f;
-		float logAvgLum = 0.f;
-	
-		for (int i=0; i<num_reduc_bins; i++) {
-			if (Lwhite < Lwhite_acc[i]) Lwhite = Lwhite_acc[i];
-			logAvgLum += logAvgLum_acc[i];
+//this kernel computes logAvgLum and Lwhite of the image, which are stored in stats
+kernel void computeLogAvgLum( 	__read_only image2d_t image,
+								volatile __global float* logAvgLum,
+								volatile __global float* Lwhite,
+								__local float* Lwhite_loc,
+								__local float* logAvgLum_loc,
+								volatile __global uint* count,
+								__global float* stats,
+								const int2 img_size) {
+
+	__local bool last_group;	//local variables can only be declared in kernels
+	float Lwhite_acc = 0.f;		//maximum luminance in the image
+	float logAvgLum_acc = 0.f;
+
+	int2 pos;
+	floatv r, g, b, a, lum;
+	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {
+		for (pos.x = get_global_id(0)*VECTOR_WIDTH; pos.x < img_size.x; pos.x += get_global_size(0)*VECTOR_WIDTH) {
+			read_pixels(image, pos, img_size.x, &r, &g, &b, &a);
+			lum = luminance(r, g, b);
+
+			Lwhite_acc = fmax(Lwhite_acc, max_components(lum));	//pixels past the end of the row are black
+			logAvgLum_acc += sum_components(lane_mask(img_size.x - pos.x)*log(lum + 0.000001f));
 		}
-		Lwhite_acc[0] = Lwhite;
-		logAvgLum_acc[0] = exp(logAvgLum/((float)WIDTH*HEIGHT));
 	}
-	else return;
+
+	reduceLogAvgLum(logAvgLum_acc, Lwhite_acc, logAvgLum, Lwhite, logAvgLum_loc, Lwhite_loc, &last_group, count, stats, img_size);
+}
+
+//display luminance of the world luminance Y, scaled so that the log average luminance becomes the key
+floatv globalMapping(floatv Y, const float scale, const float Lwhite) {
+	floatv L = scale * Y;
+	return (L * (1.f + L/(Lwhite * Lwhite)) )/(1.f + L);
 }
 
 //Reinhard's Global Tone-Mapping Operator
 kernel void reinhardGlobal(	__read_only image2d_t input_image,
 							__write_only image2d_t output_image,
-							__global float* logAvgLum_acc,
-							__global float* Lwhite_acc) {
-	float Lwhite = Lwhite_acc[0];
-	float logAvgLum = logAvgLum_acc[0];
+							__global float* stats,
+							const int2 img_size,
+							const float key,
+							const float sat) {
+	float logAvgLum = stats[0];
+	float Lwhite = stats[1];
 
 	int2 pos;
-	uint4 pixel;
-	float3 rgb, xyz;
-	for (pos.y = get_global_id(1); pos.y < HEIGHT; pos.y += get_global_size(1)) {
-		for (pos.x = get_global_id(0); pos.x < WIDTH; pos.x += get_global_size(0)) {
-			pixel = read_imageui(input_image, sampler, pos);
-
-			rgb.x = GL_to_CL(pixel.x);
-			rgb.y = GL_to_CL(pixel.y);
-			rgb.z = GL_to_CL(pixel.z);
-
-			xyz = RGBtoXYZ(rgb);
-
-			float L  = ((KEY*1.f)/logAvgLum) * xyz.y;
-			float Ld = (L * (1.f + L/(Lwhite * Lwhite)) )/(1.f + L);
-
-			pixel.x = clamp((pow(rgb.x/xyz.y, (float)SAT)*Ld)*255.f, 0.f, 255.f);
-			pixel.y = clamp((pow(rgb.y/xyz.y, (float)SAT)*Ld)*255.f, 0.f, 255.f);
-			pixel.z = clamp((pow(rgb.z/xyz.y, (float)SAT)*Ld)*255.f, 0.f, 255.f);
-			write_imageui(output_image, pos, pixel);
+	floatv r, g, b, a;
+	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {
+		for (pos.x = get_global_id(0)*VECTOR_WIDTH; pos.x < img_size.x; pos.x += get_global_size(0)*VECTOR_WIDTH) {
+			read_pixels(input_image, pos, img_size.x, &r, &g, &b, &a);
+			floatv Y = luminance(r, g, b);
+			floatv Ld = globalMapping(Y, key/logAvgLum, Lwhite);
+
+			write_pixels(output_image, pos, img_size.x,
+				pow(r/Y, (floatv)sat)*Ld*255.f,
+				pow(g/Y, (floatv)sat)*Ld*255.f,
+				pow(b/Y, (floatv)sat)*Ld*255.f, a);
 		}
 	}
 }
 
+//tone maps the image with the logAvgLum and Lwhite of the previous frame while computing those of this frame
+//so the image is only read once, for video where the luminance changes little between frames
+kernel void reinhardGlobalFused(	__read_only image2d_t input_image,
+									__write_only image2d_t output_image,
+									volatile __global float* logAvgLum,
+									volatile __global float* Lwhite,
+									__local float* Lwhite_loc,
+									__local float* logAvgLum_loc,
+									volatile __global uint* count,
+									__global float* stats,
+									const int2 img_size,
+									const float key,
+									const float sat) {
+	//stats is only overwritten by the last work group, after every other one has read it
+	const float prev_logAvgLum = stats[0];
+	const float prev_Lwhite = stats[1];
+	__local bool last_group;
+
+	float Lwhite_acc = 0.f;
+	float logAvgLum_acc = 0.f;
 
+	int2 pos;
+	floatv r, g, b, a;
+	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {
+		for (pos.x = get_global_id(0)*VECTOR_WIDTH; pos.x < img_size.x; pos.x += get_global_size(0)*VECTOR_WIDTH) {
+			read_pixels(input_image, pos, img_size.x, &r, &g, &b, &a);
+			floatv Y = luminance(r, g, b);
 
+			Lwhite_acc = fmax(Lwhite_acc, max_components(Y));
+			logAvgLum_acc += sum_components(lane_mask(img_size.x - pos.x)*log(Y + 0.000001f));
 
-//convert an RGB pixel to XYZ format
-float3 RGBtoXYZ(float3 rgb) {
-	float3 xyz;
-	xyz.x = rgb.x*0.4124 + rgb.y*0.3576 + rgb.z*0.1805;
-	xyz.y = rgb.x*0.2126 + rgb.y*0.7152 + rgb.z*0.0722;
-	xyz.z = rgb.x*0.0193 + rgb.y*0.1192 + rgb.z*0.9505;
-	return xyz;
-}
+			floatv Ld = globalMapping(Y, key/prev_logAvgLum, prev_Lwhite);
 
-//a function to read an OpenGL texture pixel when using Snapdragon's Android OpenCL implementation
-float GL_to_CL(uint val) {
-	if (BUGGY_CL_GL) {
-		if (val >= 14340) return round(0.1245790*val - 1658.44);	//>=128
-		if (val >= 13316) return round(0.0622869*val - 765.408);	//>=64
-		if (val >= 12292) return round(0.0311424*val - 350.800);	//>=32
-		if (val >= 11268) return round(0.0155702*val - 159.443);	//>=16
-	
-		float v = (float) val;
-		return round(0.0000000000000125922*pow(v,4.f) - 0.00000000026729*pow(v,3.f) + 0.00000198135*pow(v,2.f) - 0.00496681*v - 0.0000808829);
+			write_pixels(output_image, pos, img_size.x,
+				pow(r/Y, (floatv)sat)*Ld*255.f,
+				pow(g/Y, (floatv)sat)*Ld*255.f,
+				pow(b/Y, (floatv)sat)*Ld*255.f, a);
+		}
 	}
-	else return (float)val;
-}
\ No newline at end of file
+
+	reduceLogAvgLum(logAvgLum_acc, Lwhite_acc, logAvgLum, Lwhite, logAvgLum_loc, Lwhite_loc, &last_group, count, stats, img_size);
+}
@@ -0,0 +1,176 @@
+static const char *reinhardGlobal_kernel =
+"// reinhardGlobal.cl (HDR)\n"
+"// Copyright (c) 2014, Amir Chohan,\n"
+"// University of Bristol. All rights reserved.\n"
+"//\n"
+"// This program is provided under a three-clause BSD license. For full\n"
+"// license terms please see the LICENSE file distributed with this\n"
+"// source code.\n"
+"\n"
+"//reduces the per work-item sums of log luminance and maximum luminance of the image in a single launch\n"
+"//every work group stores its partial results, the last one to finish combines them into stats\n"
+"//stats holds the log average luminance followed by Lwhite, and count must be zero before the launch\n"
+"void reduceLogAvgLum(	float logAvgLum_acc,\n"
+"						float Lwhite_acc,\n"
+"						volatile __global float* logAvgLum,\n"
+"						volatile __global float* Lwhite,\n"
+"						__local float* logAvgLum_loc,\n"
+"						__local float* Lwhite_loc,\n"
+"						__local bool* last_group,\n"
+"						volatile __global uint* count,\n"
+"						__global float* stats,\n"
+"						const int2 img_size) {\n"
+"\n"
+"	const int lid = get_local_id(0) + get_local_id(1)*get_local_size(0);	//local id in one dimension\n"
+"	const int local_size = get_local_size(0)*get_local_size(1);\n"
+"	const int num_work_groups = get_num_groups(0)*get_num_groups(1);\n"
+"	const int group_id = get_group_id(0) + get_group_id(1)*get_num_groups(0);\n"
+"\n"
+"	for (int pass = 0; pass < 2; pass++) {\n"
+"		Lwhite_loc[lid] = Lwhite_acc;\n"
+"		logAvgLum_loc[lid] = logAvgLum_acc;\n"
+"\n"
+"		// Perform parallel reduction\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+"\n"
+"		for(int offset = local_size/2; offset > 0; offset = offset/2) {\n"
+"			if (lid < offset) {\n"
+"				Lwhite_loc[lid] = (Lwhite_loc[lid+offset] > Lwhite_loc[lid]) ? Lwhite_loc[lid+offset] : Lwhite_loc[lid];\n"
+"				logAvgLum_loc[lid] += logAvgLum_loc[lid + offset];\n"
+"			}\n"
+"			barrier(CLK_LOCAL_MEM_FENCE);\n"
+"		}\n"
+"\n"
+"		if (pass == 1) break;\n"
+"\n"
+"		//the partial results must be visible to the other work groups before the count is incremented\n"
+"		//mem_fence only orders them within this work item, they are volatile so they bypass non-coherent caches\n"
+"		if (lid == 0) {\n"
+"			Lwhite[group_id] = Lwhite_loc[0];\n"
+"			logAvgLum[group_id] = logAvgLum_loc[0];\n"
+"			mem_fence(CLK_GLOBAL_MEM_FENCE);\n"
+"			*last_group = (atomic_inc(count) == num_work_groups-1);\n"
+"		}\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+"		if (!*last_group) return;\n"
+"\n"
+"		//the last work group reduces the partial results of all the work groups\n"
+"		Lwhite_acc = 0.f;\n"
+"		logAvgLum_acc = 0.f;\n"
+"		for (int i = lid; i < num_work_groups; i += local_size) {\n"
+"			Lwhite_acc = (Lwhite[i] > Lwhite_acc) ? Lwhite[i] : Lwhite_acc;\n"
+"			logAvgLum_acc += logAvgLum[i];\n"
+"		}\n"
+"	}\n"
+"\n"
+"	if (lid == 0) {\n"
+"		stats[0] = exp(logAvgLum_loc[0]/((float)img_size.x*img_size.y));\n"
+"		stats[1] = Lwhite_loc[0];\n"
+"		*count = 0;	//ready for the next launch\n"
+"	}\n"
+"}\n"
+"\n"
+"//this kernel computes logAvgLum and Lwhite of the image, which are stored in stats\n"
+"kernel void computeLogAvgLum( 	__read_only image2d_t image,\n"
+"								volatile __global float* logAvgLum,\n"
+"								volatile __global float* Lwhite,\n"
+"								__local float* Lwhite_loc,\n"
+"								__local float* logAvgLum_loc,\n"
+"								volatile __global uint* count,\n"
+"								__global float* stats,\n"
+"								const int2 img_size) {\n"
+"\n"
+"	__local bool last_group;	//local variables can only be declared in kernels\n"
+"	float Lwhite_acc = 0.f;		//maximum luminance in the image\n"
+"	float logAvgLum_acc = 0.f;\n"
+"\n"
+"	int2 pos;\n"
+"	floatv r, g, b, a, lum;\n"
+"	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {\n"
+"		for (pos.x = get_global_id(0)*VECTOR_WIDTH; pos.x < img_size.x; pos.x += get_global_size(0)*VECTOR_WIDTH) {\n"
+"			read_pixels(image, pos, img_size.x, &r, &g, &b, &a);\n"
+"			lum = luminance(r, g, b);\n"
+"\n"
+"			Lwhite_acc = fmax(Lwhite_acc, max_components(lum));	//pixels past the end of the row are black\n"
+"			logAvgLum_acc += sum_components(lane_mask(img_size.x - pos.x)*log(lum + 0.000001f));\n"
+"		}\n"
+"	}\n"
+"\n"
+"	reduceLogAvgLum(logAvgLum_acc, Lwhite_acc, logAvgLum, Lwhite, logAvgLum_loc, Lwhite_loc, &last_group, count, stats, img_size);\n"
+"}\n"
+"\n"
+"//display luminance of the world luminance Y, scaled so that the log average luminance becomes the key\n"
+"floatv globalMapping(floatv Y, const float scale, const float Lwhite) {\n"
+"	floatv L = scale * Y;\n"
+"	return (L * (1.f + L/(Lwhite * Lwhite)) )/(1.f + L);\n"
+"}\n"
+"\n"
+"//Reinhard's Global Tone-Mapping Operator\n"
+"kernel void reinhardGlobal(	__read_only image2d_t input_image,\n"
+"							__write_only image2d_t output_image,\n"
+"							__global float* stats,\n"
+"							const int2 img_size,\n"
+"							const float key,\n"
+"							const float sat) {\n"
+"	float logAvgLum = stats[0];\n"
+"	float Lwhite = stats[1];\n"
+"\n"
+"	int2 pos;\n"
+"	floatv r, g, b, a;\n"
+"	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {\n"
+"		for (pos.x = get_global_id(0)*VECTOR_WIDTH; pos.x < img_size.x; pos.x += get_global_size(0)*VECTOR_WIDTH) {\n"
+"			read_pixels(input_image, pos, img_size.x, &r, &g, &b, &a);\n"
+"			floatv Y = luminance(r, g, b);\n"
+"			floatv Ld = globalMapping(Y, key/logAvgLum, Lwhite);\n"
+"\n"
+"			write_pixels(output_image, pos, img_size.x,\n"
+"				pow(r/Y, (floatv)sat)*Ld*255.f,\n"
+"				pow(g/Y, (floatv)sat)*Ld*255.f,\n"
+"				pow(b/Y, (floatv)sat)*Ld*255.f, a);\n"
+"		}\n"
+"	}\n"
+"}\n"
+"\n"
+"//tone maps the image with the logAvgLum and Lwhite of the previous frame while computing those of this frame\n"
+"//so the image is only read once, for video where the luminance changes little between frames\n"
+"kernel void reinhardGlobalFused(	__read_only image2d_t input_image,\n"
+"									__write_only image2d_t output_image,\n"
+"									volatile __global float* logAvgLum,\n"
+"									volatile __global float* Lwhite,\n"
+"									__local float* Lwhite_loc,\n"
+"									__local float* logAvgLum_loc,\n"
+"									volatile __global uint* count,\n"
+"									__global float* stats,\n"
+"									const int2 img_size,\n"
+"									const float key,\n"
+"									const float sat) {\n"
+"	//stats is only overwritten by the last work group, after every other one has read it\n"
+"	const float prev_logAvgLum = stats[0];\n"
+"	const float prev_Lwhite = stats[1];\n"
+"	__local bool last_group;\n"
+"\n"
+"	float Lwhite_acc = 0.f;\n"
+"	float logAvgLum_acc = 0.f;\n"
+"\n"
+"	int2 pos;\n"
+"	floatv r, g, b, a;\n"
+"	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {\n"
+"		for (pos.x = get_global_id(0)*VECTOR_WIDTH; pos.x < img_size.x; pos.x += get_global_size(0)*VECTOR_WIDTH) {\n"
+"			read_pixels(input_image, pos, img_size.x, &r, &g, &b, &a);\n"
+"			floatv Y = luminance(r, g, b);\n"
+"\n"
+"			Lwhite_acc = fmax(Lwhite_acc, max_components(Y));\n"
+"			logAvgLum_acc += sum_components(lane_mask(img_size.x - pos.x)*log(Y + 0.000001f));\n"
+"\n"
+"			floatv Ld = globalMapping(Y, key/prev_logAvgLum, prev_Lwhite);\n"
+"\n"
+"			write_pixels(output_image, pos, img_size.x,\n"
+"				pow(r/Y, (floatv)sat)*Ld*255.f,\n"
+"				pow(g/Y, (floatv)sat)*Ld*255.f,\n"
+"				pow(b/Y, (floatv)sat)*Ld*255.f, a);\n"
+"		}\n"
+"	}\n"
+"\n"
+"	reduceLogAvgLum(logAvgLum_acc, Lwhite_acc, logAvgLum, Lwhite, logAvgLum_loc, Lwhite_loc, &last_group, count, stats, img_size);\n"
+"}\n"
+;
@@ -0,0 +1,176 @@
+static const char *reinhardLocal_kernel =
+"// reinhardLocal.cl (HDR)\n"
+"// Copyright (c) 2014, Amir Chohan,\n"
+"// University of Bristol. All rights reserved.\n"
+"//\n"
+"// This program is provided under a three-clause BSD license. For full\n"
+"// license terms please see the LICENSE file distributed with this\n"
+"// source code.\n"
+"\n"
+"//this kernel computes logAvgLum by performing reduction\n"
+"//the results are stored in an array of size num_work_groups\n"
+"kernel void computeLogAvgLum( 	__read_only image2d_t image,\n"
+"								__global float* lum,\n"
+"								__global float* logAvgLum,\n"
+"								__local float* logAvgLum_loc,\n"
+"								const int2 img_size) {\n"
+"\n"
+"	float logAvgLum_acc = 0.f;\n"
+"\n"
+"	int2 pos;\n"
+"	floatv r, g, b, a, Y;\n"
+"	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {\n"
+"		for (pos.x = get_global_id(0)*VECTOR_WIDTH; pos.x < img_size.x; pos.x += get_global_size(0)*VECTOR_WIDTH) {\n"
+"			read_pixels(image, pos, img_size.x, &r, &g, &b, &a);\n"
+"			Y = luminance(r, g, b);\n"
+"\n"
+"			logAvgLum_acc += sum_components(lane_mask(img_size.x - pos.x)*log(Y + 0.000001f));\n"
+"			write_values(lum, pos.x + pos.y*img_size.x, img_size.x - pos.x, Y);\n"
+"		}\n"
+"	}\n"
+"\n"
+"	pos.x = get_local_id(0);\n"
+"	pos.y = get_local_id(1);\n"
+"	const int lid = pos.x + pos.y*get_local_size(0);	//local id in one dimension\n"
+"	logAvgLum_loc[lid] = logAvgLum_acc;\n"
+"\n"
+"	// Perform parallel reduction\n"
+"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+"\n"
+"\n"
+"	for(int offset = (get_local_size(0)*get_local_size(1))/2; offset > 0; offset = offset/2) {\n"
+"		if (lid < offset) {\n"
+"			logAvgLum_loc[lid] += logAvgLum_loc[lid + offset];\n"
+"		}\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+"	}\n"
+"\n"
+"	const int num_work_groups = get_global_size(0)/get_local_size(0);	//number of workgroups in x dim\n"
+"	const int group_id = get_group_id(0) + get_group_id(1)*num_work_groups;\n"
+"	if (lid == 0) {\n"
+"		logAvgLum[group_id] = logAvgLum_loc[0];\n"
+"	}\n"
+"}\n"
+"\n"
+"//combines the results of computeLogAvgLum kernel\n"
+"kernel void finalReduc(	__global float* logAvgLum_acc,\n"
+"						const unsigned int num_reduc_bins,\n"
+"						const int2 img_size) {\n"
+"	if (get_global_id(0)==0) {\n"
+"\n"
+"		float logAvgLum = 0.f;\n"
+"		for (int i=0; i<num_reduc_bins; i++) {\n"
+"			logAvgLum += logAvgLum_acc[i];\n"
+"		}\n"
+"		logAvgLum_acc[0] = exp(logAvgLum/((float)img_size.x*img_size.y));\n"
+"	}\n"
+"	else return;\n"
+"}\n"
+"\n"
+"//computes the mapping of the pixel at pos as per Reinhard's Local TMO, by choosing the largest scale around it with no edge\n"
+"float localMapping(	__global float* lumMips,\n"
+"					__global int* m_width,\n"
+"					__global int* m_offset,\n"
+"					const float* k,\n"
+"					const float factor,\n"
+"					const float epsilon,\n"
+"					const int2 pos) {\n"
+"	int2 centre_pos, surround_pos;\n"
+"	float local_logAvgLum = 0.f;\n"
+"	surround_pos = pos;\n"
+"	float v, centre_logAvgLum, surround_logAvgLum, cs_diff;\n"
+"	for (int i=0; i<NUM_MIPMAPS-1; i++) {\n"
+"		centre_pos = surround_pos;\n"
+"		surround_pos = centre_pos/2;\n"
+"\n"
+"		centre_logAvgLum = lumMips[centre_pos.x + centre_pos.y*m_width[i] + m_offset[i]]*factor;\n"
+"		surround_logAvgLum = lumMips[surround_pos.x + surround_pos.y*m_width[i+1] + m_offset[i+1]]*factor;\n"
+"\n"
+"		cs_diff = centre_logAvgLum - surround_logAvgLum;\n"
+"		cs_diff = cs_diff >= 0 ? cs_diff : -cs_diff;\n"
+"\n"
+"		v = cs_diff/(k[i] + centre_logAvgLum);\n"
+"\n"
+"		if (v > epsilon) {\n"
+"			local_logAvgLum = centre_logAvgLum;\n"
+"			break;\n"
+"		}\n"
+"		else local_logAvgLum = surround_logAvgLum;\n"
+"\n"
+"	}\n"
+"	return factor/(1.f + local_logAvgLum);\n"
+"}\n"
+"\n"
+"//applies the mappings to the VECTOR_WIDTH pixels of the input image starting at pos and writes them to the output image\n"
+"void tonemapPixels(	__read_only image2d_t input_image,\n"
+"					__write_only image2d_t output_image,\n"
+"					const floatv mapping,\n"
+"					const float sat,\n"
+"					const int2 pos,\n"
+"					const int width) {\n"
+"	floatv r, g, b, a;\n"
+"	read_pixels(input_image, pos, width, &r, &g, &b, &a);\n"
+"	floatv Y = luminance(r, g, b);\n"
+"\n"
+"	floatv Ld\t= mapping * Y * 255.f;\n"
+"\n"
+"	write_pixels(output_image, pos, width,\n"
+"		pow(r/Y, (floatv)sat)*Ld,\n"
+"		pow(g/Y, (floatv)sat)*Ld,\n"
+"		pow(b/Y, (floatv)sat)*Ld, a);\n"
+"}\n"
+"\n"
+"//computes the mapping for each pixel and applies it to the image\n"
+"//the mappings are only stored in Ld_array when store_mapping is set, for the following frames to reuse\n"
+"kernel void reinhardLocal(	__read_only image2d_t input_image,\n"
+"							__write_only image2d_t output_image,\n"
+"							__global float* Ld_array,	//array to hold the mappings for each pixel\n"
+"							__global float* lumMips,	//contains the entire mipmap pyramid for the luminance of the image\n"
+"							__global int* m_width,	//width of each of the mipmaps\n"
+"							__global int* m_offset,	///set of indices denotaing the start point of each mipmap in lumMips array\n"
+"							__global float* logAvgLum_acc,\n"
+"							const int2 img_size,\n"
+"							const float key,\n"
+"							const float sat,\n"
+"							const float epsilon,\n"
+"							const float phi,\n"
+"							const int store_mapping) {\n"
+"\n"
+"	float factor = key/logAvgLum_acc[0];\n"
+"\n"
+"	const float scale_sq[7] = {1.f, 2.f*2.f, 4.f*4.f, 8.f*8.f, 16.f*16.f, 32.f*32.f, 64.f*64.f};\n"
+"	float k[7];\n"
+"	for (int i=0; i<NUM_MIPMAPS-1; i++) {\n"
+"		k[i] = pow(2.f, phi)*key/scale_sq[i];\n"
+"	}\n"
+"	int2 pos;\n"
+"	float mappings[VECTOR_WIDTH];\n"
+"	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {\n"
+"		for (pos.x = get_global_id(0)*VECTOR_WIDTH; pos.x < img_size.x; pos.x += get_global_size(0)*VECTOR_WIDTH) {\n"
+"			//the scale selection branches for each pixel, so only the tone mapping is vectorised\n"
+"			for (int i = 0; i < VECTOR_WIDTH; i++) {\n"
+"				int2 pixel_pos = (int2)(min(pos.x+i, img_size.x-1), pos.y);\n"
+"				mappings[i] = localMapping(lumMips, m_width, m_offset, k, factor, epsilon, pixel_pos);\n"
+"			}\n"
+"			floatv mapping = VLOAD(0, mappings);\n"
+"			if (store_mapping) write_values(Ld_array, pos.x + pos.y*img_size.x, img_size.x - pos.x, mapping);\n"
+"			tonemapPixels(input_image, output_image, mapping, sat, pos, img_size.x);\n"
+"		}\n"
+"	}\n"
+"}\n"
+"\n"
+"//applies the previously computed mappings to image pixels\n"
+"kernel void tonemap(__read_only image2d_t input_image,\n"
+"					__write_only image2d_t output_image,\n"
+"					__global float* Ld_array,\n"
+"					const int2 img_size,\n"
+"					const float sat) {\n"
+"	int2 pos;\n"
+"	for (pos.y = get_global_id(1); pos.y < img_size.y; pos.y += get_global_size(1)) {\n"
+"		for (pos.x = get_global_id(0)*VECTOR_WIDTH; pos.x < img_size.x; pos.x += get_global_size(0)*VECTOR_WIDTH) {\n"
+"			floatv mapping = read_values(Ld_array, pos.x + pos.y*img_size.x, img_size.x - pos.x);\n"
+"			tonemapPixels(input_image, output_image, mapping, sat, pos, img_size.x);\n"
+"		}\n"
+"	}\n"
+"}\n"
+;
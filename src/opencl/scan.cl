@@ -0,0 +1,48 @@
+// scan.cl (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#ifndef SCAN_TYPE
+#define SCAN_TYPE uint
+#endif
+
+//work-efficient (Blelloch) exclusive prefix sum of n values in local memory, computed by the whole work group
+//n must be a power of two, each work item handling n/(2*local size) pairs of values at every step
+//must be reached by all the work items of the group, the result being visible to all of them on return
+void exclusive_scan(__local SCAN_TYPE* data, const int n) {
+	const int lid = get_local_id(0);
+	const int local_size = get_local_size(0);
+
+	//up-sweep, building a tree of partial sums in place
+	int offset = 1;
+	for (int d = n/2; d > 0; d /= 2) {
+		barrier(CLK_LOCAL_MEM_FENCE);
+		for (int i = lid; i < d; i += local_size) {
+			int a = offset*(2*i+1) - 1;
+			int b = offset*(2*i+2) - 1;
+			data[b] += data[a];
+		}
+		offset *= 2;
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (lid == 0) data[n-1] = 0;
+
+	//down-sweep, pushing the sums of the left subtrees to the right
+	for (int d = 1; d < n; d *= 2) {
+		offset /= 2;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		for (int i = lid; i < d; i += local_size) {
+			int a = offset*(2*i+1) - 1;
+			int b = offset*(2*i+2) - 1;
+			SCAN_TYPE t = data[a];
+			data[a] = data[b];
+			data[b] += t;
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+}
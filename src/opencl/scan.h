@@ -0,0 +1,50 @@
+static const char *scan_kernel =
+"// scan.cl (HDR)\n"
+"// Copyright (c) 2014, Amir Chohan,\n"
+"// University of Bristol. All rights reserved.\n"
+"//\n"
+"// This program is provided under a three-clause BSD license. For full\n"
+"// license terms please see the LICENSE file distributed with this\n"
+"// source code.\n"
+"\n"
+"#ifndef SCAN_TYPE\n"
+"#define SCAN_TYPE uint\n"
+"#endif\n"
+"\n"
+"//work-efficient (Blelloch) exclusive prefix sum of n values in local memory, computed by the whole work group\n"
+"//n must be a power of two, each work item handling n/(2*local size) pairs of values at every step\n"
+"//must be reached by all the work items of the group, the result being visible to all of them on return\n"
+"void exclusive_scan(__local SCAN_TYPE* data, const int n) {\n"
+"	const int lid = get_local_id(0);\n"
+"	const int local_size = get_local_size(0);\n"
+"\n"
+"	//up-sweep, building a tree of partial sums in place\n"
+"	int offset = 1;\n"
+"	for (int d = n/2; d > 0; d /= 2) {\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+"		for (int i = lid; i < d; i += local_size) {\n"
+"			int a = offset*(2*i+1) - 1;\n"
+"			int b = offset*(2*i+2) - 1;\n"
+"			data[b] += data[a];\n"
+"		}\n"
+"		offset *= 2;\n"
+"	}\n"
+"\n"
+"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+"	if (lid == 0) data[n-1] = 0;\n"
+"\n"
+"	//down-sweep, pushing the sums of the left subtrees to the right\n"
+"	for (int d = 1; d < n; d *= 2) {\n"
+"		offset /= 2;\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+"		for (int i = lid; i < d; i += local_size) {\n"
+"			int a = offset*(2*i+1) - 1;\n"
+"			int b = offset*(2*i+2) - 1;\n"
+"			SCAN_TYPE t = data[a];\n"
+"			data[a] = data[b];\n"
+"			data[b] += t;\n"
+"		}\n"
+"	}\n"
+"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+"}\n"
+;
@@ -1,6 +1,6 @@
 #!/bin/bash
 
-kernels="histEq reinhardGlobal reinhardLocal gradDom"
+kernels="common histEq reinhardGlobal reinhardLocal gradDom mipmap scan vector"
 
 for name in $kernels
 do
@@ -14,7 +14,7 @@ do
     fi
     echo "Generating OpenCL $name kernel"
 
-    echo "const char *"$name"_kernel =" >$OUT
+    echo "static const char *"$name"_kernel =" >$OUT
     sed -e 's/\\/\\\\/g;s/"/\\"/g;s/  /\\t/g;s/^/"/;s/$/\\n"/' $IN >>$OUT
     if [ $? -ne 0 ]
     then
@@ -0,0 +1,111 @@
+// vector.cl (HDR)
+// Copyright (c) 2014, Amir Chohan,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+//the per-pixel kernels process VECTOR_WIDTH consecutive pixels of a row in each work item
+//so the arithmetic of the pixels is done with vector types, which the host picks with -D VECTOR_WIDTH
+#ifndef VECTOR_WIDTH
+#define VECTOR_WIDTH 1
+#endif
+
+#if VECTOR_WIDTH == 8
+typedef float8 floatv;
+#define VLOAD(offset, p) vload8(offset, p)
+#define VSTORE(v, offset, p) vstore8(v, offset, p)
+#elif VECTOR_WIDTH == 4
+typedef float4 floatv;
+#define VLOAD(offset, p) vload4(offset, p)
+#define VSTORE(v, offset, p) vstore4(v, offset, p)
+#else
+typedef float floatv;
+#define VLOAD(offset, p) ((p)[offset])
+#define VSTORE(v, offset, p) ((p)[offset] = (v))
+#endif
+
+
+//reads the VECTOR_WIDTH pixels of a row starting at pos, those past the end of the row being black
+//the alpha channel is passed through as it is
+void read_pixels(__read_only image2d_t image, const int2 pos, const int width, floatv* r, floatv* g, floatv* b, floatv* a) {
+	float _r[VECTOR_WIDTH], _g[VECTOR_WIDTH], _b[VECTOR_WIDTH], _a[VECTOR_WIDTH];
+	for (int i = 0; i < VECTOR_WIDTH; i++) {
+		float4 pixel = (pos.x+i < width) ? read_input(image, (int2)(pos.x+i, pos.y)) : (float4)(0.f);
+		_r[i] = pixel.x;
+		_g[i] = pixel.y;
+		_b[i] = pixel.z;
+		_a[i] = pixel.w;
+	}
+	*r = VLOAD(0, _r);
+	*g = VLOAD(0, _g);
+	*b = VLOAD(0, _b);
+	*a = VLOAD(0, _a);
+}
+
+//writes the VECTOR_WIDTH pixels of a row starting at pos which are within the row, the colours being clamped to [0, 255]
+void write_pixels(__write_only image2d_t image, const int2 pos, const int width, floatv r, floatv g, floatv b, floatv a) {
+	float _r[VECTOR_WIDTH], _g[VECTOR_WIDTH], _b[VECTOR_WIDTH], _a[VECTOR_WIDTH];
+	VSTORE(clamp(r, 0.f, 255.f), 0, _r);
+	VSTORE(clamp(g, 0.f, 255.f), 0, _g);
+	VSTORE(clamp(b, 0.f, 255.f), 0, _b);
+	VSTORE(a, 0, _a);
+	for (int i = 0; i < VECTOR_WIDTH && pos.x+i < width; i++) {
+		write_imageui(image, (int2)(pos.x+i, pos.y), (uint4)(_r[i], _g[i], _b[i], _a[i]));
+	}
+}
+
+//reads the VECTOR_WIDTH values of a row of a buffer starting at index, those past the end of the row being zero
+floatv read_values(__global float* data, const int index, const int remaining) {
+	if (remaining >= VECTOR_WIDTH) return VLOAD(0, data + index);
+	float _v[VECTOR_WIDTH];
+	for (int i = 0; i < VECTOR_WIDTH; i++) _v[i] = (i < remaining) ? data[index+i] : 0.f;
+	return VLOAD(0, _v);
+}
+
+//writes the VECTOR_WIDTH values of a row of a buffer starting at index which are within the row
+void write_values(__global float* data, const int index, const int remaining, floatv v) {
+	if (remaining >= VECTOR_WIDTH) {
+		VSTORE(v, 0, data + index);
+		return;
+	}
+	float _v[VECTOR_WIDTH];
+	VSTORE(v, 0, _v);
+	for (int i = 0; i < remaining; i++) data[index+i] = _v[i];
+}
+
+//1 for the components within the remaining pixels of a row and 0 for those past its end
+floatv lane_mask(const int remaining) {
+	float _m[VECTOR_WIDTH];
+	for (int i = 0; i < VECTOR_WIDTH; i++) _m[i] = (i < remaining) ? 1.f : 0.f;
+	return VLOAD(0, _m);
+}
+
+//luminance of linear RGB, the Y of RGBtoXYZ
+floatv luminance(floatv r, floatv g, floatv b) {
+	return r*0.2126f + g*0.7152f + b*0.0722f;
+}
+
+//sum and maximum of the components of a vector
+float sum_components(floatv v) {
+#if VECTOR_WIDTH == 8
+	v.lo += v.hi;
+#endif
+#if VECTOR_WIDTH >= 4
+	return v.s0 + v.s1 + v.s2 + v.s3;
+#else
+	return v;
+#endif
+}
+
+float max_components(floatv v) {
+#if VECTOR_WIDTH == 8
+	v.lo = fmax(v.lo, v.hi);
+#endif
+#if VECTOR_WIDTH >= 4
+	return fmax(fmax(v.s0, v.s1), fmax(v.s2, v.s3));
+#else
+	return v;
+#endif
+}
@@ -0,0 +1,113 @@
+static const char *vector_kernel =
+"// vector.cl (HDR)\n"
+"// Copyright (c) 2014, Amir Chohan,\n"
+"// University of Bristol. All rights reserved.\n"
+"//\n"
+"// This program is provided under a three-clause BSD license. For full\n"
+"// license terms please see the LICENSE file distributed with this\n"
+"// source code.\n"
+"\n"
+"//the per-pixel kernels process VECTOR_WIDTH consecutive pixels of a row in each work item\n"
+"//so the arithmetic of the pixels is done with vector types, which the host picks with -D VECTOR_WIDTH\n"
+"#ifndef VECTOR_WIDTH\n"
+"#define VECTOR_WIDTH 1\n"
+"#endif\n"
+"\n"
+"#if VECTOR_WIDTH == 8\n"
+"typedef float8 floatv;\n"
+"#define VLOAD(offset, p) vload8(offset, p)\n"
+"#define VSTORE(v, offset, p) vstore8(v, offset, p)\n"
+"#elif VECTOR_WIDTH == 4\n"
+"typedef float4 floatv;\n"
+"#define VLOAD(offset, p) vload4(offset, p)\n"
+"#define VSTORE(v, offset, p) vstore4(v, offset, p)\n"
+"#else\n"
+"typedef float floatv;\n"
+"#define VLOAD(offset, p) ((p)[offset])\n"
+"#define VSTORE(v, offset, p) ((p)[offset] = (v))\n"
+"#endif\n"
+"\n"
+"\n"
+"//reads the VECTOR_WIDTH pixels of a row starting at pos, those past the end of the row being black\n"
+"//the alpha channel is passed through as it is\n"
+"void read_pixels(__read_only image2d_t image, const int2 pos, const int width, floatv* r, floatv* g, floatv* b, floatv* a) {\n"
+"	float _r[VECTOR_WIDTH], _g[VECTOR_WIDTH], _b[VECTOR_WIDTH], _a[VECTOR_WIDTH];\n"
+"	for (int i = 0; i < VECTOR_WIDTH; i++) {\n"
+"		float4 pixel = (pos.x+i < width) ? read_input(image, (int2)(pos.x+i, pos.y)) : (float4)(0.f);\n"
+"		_r[i] = pixel.x;\n"
+"		_g[i] = pixel.y;\n"
+"		_b[i] = pixel.z;\n"
+"		_a[i] = pixel.w;\n"
+"	}\n"
+"	*r = VLOAD(0, _r);\n"
+"	*g = VLOAD(0, _g);\n"
+"	*b = VLOAD(0, _b);\n"
+"	*a = VLOAD(0, _a);\n"
+"}\n"
+"\n"
+"//writes the VECTOR_WIDTH pixels of a row starting at pos which are within the row, the colours being clamped to [0, 255]\n"
+"void write_pixels(__write_only image2d_t image, const int2 pos, const int width, floatv r, floatv g, floatv b, floatv a) {\n"
+"	float _r[VECTOR_WIDTH], _g[VECTOR_WIDTH], _b[VECTOR_WIDTH], _a[VECTOR_WIDTH];\n"
+"	VSTORE(clamp(r, 0.f, 255.f), 0, _r);\n"
+"	VSTORE(clamp(g, 0.f, 255.f), 0, _g);\n"
+"	VSTORE(clamp(b, 0.f, 255.f), 0, _b);\n"
+"	VSTORE(a, 0, _a);\n"
+"	for (int i = 0; i < VECTOR_WIDTH && pos.x+i < width; i++) {\n"
+"		write_imageui(image, (int2)(pos.x+i, pos.y), (uint4)(_r[i], _g[i], _b[i], _a[i]));\n"
+"	}\n"
+"}\n"
+"\n"
+"//reads the VECTOR_WIDTH values of a row of a buffer starting at index, those past the end of the row being zero\n"
+"floatv read_values(__global float* data, const int index, const int remaining) {\n"
+"	if (remaining >= VECTOR_WIDTH) return VLOAD(0, data + index);\n"
+"	float _v[VECTOR_WIDTH];\n"
+"	for (int i = 0; i < VECTOR_WIDTH; i++) _v[i] = (i < remaining) ? data[index+i] : 0.f;\n"
+"	return VLOAD(0, _v);\n"
+"}\n"
+"\n"
+"//writes the VECTOR_WIDTH values of a row of a buffer starting at index which are within the row\n"
+"void write_values(__global float* data, const int index, const int remaining, floatv v) {\n"
+"	if (remaining >= VECTOR_WIDTH) {\n"
+"		VSTORE(v, 0, data + index);\n"
+"		return;\n"
+"	}\n"
+"	float _v[VECTOR_WIDTH];\n"
+"	VSTORE(v, 0, _v);\n"
+"	for (int i = 0; i < remaining; i++) data[index+i] = _v[i];\n"
+"}\n"
+"\n"
+"//1 for the components within the remaining pixels of a row and 0 for those past its end\n"
+"floatv lane_mask(const int remaining) {\n"
+"	float _m[VECTOR_WIDTH];\n"
+"	for (int i = 0; i < VECTOR_WIDTH; i++) _m[i] = (i < remaining) ? 1.f : 0.f;\n"
+"	return VLOAD(0, _m);\n"
+"}\n"
+"\n"
+"//luminance of linear RGB, the Y of RGBtoXYZ\n"
+"floatv luminance(floatv r, floatv g, floatv b) {\n"
+"	return r*0.2126f + g*0.7152f + b*0.0722f;\n"
+"}\n"
+"\n"
+"//sum and maximum of the components of a vector\n"
+"float sum_components(floatv v) {\n"
+"#if VECTOR_WIDTH == 8\n"
+"	v.lo += v.hi;\n"
+"#endif\n"
+"#if VECTOR_WIDTH >= 4\n"
+"	return v.s0 + v.s1 + v.s2 + v.s3;\n"
+"#else\n"
+"	return v;\n"
+"#endif\n"
+"}\n"
+"\n"
+"float max_components(floatv v) {\n"
+"#if VECTOR_WIDTH == 8\n"
+"	v.lo = fmax(v.lo, v.hi);\n"
+"#endif\n"
+"#if VECTOR_WIDTH >= 4\n"
+"	return fmax(fmax(v.s0, v.s1), fmax(v.s2, v.s3));\n"
+"#else\n"
+"	return v;\n"
+"#endif\n"
+"}\n"
+;